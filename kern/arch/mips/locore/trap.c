@@ -36,6 +36,7 @@
 #include <spl.h>
 #include <thread.h>
 #include <current.h>
+#include <usage.h>
 #include <vm.h>
 #include <mainbus.h>
 #include <syscall.h>
@@ -151,6 +152,11 @@ mips_trap(struct trapframe *tf)
 						+ STACK_SIZE));
 	}
 
+	/* Coming from user mode, so charge the time spent there. */
+	if (!iskern) {
+		usage_charge(true);
+	}
+
 	/* Interrupt? Call the interrupt handler and return. */
 	if (code == EX_IRQ) {
 		int old_in;
@@ -187,6 +193,9 @@ mips_trap(struct trapframe *tf)
 			doadjust = false;
 		}
 
+		/* For usage_tick(), if this is the clock. */
+		curcpu->c_intr_user = !iskern;
+
 		mainbus_interrupt(tf);
 
 		if (doadjust) {
@@ -334,6 +343,11 @@ mips_trap(struct trapframe *tf)
 		return;
 	}
 
+	/* Going back to user mode; charge the time spent in here. */
+	if (!iskern) {
+		usage_charge(false);
+	}
+
 	cputhreads[curcpu->c_number] = (vaddr_t)curthread;
 	cpustacks[curcpu->c_number] = (vaddr_t)curthread->t_stack + STACK_SIZE;
 
@@ -379,6 +393,9 @@ mips_usermode(struct trapframe *tf)
 	spl0();
 	cpu_irqoff();
 
+	/* Charge the time spent in the kernel getting here. */
+	usage_charge(false);
+
 	cputhreads[curcpu->c_number] = (vaddr_t)curthread;
 	cpustacks[curcpu->c_number] = (vaddr_t)curthread->t_stack + STACK_SIZE;
 
@@ -35,6 +35,7 @@
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
+#include <trace.h>
 #include <kern/wait.h>
 
 
@@ -102,6 +103,9 @@ syscall(struct trapframe *tf)
 	retval = 0;
 	retval_big = 0;
 
+	TRACE(TRACE_SYSCALL, curthread, callno, 0);
+	curthread->t_usage.u_nsyscalls++;
+
 	switch (callno) {
 	    case SYS_reboot:
 		err = sys_reboot(tf->tf_a0);
@@ -112,6 +116,11 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
 		case SYS_open:
 		err = sys_open((userptr_t)tf->tf_a0,
 					tf->tf_a1,
@@ -147,6 +156,47 @@ syscall(struct trapframe *tf)
 				&retval);
 		break;
 
+		case SYS_readv:
+		err = sys_readv(tf->tf_a0,
+				(const_userptr_t)tf->tf_a1,
+				(int) tf->tf_a2,
+				&retval);
+		break;
+
+		case SYS_writev:
+		err = sys_writev(tf->tf_a0,
+				(const_userptr_t)tf->tf_a1,
+				(int) tf->tf_a2,
+				&retval);
+		break;
+
+		/* The offset is past the registers, on the user stack */
+		case SYS_pread:
+		err = sys_pread(tf->tf_a0,
+				(userptr_t)tf->tf_a1,
+				(size_t) tf->tf_a2,
+				(const_userptr_t)(tf->tf_sp+16),
+				&retval);
+		break;
+
+		case SYS_pwrite:
+		err = sys_pwrite(tf->tf_a0,
+				(userptr_t)tf->tf_a1,
+				(size_t) tf->tf_a2,
+				(const_userptr_t)(tf->tf_sp+16),
+				&retval);
+		break;
+
+		/* len and flags are past the registers, on the user stack */
+		case SYS_copy_file_range:
+		err = sys_copy_file_range(tf->tf_a0,
+				(userptr_t)tf->tf_a1,
+				tf->tf_a2,
+				(userptr_t)tf->tf_a3,
+				(const_userptr_t)(tf->tf_sp+16),
+				&retval);
+		break;
+
 		case SYS_dup2:
 		err = sys_dup2(tf->tf_a0,
 				tf->tf_a1,
@@ -186,15 +236,52 @@ syscall(struct trapframe *tf)
 						(char **)tf->tf_a1);
 		break;
 
+		case SYS_spawn:
+		err = sys_spawn((userptr_t)tf->tf_a0, (char **)tf->tf_a1,
+				(const_userptr_t)tf->tf_a2, (int)tf->tf_a3,
+				&retval);
+		break;
+
+		case SYS_getrusage:
+		err = sys_getrusage((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
+
 		case SYS_sbrk:
 		err = sys_sbrk((ssize_t)tf->tf_a0, &retval);
 		break;
 
+		case SYS___threadfork:
+		err = sys___threadfork(tf, (userptr_t)tf->tf_a0,
+				       (userptr_t)tf->tf_a1, &retval);
+		break;
+
+		case SYS_threadjoin:
+		err = sys_threadjoin((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+				     &retval);
+		break;
+
+		case SYS_threadexit:
+		sys_threadexit((int)tf->tf_a0);
+		/* threadexit should never return */
+		break;
+
+		case SYS_futex_wait:
+		err = sys_futex_wait((userptr_t)tf->tf_a0, (int)tf->tf_a1,
+				     (const_userptr_t)tf->tf_a2);
+		break;
+
+		case SYS_futex_wake:
+		err = sys_futex_wake((userptr_t)tf->tf_a0, (int)tf->tf_a1,
+				     &retval);
+		break;
+
 	    default:
 		err = ENOSYS;
 		break;
 	}
 
+	TRACE(TRACE_SYSRET, curthread, callno, err);
+
 	if (err) {
 		/*
 		 * Return the error code. This gets converted at
@@ -196,6 +196,8 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	/* make sure it's page-aligned */
 	KASSERT((paddr & PAGE_FRAME) == paddr);
 
+	curthread->t_usage.u_minflt++;
+
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
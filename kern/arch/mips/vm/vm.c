@@ -187,6 +187,10 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	if (faultaddress < (as->as_stackbase) && faultaddress >= (as->as_heapbase + as->as_heapsz)) {
 		return SIGSEGV;
 	}
+	/* Off the bottom of a thread's stack */
+	if (faultaddress >= as->as_stackbase && as_is_stack_guard(faultaddress)) {
+		return SIGSEGV;
+	}
 		
 	faultaddress &= PAGE_FRAME;
 	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
@@ -206,6 +210,12 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	KASSERT(as->as_stackbase != 0);
 	KASSERT(as->as_pgtable != NULL);
 
+	/*
+	 * Threads of the same process can fault on the same page at
+	 * once; only one of them should allocate it.
+	 */
+	lock_acquire(as->as_fault_lock);
+
 	/* Index into the page table */
 	int outer_page_index = GET_OUTER_TABLE_INDEX(faultaddress);
 	int inner_page_index = GET_INNER_TABLE_INDEX(faultaddress);
@@ -228,6 +238,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	else {
 		as->as_pgtable->inner_mapping[outer_page_index] = create_inner_pgtable();
 		if (as->as_pgtable->inner_mapping[outer_page_index] == NULL) {
+			lock_release(as->as_fault_lock);
 			return ENOMEM;
 		}
 
@@ -236,11 +247,15 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		as->as_pgtable->inner_mapping[outer_page_index]->p_addrs[inner_page_index] = paddr;
 	}
 
+	lock_release(as->as_fault_lock);
+
 	/* make sure the physicial page is valid */
 	KASSERT(paddr != 0);
 	/* make sure it's page-aligned */
 	KASSERT((paddr & PAGE_FRAME) == paddr);
 
+	curthread->t_usage.u_minflt++;
+
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
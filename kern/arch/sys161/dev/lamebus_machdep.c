@@ -275,6 +275,16 @@ mainbus_send_ipi(struct cpu *target)
 	lamebus_assert_ipi(lamebus, target);
 }
 
+/*
+ * Push back the current cpu's next timer interrupt.
+ */
+void
+mainbus_timer_defer(unsigned nticks)
+{
+	KASSERT(nticks > 0);
+	mips_timer_set(nticks * (CPU_FREQUENCY / HZ));
+}
+
 /*
  * Interrupt dispatcher.
  */
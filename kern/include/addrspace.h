@@ -39,9 +39,21 @@
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct lock;
 
 #define DUMBVM_STACKPAGES    18
 
+/*
+ * Size of the stack region for each user-level thread. Thread N's
+ * stack is the Nth one down from USERSTACK, so thread 0 (the
+ * original one) keeps the usual stack. Below each stack is a guard
+ * page that is never mapped, so a thread that runs off the bottom of
+ * its stack faults instead of writing over the next thread's. Stacks
+ * don't grow: each is fixed at USER_THREAD_STACKPAGES.
+ */
+#define USER_THREAD_STACKPAGES	16
+#define USER_THREAD_SLOTPAGES	(USER_THREAD_STACKPAGES + 1)
+
 
 
 /*
@@ -65,6 +77,7 @@ struct addrspace {
         vaddr_t as_heapbase;
         size_t as_heapsz;
         vaddr_t as_stackbase;
+        struct lock *as_fault_lock;	/* for page table updates */
 #endif
 };
 
@@ -105,6 +118,13 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_define_thread_stack - make sure the stack region for user
+ *                thread TID is part of the address space, and hand
+ *                back the initial stack pointer for it.
+ *
+ *    as_is_stack_guard - true if the page at ADDR is the guard page
+ *                below some thread's stack, which must not be mapped.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -124,6 +144,9 @@ int               as_prepare_load(struct addrspace *as);
 void as_zero_region(paddr_t paddr, unsigned npages);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+bool              as_is_stack_guard(vaddr_t addr);
+int               as_define_thread_stack(struct addrspace *as, unsigned tid,
+                                         vaddr_t *initstackptr);
 
 
 /*
@@ -84,8 +84,54 @@ void timespec_sub(const struct timespec *t1,
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
+ *
+ * thread_sleep_ns() does the same for a number of nanoseconds, rounded
+ * up to a whole number of timer ticks.
  */
 void clocksleep(int seconds);
+void thread_sleep_ns(uint64_t nsecs);
+
+
+/*
+ * Timers.
+ *
+ * A timer calls a function once, at or shortly after a given time.
+ * Time here is counted in ticks (hardclocks on cpu 0) since boot, so
+ * timers have a resolution of 1/HZ seconds.
+ *
+ * Timer functions are called from the hardclock interrupt, without
+ * any locks held, and must not sleep.
+ *
+ * The structure is public so timers can be embedded in other things
+ * (or put on the stack), but callers should only use the functions.
+ *
+ *    timer_now      - current time, in ticks.
+ *    timer_ns2ticks - convert a duration to ticks, rounding up.
+ *    timer_init     - set up a timer to call FUNC(DATA).
+ *    timer_start    - arm the timer to go off at tick WHEN. If WHEN
+ *                     has already passed, it goes off on the next tick.
+ *                     Must not already be armed.
+ *    timer_stop     - disarm the timer. Returns true if it was armed
+ *                     and hadn't gone off. If the function is running
+ *                     on another cpu, waits for it to finish, so once
+ *                     this returns the timer may be freed; so, don't
+ *                     call it while holding anything the function
+ *                     needs.
+ */
+struct timer {
+	struct timer *tm_next;		/* link in wheel slot */
+	struct timer *tm_prev;
+	uint64_t tm_when;		/* tick to go off at */
+	void (*tm_func)(void *);	/* what to call */
+	void *tm_data;			/* argument for tm_func */
+	volatile unsigned tm_state;	/* see clock.c */
+};
+
+uint64_t timer_now(void);
+uint64_t timer_ns2ticks(uint64_t nsecs);
+void timer_init(struct timer *t, void (*func)(void *), void *data);
+void timer_start(struct timer *t, uint64_t when);
+bool timer_stop(struct timer *t);
 
 
 #endif /* _CLOCK_H_ */
@@ -32,10 +32,19 @@
 
 
 #include <spinlock.h>
+#include <lockstat.h>
+#include <trace.h>
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 
+/*
+ * Number of scheduler priority levels. Each cpu keeps one run queue
+ * per level; level 0 is the highest priority. See schedule() in
+ * thread.c for how threads move between levels.
+ */
+#define SCHED_NLEVELS	4
+
 /*
  * Per-cpu structure
  *
@@ -59,16 +68,49 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
-	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	struct threadlist c_threadcache; /* Recycled threads, with stacks */
+	unsigned c_hardclocks;		/* Counter of hardclock ticks */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	bool c_intr_user;		/* Last interrupt came from user mode */
+	uint32_t c_randseed;		/* State for picking steal victims */
+
+	/*
+	 * Scheduler placement counters, for thread_printstats().
+	 * Only updated by this cpu, with interrupts off.
+	 */
+	unsigned c_wake_affine;		/* Woken onto cpu last run on */
+	unsigned c_wake_moved;		/* Woken onto this cpu instead */
+	unsigned c_steal_cold;		/* Cache-cold threads stolen */
+	unsigned c_steal_hot;		/* Cache-hot threads left alone */
+
+	/*
+	 * Tickless operation; see thread_tick_defer(). Also only
+	 * touched by this cpu.
+	 */
+	uint64_t c_tickless_since;	/* timer_now() when tick deferred */
+	unsigned c_ticks_skipped;	/* Hardclocks not taken */
+	unsigned c_yields_skipped;	/* Quantum expiries with no switch */
+	unsigned c_migrations_skipped;	/* Migration checks not made */
+
+#if OPT_TRACE
+	/*
+	 * Event trace ring; see trace.h. Written only by this cpu,
+	 * with interrupts off; read by anyone.
+	 */
+	struct tracebuf c_trace;
+#endif
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	bool c_tickless;		/* True if hardclock is deferred */
+	struct threadlist c_runqueue[SCHED_NLEVELS]; /* Run queues, by priority */
 	struct spinlock c_runqueue_lock;
+#if OPT_LOCKSTAT
+	struct lockstat c_runqueue_stat; /* Profile of c_runqueue_lock */
+#endif
 
 	/*
 	 * Accessed by other cpus.
@@ -110,6 +152,14 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * cpu_count returns the number of cpus; cpu_get returns cpu number NUM,
+ * which must be less than that. cpus are never destroyed, so the
+ * pointer stays good.
+ */
+unsigned cpu_count(void);
+struct cpu *cpu_get(unsigned num);
+
 /*
  * Produce a string describing the CPU type.
  */
@@ -163,6 +213,7 @@ void cpu_halt(void);
 #define IPI_OFFLINE		1	/* CPU is requested to go offline */
 #define IPI_UNIDLE		2	/* Runnable threads are available */
 #define IPI_TLBSHOOTDOWN	3	/* MMU mapping(s) need invalidation */
+#define IPI_TICK		4	/* Hardclock should be re-armed */
 
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _EXECCACHE_H_
+#define _EXECCACHE_H_
+
+/*
+ * Exec image cache.
+ *
+ * load_elf gets the headers and segment contents of the program it is
+ * loading from here, instead of reading and checking the file itself.
+ * The cache keeps images of recently run programs, so running one
+ * again needs no disk I/O or parsing: only copying the segments into
+ * the new address space.
+ *
+ * Images are keyed by vnode. Each cached image holds a reference to
+ * its vnode, so the vnode can't be recycled for another file while
+ * it's cached. The image also records the vnode's modification
+ * generation (see vnode_getgen), and once the file is written or
+ * truncated the image is stale and is read afresh. Images are evicted
+ * least recently used first, to keep the segment data held under a
+ * fixed budget. Programs too big to cache, with segments over a
+ * fixed limit, still get an image, but its segments are read straight
+ * from the file and it isn't kept.
+ *
+ * The cache keeps copies of the segments' file bytes, not physical
+ * pages shared by every process running the program. The VM system
+ * (arch/mips/vm/vm.c) can't share pages between address spaces: a
+ * coremap entry records only a page's state, not how many page tables
+ * map it, and every user page is mapped writable (as_define_region
+ * ignores the segment permissions and vm_fault always sets the dirty
+ * bit), so a write to a shared text page couldn't be caught and
+ * copied. Each exec still copies the segments into pages of its own.
+ *
+ * Since cached images keep their files open, execcache_flush must be
+ * called before unmounting a filesystem; vfs_unmount does so.
+ */
+
+#include <elf.h>
+
+struct vnode;
+
+/*
+ * A loadable segment. es_data is the cache's own copy of the file
+ * bytes, which load_elf copies into the new process's pages.
+ */
+struct execseg {
+	Elf_Phdr es_ph;			/* program header */
+	char *es_data;			/* p_filesz bytes of file, or NULL */
+};
+
+struct execimage {
+	struct vnode *ei_vn;		/* the file; we hold a reference */
+	unsigned ei_gen;		/* its generation when read */
+	vaddr_t ei_entry;		/* entry point */
+	unsigned ei_nsegs;		/* number of PT_LOAD segments */
+	struct execseg *ei_segs;	/* the PT_LOAD segments */
+	size_t ei_size;			/* bytes of segment data held */
+	unsigned ei_refcount;		/* loads using it now */
+	bool ei_cached;			/* whether on the cache list */
+	struct execimage *ei_next;	/* cache list, most recent first */
+};
+
+/*
+ * execcache_bootstrap - set up; call once during startup.
+ * execcache_get       - get the image for the executable V, reading
+ *                       and checking it if need be. Fails with ENOEXEC
+ *                       if it isn't one we can run.
+ * execcache_put       - done with an image from execcache_get.
+ * execcache_flush     - drop everything cached.
+ * execcache_printstats - print hits, misses, and what's cached.
+ */
+void execcache_bootstrap(void);
+int execcache_get(struct vnode *v, struct execimage **ret);
+void execcache_put(struct execimage *ei);
+void execcache_flush(void);
+void execcache_printstats(void);
+
+#endif /* _EXECCACHE_H_ */
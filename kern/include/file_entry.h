@@ -32,6 +32,7 @@
 
 #include <types.h>
 #include <synch.h>
+#include <spinlock.h>
 
 /* 
  * File entry structure that represents one entry in the process' file table.
@@ -42,7 +43,13 @@ struct file_entry {
     off_t fe_offset; /* Corresponding uio for file descriptor */
     struct vnode *fe_vn; /* Corresponding abstract file representation */
 	char *fe_filename; /* name of the correponding file */
-	int fe_refcount; /* Number of references to this fe in the filetable */
+	/*
+	 * References: one per file table slot holding this fe (in any process), plus one
+	 * for each system call using it at the moment. Under fe_countlock, not fe_lock,
+	 * so taking a reference never waits for I/O in progress.
+	 */
+	int fe_refcount;
+	struct spinlock fe_countlock;
 };
 
 #endif
@@ -37,6 +37,12 @@ int sys_open(userptr_t filename, int flags, mode_t mode, int *retval);
 int sys_lseek(int fd, off_t higher_pos, off_t lower_pos, int whence, off_t *retval);
 int sys_read(int fd, userptr_t buf, size_t buflen, int *retval);
 int sys_write(int fd, userptr_t buf, size_t nbytes, int *retval);
+int sys_readv(int fd, const_userptr_t iov, int iovcnt, int *retval);
+int sys_writev(int fd, const_userptr_t iov, int iovcnt, int *retval);
+int sys_pread(int fd, userptr_t buf, size_t buflen, const_userptr_t posptr, int *retval);
+int sys_pwrite(int fd, userptr_t buf, size_t nbytes, const_userptr_t posptr, int *retval);
+int sys_copy_file_range(int infd, userptr_t inposp, int outfd, userptr_t outposp,
+                        const_userptr_t stackargs, int *retval);
 int sys_close(int fd);
 int sys_dup2( int oldfd, int newfd, int *retval);
 #endif
\ No newline at end of file
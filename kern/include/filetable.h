@@ -44,21 +44,41 @@
 #include <spl.h>
 #include <vnode.h>
 
+/* Slots a new file table starts with; it doubles as needed, up to __OPEN_MAX. */
+#define FT_INITSIZE	8
+
+/* Words in the bitmap of file handles in use */
+#define FT_MAPWORDS	((__OPEN_MAX + 31) / 32)
+
 /*
  * File table structure, which contains a lock and an array of file entries.
  * Note that the indices of ft_file_entries will correspond to each file entry's 
- * file handle.
+ * file handle. The array only has ft_size slots; it grows when a file handle past
+ * the end is handed out. ft_inuse has a bit set for each file handle that is taken,
+ * so the lowest free one can be found a word at a time, and fork only has to visit
+ * open files.
+ *
+ * Changes to the table (open, close, dup2) are serialized by ft_rwlock held for writing.
+ * The slots and ft_size are also protected by ft_slotlock, which is all filetable_get
+ * needs, so looking up a file handle takes no sleep lock.
  */
 struct filetable {
-    struct file_entry *ft_file_entries[__OPEN_MAX];
-    struct lock *ft_lock; 
+    struct file_entry **ft_file_entries;
+    unsigned ft_size;
+    uint32_t ft_inuse[FT_MAPWORDS];
+    struct rwlock *ft_rwlock; 
+    struct spinlock ft_slotlock;
 };
 
 struct filetable * filetable_init(void);
 int file_open(char *filename, int flags, mode_t mode, int *retval);
 int file_close(int fd);
-int dup_file_close(int fd);
+int filetable_close(struct filetable *ft, int fd);
+int dup_file_close(struct filetable *ft, int fd);
+int filetable_dup2(struct filetable *ft, int oldfd, int newfd);
 int filetable_init_std(struct filetable *ft);
 void filetable_destroy(struct filetable *ft);
-void filetable_copy(struct filetable *new_ft, struct filetable *ft);
+int filetable_copy(struct filetable *new_ft, struct filetable *ft);
+int filetable_get(struct filetable *ft, int fd, struct file_entry **ret);
+void filetable_put(struct file_entry *fe);
 #endif
@@ -54,6 +54,7 @@
 #define SYS_waitpid      4
 #define SYS_getpid       5
 #define SYS_getppid      6
+#define SYS_spawn        126
 //                              (virtual memory)
 #define SYS_sbrk         7
 #define SYS_mmap         8
@@ -86,7 +87,7 @@
 //#define SYS_sigaltstack 33
 //                              (resource tracking and usage)
 //#define SYS_wait4      34
-//#define SYS_getrusage  35
+#define SYS_getrusage    35
 //                              (resource limits)
 //#define SYS_getrlimit  36
 //#define SYS_setrlimit  37
@@ -109,12 +110,12 @@
 #define SYS_close        49
 #define SYS_read         50
 #define SYS_pread        51
-//#define SYS_readv      52
+#define SYS_readv        52
 //#define SYS_preadv     53
 #define SYS_getdirentry  54
 #define SYS_write        55
 #define SYS_pwrite       56
-//#define SYS_writev     57
+#define SYS_writev       57
 //#define SYS_pwritev    58
 #define SYS_lseek        59
 #define SYS_flock        60
@@ -124,6 +125,7 @@
 #define SYS_ioctl        64
 #define SYS_select       65
 #define SYS_poll         66
+#define SYS_copy_file_range 127
 
 //                              -- Pathname-related --
 #define SYS_link         67
@@ -197,6 +199,13 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- Threads and synchronization --
+#define SYS___threadfork 121
+#define SYS_threadjoin   122
+#define SYS_threadexit   123
+#define SYS_futex_wait   124
+#define SYS_futex_wake   125
+
 /*CALLEND*/
 
 
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_TRACE_H_
+#define _KERN_TRACE_H_
+
+/*
+ * Scheduler trace definitions visible to userspace. This covers the
+ * format of trace dump files and is used by tracedump to decode them.
+ *
+ * A dump file is a struct trace_header, then for each cpu a struct
+ * trace_cpuheader followed by tc_count records, oldest first. All
+ * fields are in the kernel's (big-endian) byte order.
+ */
+
+#define TRACE_MAGIC	0x7ace7ace	/* magic number for dump files */
+#define TRACE_VERSION	1		/* format version */
+
+/* Event types for tr_type, and what the arguments are */
+#define TRACE_NONE	0	/* unused slot */
+#define TRACE_SWITCHOUT	1	/* tr_a: new state of outgoing thread */
+#define TRACE_SWITCHIN	2	/* tr_a: priority of incoming thread */
+#define TRACE_WAKEUP	3	/* tr_a: cpu queued on, tr_b: priority */
+#define TRACE_MIGRATE	4	/* tr_a: old cpu, tr_b: new cpu */
+#define TRACE_IPI	5	/* tr_a: target cpu, tr_b: IPI code */
+#define TRACE_SYSCALL	6	/* tr_a: call number */
+#define TRACE_SYSRET	7	/* tr_a: call number, tr_b: error code */
+#define TRACE_NTYPES	8
+
+/*
+ * One event. tr_thread identifies the thread the event is about (by
+ * its kernel address), which is not always the one running: for
+ * wakeups and migrations it's the thread being moved.
+ */
+struct trace_record {
+	uint32_t tr_sec;		/* time of day, seconds */
+	uint32_t tr_nsec;		/* and nanoseconds */
+	uint16_t tr_type;		/* TRACE_* */
+	uint16_t tr_cpu;		/* cpu that recorded it */
+	uint32_t tr_thread;		/* thread concerned */
+	uint32_t tr_a;			/* arguments, depending on type */
+	uint32_t tr_b;
+};
+
+struct trace_header {
+	uint32_t th_magic;		/* TRACE_MAGIC */
+	uint32_t th_version;		/* TRACE_VERSION */
+	uint32_t th_ncpus;		/* number of cpu sections */
+	uint32_t th_nrecords;		/* ring size per cpu */
+};
+
+struct trace_cpuheader {
+	uint32_t tc_cpu;		/* cpu number */
+	uint32_t tc_count;		/* records that follow */
+	uint32_t tc_lost;		/* older records overwritten */
+};
+
+#endif /* _KERN_TRACE_H_ */
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention profiling.
+ *
+ * Each profiled lock carries a struct lockstat counting acquisitions,
+ * acquisitions that had to wait, total time spent waiting, and the
+ * longest time the lock was held. Locks are grouped into classes by
+ * name, so e.g. all the per-file "fe_lock"s are reported together;
+ * when a lock is destroyed its counts are folded into its class.
+ *
+ * Sleep locks and rwlocks are always profiled. Spinlocks are only
+ * profiled if attached to a lockstat with spinlock_setstat(), since
+ * most spinlocks have no name and are held for a few instructions.
+ *
+ * Counting is always on; the counters are updated under the lock
+ * being profiled, so they cost a few increments. Wait times are
+ * measured from lockstat_bootstrap() on, but only for acquisitions
+ * that actually wait, where two clock reads are lost in the wait.
+ * Hold times need the clock read on every acquire and release, which
+ * is several device register reads each, so they are only collected
+ * while timing is turned on from the menu. It starts off.
+ *
+ * Only available if OPT_LOCKSTAT is set.
+ */
+
+#include <kern/time.h>
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+
+/* Longest name kept for a lock class; longer names are truncated. */
+#define LOCKSTAT_NAMELEN	24
+
+struct lockstat_class;		/* Opaque */
+
+struct lockstat {
+	struct lockstat_class *ls_class;	/* class, by name */
+	struct lockstat *ls_prev;		/* live locks in class */
+	struct lockstat *ls_next;
+	unsigned ls_acquires;			/* total acquisitions */
+	unsigned ls_contended;			/* ... that had to wait */
+	uint64_t ls_waitns;			/* total time waited */
+	uint64_t ls_maxholdns;			/* longest hold */
+	bool ls_holdtimed;			/* ls_holdstart is valid */
+	struct timespec ls_holdstart;		/* when last acquired */
+};
+
+/*
+ * Setup and teardown.
+ *
+ * lockstat_bootstrap - start timing waits; call once the clock is
+ *                      attached.
+ * lockstat_init      - set up a lockstat and enter it in the class
+ *                      for NAME. SPIN says if it's for a spinlock.
+ *                      May sleep (for kmalloc) the first time a name
+ *                      is seen.
+ * lockstat_cleanup   - fold the counts into the class and take the
+ *                      lockstat out of it.
+ */
+void lockstat_bootstrap(void);
+void lockstat_init(struct lockstat *ls, const char *name, bool spin);
+void lockstat_cleanup(struct lockstat *ls);
+
+/*
+ * Hooks for the lock code. All must be called with the lock being
+ * profiled (or, for rwlocks and sleep locks, its internal spinlock)
+ * held, except lockstat_waitstart, which is called just before
+ * starting to wait.
+ *
+ * lockstat_waitstart - note the time a wait began in *START, or
+ *                      zero it if the clock isn't there yet.
+ * lockstat_acquired  - count an acquisition. If CONTENDED, START is
+ *                      what lockstat_waitstart filled in. If HOLD,
+ *                      start timing the hold.
+ * lockstat_released  - finish timing a hold.
+ */
+void lockstat_waitstart(struct timespec *start);
+void lockstat_acquired(struct lockstat *ls, bool contended,
+		       const struct timespec *start, bool hold);
+void lockstat_released(struct lockstat *ls);
+
+/*
+ * Reporting.
+ *
+ * lockstat_print     - print the N lock classes with the most
+ *                      contended acquisitions.
+ * lockstat_reset     - zero all counters.
+ * lockstat_settiming - turn hold timing on or off.
+ */
+void lockstat_print(unsigned n);
+void lockstat_reset(void);
+void lockstat_settiming(bool on);
+
+#endif /* OPT_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H_ */
@@ -55,6 +55,13 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/*
+ * Make the current cpu's next timer interrupt come NTICKS ticks from
+ * now instead of one. The interrupt handler goes back to one tick at
+ * a time by itself.
+ */
+void mainbus_timer_defer(unsigned nticks);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
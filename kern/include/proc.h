@@ -40,14 +40,24 @@
 #define ORPHAN		2 /* PID of a running process with no parent */
 #define ZOMBIE		3 /* PID of a process that has finished and is waiting to be cleaned up */
 
+/*
+ * Most user-level threads a process can have at once, counting exited
+ * ones that haven't been joined. Thread 0 is the one the process
+ * started with. Must fit in the bits of p_uthreads_running.
+ */
+#define USER_THREAD_MAX	32
+
 
 #include <spinlock.h>
 #include <thread.h> /* required for struct threadarray */
+#include <usage.h>
 #include <filetable.h>
 #include <types.h>
 
 struct addrspace;
 struct vnode;
+struct lock;
+struct cv;
 
 /*
  * Process structure.
@@ -58,7 +68,24 @@ struct proc {
 	struct threadarray p_threads;	/* Threads in this process */
 	pid_t p_pid;	/* The process' PID */
 
-	struct array *p_children;	/* An array of the process' children's PIDs */
+	/*
+	 * Parent, children, and where the parent waits for children to
+	 * exit. All used under pid_table_lk. p_parent is only valid while
+	 * our PID table status is OCCUPIED (or ZOMBIE); once the parent
+	 * exits we're an ORPHAN and it's NULL.
+	 *
+	 * The children are a list linked through p_sibnext/p_sibprev,
+	 * with the zombies kept at the front in the order they exited,
+	 * so waitpid(-1) only has to look at the head. p_zombietail is
+	 * the last zombie, or NULL if there are none.
+	 */
+	struct proc *p_parent;
+	struct proc *p_childhead;
+	struct proc *p_childtail;
+	struct proc *p_zombietail;
+	struct proc *p_sibnext;
+	struct proc *p_sibprev;
+	struct cv *p_waitcv;
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
@@ -68,6 +95,48 @@ struct proc {
 
 	/* Filetable */
 	struct filetable *p_filetable;
+
+	/*
+	 * User-level threads (see thread_syscalls.c). Slots are
+	 * indexed by thread id; a slot is in use while its thread
+	 * runs and, after it exits, until someone joins it. All
+	 * protected by p_uthread_lock.
+	 */
+	struct lock *p_uthread_lock;
+	struct cv *p_uthread_cv;		/* signalled when a thread exits */
+	unsigned p_nuthreads;			/* running user threads */
+	uint32_t p_uthreads_running;		/* bitmap of running threads */
+	uint32_t p_uthreads_exited;		/* bitmap of unjoined threads */
+	int p_uthread_status[USER_THREAD_MAX];	/* exit status, if exited */
+	int p_exitcode;				/* for when the last one exits */
+
+	/*
+	 * Resources used (see usage.h), protected by p_lock: by our
+	 * threads that have left, and in all by the children we reaped.
+	 */
+	struct usage p_usage;
+	struct usage p_childusage;
+};
+
+/*
+ * Number of slots in the PID table, and so the most processes that can
+ * exist at once (less the two reserved slots). PIDs are not slot
+ * numbers: each time a slot is reused its PID goes up by
+ * PID_TABLE_SIZE, wrapping at __PID_MAX, so a PID isn't handed out
+ * again soon after it's freed. The slot for a PID is PID %
+ * PID_TABLE_SIZE.
+ */
+#define PID_TABLE_SIZE	1024
+
+/*
+ * One slot of the PID table. Everything about a PID sits together.
+ */
+struct pid_entry {
+	pid_t pe_pid;		/* PID in use, or next PID to issue if free */
+	int pe_status;		/* AVAILABLE, OCCUPIED, ORPHAN or ZOMBIE */
+	int pe_exitcode;	/* Exit code, once ZOMBIE */
+	struct proc *pe_proc;	/* The process */
+	unsigned pe_nextfree;	/* Next slot on the free list */
 };
 
 /* 
@@ -75,18 +144,19 @@ struct proc {
  */
 struct pid_table{
 	struct lock *pid_table_lk; /* lock to synchronize children table */
-	/* Note: Index number in the arrays represents the corresponding PID of entry*/
-	/* Array of process statuses, as defined above */
-	struct array *process_statuses;
-	struct array *processes;
-	struct array *process_exitcodes;
-	// int process_statuses[__PID_MAX];
-	// /* Array of processes */
-	// struct proc *processes[__PID_MAX];
-	// /* Array of process exit codes */
-	// int process_exitcodes[__PID_MAX];
-	/* CV used to implement wait cv */
-	struct cv *pid_table_cv;
+	/*
+	 * Lookups only need pid_table_rwlk held for reading. Updates need
+	 * pid_table_lk (so waiters on p_waitcv see them) and then
+	 * pid_table_rwlk held for writing.
+	 */
+	struct rwlock *pid_table_rwlk;
+	/*
+	 * Free slots, oldest-freed first so PIDs are reused as late as
+	 * possible. PID_TABLE_SIZE means none.
+	 */
+	unsigned pid_freehead;
+	unsigned pid_freetail;
+	struct pid_entry pid_entries[PID_TABLE_SIZE];
 };
 
 /* This is the globally accessible pid_table */
@@ -104,6 +174,9 @@ struct proc *proc_create_runprogram(const char *name);
 /* Create a new forked child process */
 struct proc *proc_create_fork(const char *name, int *err);
 
+/* Create a new child process with no address space, for spawn */
+struct proc *proc_create_spawn(const char *name, int *err);
+
 /* Destroy a process. */
 void proc_destroy(struct proc *proc);
 
@@ -113,6 +186,20 @@ int proc_addthread(struct proc *proc, struct thread *t);
 /* Detach a thread from its process. */
 void proc_remthread(struct thread *t);
 
+/* Get the resources used so far by a process, not counting children. */
+void proc_getusage(struct proc *proc, struct usage *ret);
+
+/*
+ * Child list upkeep; call with pid_table_lk held.
+ * proc_addchild     - add a new, running child at the back.
+ * proc_remchild     - take a child out of the list.
+ * proc_zombiechild  - move a child that just exited to the back of
+ *                     the zombies at the front.
+ */
+void proc_addchild(struct proc *parent, struct proc *child);
+void proc_remchild(struct proc *parent, struct proc *child);
+void proc_zombiechild(struct proc *parent, struct proc *child);
+
 /* Fetch the address space of the current process. */
 struct addrspace *proc_getas(void);
 
@@ -120,8 +207,10 @@ struct addrspace *proc_getas(void);
 struct addrspace *proc_setas(struct addrspace *);
 
 pid_t issue_pid(void);
-void configure_pid_fields(struct proc *child_proc);
+int configure_pid_fields(struct proc *child_proc);
+void unconfigure_pid_fields(struct proc *child_proc);
 void init_pid_table(void);
 void delete_pid_entry(pid_t pid);
+struct pid_entry *pid_lookup(pid_t pid);
 struct proc *get_process_from_pid(pid_t pid);
 #endif /* _PROC_H_ */
@@ -36,8 +36,12 @@
 int sys_fork(struct trapframe *tf, int *retval);
 int sys_execv(userptr_t program, char **args);
 void enter_new_forked_process(void *data1, unsigned long data2);
+int sys_spawn(userptr_t program, char **args, const_userptr_t actions, int nactions, int *retval);
+void enter_new_spawned_process(void *data1, unsigned long data2);
 int sys_getpid(int *retval);
 pid_t sys_waitpid(pid_t pid, int *status, int options, int *retval);
 bool is_child(pid_t pid);
+int sys_getrusage(int who, userptr_t usage);
 void sys__exit(int exitcode);
+void proc_exit(int exitcode);
 #endif
\ No newline at end of file
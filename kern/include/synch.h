@@ -36,6 +36,8 @@
 
 
 #include <spinlock.h>
+#include <lockstat.h>
+#include <cpu.h>	/* for SCHED_NLEVELS */
 
 /*
  * Dijkstra-style semaphore.
@@ -71,12 +73,36 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * Locks are adaptive: a thread that finds the lock held spins for a
+ * while if the holder is running on another cpu, on the theory that
+ * it will let go soon, and only goes to sleep if the holder is not
+ * running or the spin goes on too long. The lk_n* counters record
+ * which path each acquisition took; they are protected by lk_lock,
+ * as is lk_stat, the contention profile (see lockstat.h).
+ *
+ * Locks also do priority inheritance: a thread that sleeps waiting
+ * for a lock lends its priority to the holder, and through it to
+ * whoever holds the lock the holder is waiting for, and so on. The
+ * holder gets its own priority back as it releases the locks that
+ * were waited for. lk_nwaiters, lk_nwaiting, and lk_nextheld are for
+ * this; they are protected by a global spinlock in synch.c, and
+ * lk_nwaiters also by lk_lock.
  */
 struct lock {
         char *lk_name;
 	struct wchan *lk_wchan;
 	struct spinlock lk_lock;
 	struct thread *volatile lk_holder;
+	unsigned lk_nfast;		/* acquired without waiting */
+	unsigned lk_nspin;		/* acquired after spinning only */
+	unsigned lk_nsleep;		/* had to sleep at least once */
+	unsigned lk_nwaiters;		/* threads asleep waiting */
+	unsigned lk_nwaiting[SCHED_NLEVELS]; /* ... by priority lent */
+	struct lock *lk_nextheld;	/* holder's t_heldlocks list */
+#if OPT_LOCKSTAT
+	struct lockstat lk_stat;	/* contention profile */
+#endif
 };
 
 struct lock *lock_create(const char *name);
@@ -90,12 +116,15 @@ void lock_destroy(struct lock *);
  *                   this.
  *    lock_do_i_hold - Return true if the current thread holds the lock;
  *                   false otherwise.
+ *    lock_printstats - Print how many acquisitions took the fast, spin,
+ *                   and sleep paths.
  *
  * These operations must be atomic. You get to write them.
  */
 void lock_acquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
+void lock_printstats(struct lock *);
 
 
 /*
@@ -125,6 +154,9 @@ void cv_destroy(struct cv *);
  * Operations:
  *    cv_wait      - Release the supplied lock, go to sleep, and, after
  *                   waking up again, re-acquire the lock.
+ *    cv_timedwait - Like cv_wait, but give up and return ETIMEDOUT if
+ *                   not woken by DEADLINE, in timer ticks (see clock.h).
+ *                   Returns 0 if woken.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
  *
@@ -135,8 +167,58 @@ void cv_destroy(struct cv *);
  * These operations must be atomic. You get to write them.
  */
 void cv_wait(struct cv *cv, struct lock *lock);
+int cv_timedwait(struct cv *cv, struct lock *lock, uint64_t deadline);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or a single
+ * writer. Writers are preferred: once a writer is waiting, new
+ * readers wait behind it, so a steady stream of readers cannot starve
+ * writers out. (The flip side is that a steady stream of writers can
+ * starve readers; use this for read-mostly data.)
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ *
+ * rwlock_stat counts both read and write acquisitions, but only write
+ * holds are timed, since readers overlap.
+ */
+
+struct rwlock {
+        char *rwlock_name;
+	struct wchan *rwlock_rwchan;	/* readers wait here */
+	struct wchan *rwlock_wwchan;	/* writers wait here */
+	struct spinlock rwlock_lock;
+	unsigned rwlock_readers;	/* number of readers holding it */
+	unsigned rwlock_waitwriters;	/* number of writers waiting */
+	struct thread *rwlock_writer;	/* writer holding it, if any */
+#if OPT_LOCKSTAT
+	struct lockstat rwlock_stat;	/* contention profile */
+#endif
+};
+
+struct rwlock *rwlock_create(const char *);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading. Multiple threads can
+ *                          hold the lock for reading at the same time.
+ *    rwlock_release_read  - Free the lock.
+ *    rwlock_acquire_write - Get the lock for writing. Only one thread can
+ *                          hold the write lock at one time.
+ *    rwlock_release_write - Free the write lock.
+ *
+ * These operations must be atomic.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
\ No newline at end of file
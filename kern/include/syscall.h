@@ -33,6 +33,8 @@
 #include <file_syscalls.h>
 #include <proc_syscalls.h>
 #include <vm_syscalls.h>
+#include <thread_syscalls.h>
+#include <futex_syscalls.h>
 #include <directory_syscalls.h>
 #include <filetable.h>
 #include <cdefs.h> /* for __DEAD */
@@ -62,4 +64,5 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t user_req, userptr_t user_rem);
 #endif /* _SYSCALL_H_ */
@@ -56,6 +56,11 @@ int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int rwtest(int, char **);
+int rwtest2(int, char **);
+int pitest(int, char **);
+int schedtest(int, char **);
+int timertest(int, char **);
 
 /* filesystem tests */
 int fstest(int, char **);
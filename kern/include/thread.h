@@ -39,8 +39,10 @@
 #include <array.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include <usage.h>
 
 struct cpu;
+struct lock;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -55,6 +57,9 @@ struct cpu;
 /* Macro to test if two addresses are on the same kernel stack */
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
+/* Size of thread names, including the terminating null; longer ones are cut */
+#define THREAD_NAME_MAX 32
+
 /* States a thread can be in. */
 typedef enum {
 	S_RUN,		/* running */
@@ -84,6 +89,37 @@ struct thread {
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
 
+	/*
+	 * Scheduler fields. t_priority is the run queue level the
+	 * thread is on (0 is highest); t_quantum is the number of
+	 * hardclocks left before it is demoted a level. Both are
+	 * only touched by the thread itself, by whoever is waking it
+	 * up, or under the runqueue lock of t_cpu.
+	 */
+	unsigned t_priority;		/* Scheduler priority level */
+	unsigned t_quantum;		/* Hardclocks left in time slice */
+
+	/*
+	 * Priority inheritance (see synch.c). t_inherit is the best
+	 * priority lent by threads waiting for locks this thread
+	 * holds, or SCHED_NLEVELS if none; the thread is scheduled at
+	 * the better of that and t_priority. t_inherit changes only
+	 * under the runqueue lock of t_cpu as well, so the scheduler
+	 * can rely on it. The rest belong to synch.c.
+	 */
+	unsigned t_inherit;		/* Inherited priority level */
+	struct lock *t_waitlock;	/* Lock we're asleep waiting for */
+	unsigned t_waitprio;		/* Priority lent to t_waitlock */
+	struct lock *t_heldlocks;	/* Held locks with waiters */
+
+	/*
+	 * Where and when (in that cpu's c_hardclocks) the thread last
+	 * stopped running, for cache affinity. t_lastcpu is NULL if
+	 * the thread has never run.
+	 */
+	struct cpu *t_lastcpu;		/* CPU thread last ran on */
+	unsigned t_lastrun;		/* Hardclock it last ran at */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -101,10 +137,24 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+	/*
+	 * Storage for t_name, so recycled threads can be renamed
+	 * without allocating.
+	 */
+	char t_namebuf[THREAD_NAME_MAX];
+
 	/*
 	 * Public fields
 	 */
 
+	/* User-level thread id within t_proc; see thread_syscalls.c */
+	unsigned t_utid;
+
+	/* Resources used while in t_proc, and when we last charged time */
+	struct usage t_usage;
+	struct timespec t_usagemark;
+	unsigned t_usagegen;		/* usage_clockgen at t_usagemark */
+
 	/* add more here as needed */
 };
 
@@ -162,11 +212,44 @@ void thread_yield(void);
  */
 void schedule(void);
 
+/*
+ * Charge the current thread for TICKS hardclocks of cpu time. Returns
+ * true if it should be preempted, either because its time slice ran
+ * out and something else is waiting, or because a higher-priority
+ * thread is waiting. Called from the timer interrupt.
+ */
+bool thread_tick(unsigned ticks);
+
+/*
+ * Tickless operation, for hardclock(). thread_tick_resume returns how
+ * many ticks have passed since this cpu's last hardclock;
+ * thread_tick_defer skips the next IDLETICKS (if idle) or BUSYTICKS
+ * (if not) hardclocks if this cpu has nothing queued.
+ */
+unsigned thread_tick_resume(void);
+void thread_tick_defer(unsigned idleticks, unsigned busyticks);
+
+/*
+ * Priority inheritance, for the lock code.
+ *
+ * thread_effective_priority returns the level T is scheduled at.
+ * thread_inherit_priority sets T's inherited priority to PRIO (or
+ * SCHED_NLEVELS for none), moving it between run queues if need be.
+ */
+unsigned thread_effective_priority(struct thread *t);
+void thread_inherit_priority(struct thread *t, unsigned prio);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
  */
 void thread_consider_migration(void);
 
+/*
+ * Print the per-cpu scheduler placement, migration, and tickless
+ * counters.
+ */
+void thread_printstats(void);
+
 
 #endif /* _THREAD_H_ */
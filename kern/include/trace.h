@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+/*
+ * Scheduler event tracing.
+ *
+ * Each cpu has a fixed-size ring of timestamped events (see
+ * kern/trace.h for the event types): context switches, wakeups,
+ * migrations, IPIs, and system call entry and exit. When the ring is
+ * full the oldest events are overwritten, so it always holds the most
+ * recent history.
+ *
+ * A cpu only ever writes its own ring, with interrupts off, so
+ * recording takes no locks. Readers copy the rings without locking
+ * either; they stop tracing while they do so, but an event being
+ * recorded on another cpu at that moment can come out torn.
+ *
+ * Tracing is off until turned on from the menu. Each event costs a
+ * clock read, which is several device register reads at splhigh, in
+ * every context switch, wakeup, IPI and system call; so it is not on
+ * by default, even in debug kernels.
+ *
+ * Only available if OPT_TRACE is set.
+ */
+
+#include <kern/trace.h>
+#include "opt-trace.h"
+
+#if OPT_TRACE
+
+/* Events kept per cpu. Must be a power of 2. */
+#define TRACE_NRECORDS	1024
+
+struct tracebuf {
+	struct trace_record *tb_records;	/* TRACE_NRECORDS of them */
+	unsigned tb_head;			/* total ever recorded */
+};
+
+/*
+ * trace_cpu_init   - set up a cpu's ring. May sleep.
+ * trace_event      - record an event on the current cpu. Use the TRACE
+ *                    macro below instead, so it compiles away.
+ */
+void trace_cpu_init(struct tracebuf *tb);
+void trace_event(unsigned type, const void *thread, uint32_t a, uint32_t b);
+
+/*
+ * trace_print      - print the N most recent events, all cpus merged.
+ * trace_dump       - write all the rings to the file PATH, in the
+ *                    format described in kern/trace.h.
+ * trace_reset      - empty all the rings.
+ * trace_setenabled - turn tracing on or off.
+ */
+void trace_print(unsigned n);
+int trace_dump(const char *path);
+void trace_reset(void);
+void trace_setenabled(bool on);
+
+#define TRACE(type, thread, a, b) trace_event(type, thread, a, b)
+
+#else
+
+#define TRACE(type, thread, a, b) ((void)0)
+
+#endif /* OPT_TRACE */
+
+#endif /* _TRACE_H_ */
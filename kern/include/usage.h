@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _USAGE_H_
+#define _USAGE_H_
+
+/*
+ * Resource usage accounting, for getrusage().
+ *
+ * Each thread counts what it uses in its own t_usage. Only the thread
+ * itself (or an interrupt on its own cpu) updates it, so no lock is
+ * needed. When a thread leaves its process its counts are added to
+ * the process's p_usage. When a process is reaped by waitpid, its
+ * totals (its own and those of the children it reaped) are added to
+ * the parent's p_childusage.
+ *
+ * proc_getusage reads the counts of threads still running, on other
+ * cpus, without a lock. Such a read can be torn: a 64-bit counter or
+ * a timespec caught mid-update may mix old and new halves. That's
+ * tolerated, since the totals are only a report.
+ *
+ * By default CPU time is sampled: each hardclock charges its ticks to
+ * the thread it interrupted, as user or system time depending on
+ * where the interrupt came from. Ticks an idle cpu skipped are caught
+ * up when it next ticks, and are charged if it is busy by then. This
+ * costs nothing outside hardclock, but short runs that fall between
+ * ticks go uncounted.
+ *
+ * usage_setclocked(true) (the "ru on" menu command) charges time by
+ * the clock instead. The time since the thread's t_usagemark is
+ * charged to user time on each trap from user mode, and to system
+ * time on each return to user mode and when the thread is switched
+ * out. A thread switching in starts a new mark. This is exact but
+ * costs a clock read per trap and two per context switch, so it is
+ * off by default. It does nothing until usage_bootstrap(), since the
+ * clock isn't there before then.
+ */
+
+#include <kern/time.h>
+
+struct thread;
+struct rusage;
+
+struct usage {
+	struct timespec u_utime;	/* time in user mode */
+	struct timespec u_stime;	/* time in the kernel */
+	uint64_t u_minflt;		/* page faults handled */
+	uint64_t u_nvcsw;		/* switches to sleep */
+	uint64_t u_nivcsw;		/* switches while still runnable */
+	uint64_t u_nsyscalls;		/* system calls made */
+	uint64_t u_inbytes;		/* bytes read */
+	uint64_t u_outbytes;		/* bytes written */
+};
+
+/*
+ * usage_bootstrap  - call once the clock is attached.
+ * usage_setclocked - charge time by the clock (if ON) or by ticks.
+ * usage_init       - zero all counts.
+ * usage_add        - add the counts in FROM to TO.
+ * usage_export     - convert to the struct rusage handed to userlevel.
+ */
+void usage_bootstrap(void);
+void usage_setclocked(bool on);
+void usage_init(struct usage *u);
+void usage_add(struct usage *to, const struct usage *from);
+void usage_export(const struct usage *u, struct rusage *ru);
+
+/*
+ * Time charging. Call with interrupts off.
+ *
+ * usage_tick   - charge TICKS hardclocks to the current thread,
+ *                unless charging by the clock.
+ * usage_charge - charge the current thread's time since its mark to
+ *                user time (if USER) or system time, and mark again.
+ *                Does nothing unless charging by the clock.
+ * usage_mark   - start a new mark for T, which is about to run.
+ */
+void usage_tick(unsigned ticks);
+void usage_charge(bool user);
+void usage_mark(struct thread *t);
+
+#endif /* _USAGE_H_ */
@@ -66,6 +66,16 @@ bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
  */
 void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Like wchan_sleep, but give up at DEADLINE (in timer ticks; see
+ * clock.h) if not woken up by then. Returns 0 if woken up, or
+ * ETIMEDOUT if the deadline passed first, including if it had already
+ * passed when called, in which case this doesn't sleep at all.
+ * Either way the associated lock is held again on return.
+ */
+int wchan_sleep_until(struct wchan *wc, struct spinlock *lk,
+		      uint64_t deadline);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The associated spinlock should be locked.
@@ -42,9 +42,12 @@
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
+#include <lockstat.h>
+#include <usage.h>
 #include <vm.h>
 #include <mainbus.h>
 #include <vfs.h>
+#include <execcache.h>
 #include <device.h>
 #include <syscall.h>
 #include <test.h>
@@ -110,7 +113,9 @@ boot(void)
 	proc_bootstrap();
 	thread_bootstrap();
 	hardclock_bootstrap();
+	futex_bootstrap();
 	vfs_bootstrap();
+	execcache_bootstrap();
 	kheap_nextgeneration();
 
 	/* Probe and initialize devices. Interrupts should come on. */
@@ -126,6 +131,10 @@ boot(void)
 	/* Late phase of initialization. */
 	vm_bootstrap();
 	kprintf_bootstrap();
+	usage_bootstrap();
+#if OPT_LOCKSTAT
+	lockstat_bootstrap();
+#endif
 	thread_start_cpus();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
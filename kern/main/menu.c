@@ -41,9 +41,15 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <lockstat.h>
+#include <trace.h>
+#include <execcache.h>
+#include <usage.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-lockstat.h"
+#include "opt-trace.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -134,6 +140,8 @@ common_prog(int nargs, char **args)
 			args /* thread arg */, nargs /* thread arg */);
 	if (result) {
 		kprintf("thread_fork failed: %s\n", strerror(result));
+		/* It's on our child list with a PID; take it off first */
+		unconfigure_pid_fields(proc);
 		proc_destroy(proc);
 		return result;
 	}
@@ -384,6 +392,156 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_schedstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_printstats();
+
+	return 0;
+}
+
+#if OPT_LOCKSTAT
+/*
+ * Command for lock contention stats.
+ *
+ *    ls [n]    print the n most contended lock classes (default 10)
+ *    ls reset  zero the counters
+ *    ls on     turn on timing of holds (waits are always timed)
+ *    ls off    turn it off
+ */
+static
+int
+cmd_lockstats(int nargs, char **args)
+{
+	unsigned n = 10;
+
+	if (nargs > 2) {
+		kprintf("Usage: ls [n | reset | on | off]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		if (!strcmp(args[1], "reset")) {
+			lockstat_reset();
+			return 0;
+		}
+		if (!strcmp(args[1], "on")) {
+			lockstat_settiming(true);
+			return 0;
+		}
+		if (!strcmp(args[1], "off")) {
+			lockstat_settiming(false);
+			return 0;
+		}
+		n = atoi(args[1]);
+	}
+
+	lockstat_print(n);
+
+	return 0;
+}
+#endif
+
+#if OPT_TRACE
+/*
+ * Command for the scheduler event trace.
+ *
+ *    tr [n]       print the n most recent events (default 40)
+ *    tr dump FILE write all events to FILE, for tracedump
+ *    tr reset     empty the trace
+ *    tr on        start tracing
+ *    tr off       stop tracing
+ */
+static
+int
+cmd_trace(int nargs, char **args)
+{
+	unsigned n = 40;
+	int result;
+
+	if (nargs == 3 && !strcmp(args[1], "dump")) {
+		result = trace_dump(args[2]);
+		if (result) {
+			kprintf("tr dump: %s: %s\n", args[2],
+				strerror(result));
+		}
+		return result;
+	}
+	if (nargs > 2) {
+		kprintf("Usage: tr [n | dump file | reset | on | off]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		if (!strcmp(args[1], "reset")) {
+			trace_reset();
+			return 0;
+		}
+		if (!strcmp(args[1], "on")) {
+			trace_setenabled(true);
+			return 0;
+		}
+		if (!strcmp(args[1], "off")) {
+			trace_setenabled(false);
+			return 0;
+		}
+		n = atoi(args[1]);
+	}
+
+	trace_print(n);
+
+	return 0;
+}
+#endif
+
+/*
+ * Command for how getrusage times are charged.
+ *
+ *    ru on     charge by the clock at each trap and switch
+ *    ru off    sample at hardclock (the default)
+ */
+static
+int
+cmd_rusage(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		usage_setclocked(true);
+		return 0;
+	}
+	if (nargs == 2 && !strcmp(args[1], "off")) {
+		usage_setclocked(false);
+		return 0;
+	}
+	kprintf("Usage: ru on | off\n");
+	return EINVAL;
+}
+
+/*
+ * Command for the exec image cache.
+ *
+ *    ec        print hits, misses, and what's cached
+ *    ec flush  empty the cache
+ */
+static
+int
+cmd_execcache(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "flush")) {
+		execcache_flush();
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: ec [flush]\n");
+		return EINVAL;
+	}
+
+	execcache_printstats();
+
+	return 0;
+}
+
 static
 int
 cmd_kheapgeneration(int nargs, char **args)
@@ -479,6 +637,8 @@ static const char *testmenu[] = {
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[sch] Scheduler latency test        ",
+	"[tmt] Timer test                    ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
@@ -486,6 +646,9 @@ static const char *testmenu[] = {
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
 	"[sy4] CV test #2            (1)     ",
+	"[sy5] RW lock test                  ",
+	"[sy6] RW lock writer-preference test",
+	"[sy7] Priority inheritance test     ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
 	"[fs3] FS write stress               ",
@@ -519,6 +682,15 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[ss] Scheduler stats                ",
+#if OPT_LOCKSTAT
+	"[ls] Lock contention stats          ",
+#endif
+#if OPT_TRACE
+	"[tr] Scheduler event trace          ",
+#endif
+	"[ru] Clock-based rusage times       ",
+	"[ec] Exec image cache stats         ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -573,6 +745,15 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "ss",         cmd_schedstats },
+#if OPT_LOCKSTAT
+	{ "ls",         cmd_lockstats },
+#endif
+#if OPT_TRACE
+	{ "tr",         cmd_trace },
+#endif
+	{ "ru",         cmd_rusage },
+	{ "ec",         cmd_execcache },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -588,12 +769,17 @@ static struct {
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "sch",	schedtest },
+	{ "tmt",	timertest },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sy5",	rwtest },
+	{ "sy6",	rwtest2 },
+	{ "sy7",	pitest },
 
 	/* file system assignment tests */
 	{ "fs1",	fstest },
@@ -50,6 +50,7 @@
 #include <vnode.h>
 #include <limits.h>
 #include <filetable.h>
+#include <synch.h>
 #include <kern/errno.h>
 
 /*
@@ -86,13 +87,44 @@ proc_create(const char *name)
 		kfree(proc);
 		return NULL;
 	}
-	proc->p_children = array_create();
-	if (proc->p_children == NULL) {
-		kfree(proc->p_filetable);
+
+	proc->p_uthread_lock = lock_create("p_uthread_lock");
+	if (proc->p_uthread_lock == NULL) {
+		filetable_destroy(proc->p_filetable);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
+	proc->p_uthread_cv = cv_create("p_uthread_cv");
+	if (proc->p_uthread_cv == NULL) {
+		lock_destroy(proc->p_uthread_lock);
+		filetable_destroy(proc->p_filetable);
 		kfree(proc->p_name);
 		kfree(proc);
 		return NULL;
 	}
+	proc->p_waitcv = cv_create("p_waitcv");
+	if (proc->p_waitcv == NULL) {
+		cv_destroy(proc->p_uthread_cv);
+		lock_destroy(proc->p_uthread_lock);
+		filetable_destroy(proc->p_filetable);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
+	proc->p_parent = NULL;
+	proc->p_childhead = NULL;
+	proc->p_childtail = NULL;
+	proc->p_zombietail = NULL;
+	proc->p_sibnext = NULL;
+	proc->p_sibprev = NULL;
+	/* One thread to start with, which is thread 0. */
+	proc->p_nuthreads = 1;
+	proc->p_uthreads_running = 1;
+	proc->p_uthreads_exited = 0;
+	proc->p_exitcode = 0;
+	usage_init(&proc->p_usage);
+	usage_init(&proc->p_childusage);
 
 	threadarray_init(&proc->p_threads);
 	spinlock_init(&proc->p_lock);
@@ -143,12 +175,6 @@ proc_destroy(struct proc *proc)
 		VOP_DECREF(proc->p_cwd);
 		proc->p_cwd = NULL;
 	}
-	/* Process PID fields */
-	int p_children_size = array_num(proc->p_children);
-	for (int i = 0; i < p_children_size; i++){
-		array_remove(proc->p_children, 0); /* Empty the array, one element at a time */
-	}
-
 	/* VM fields */
 	if (proc->p_addrspace) {
 		/*
@@ -198,11 +224,12 @@ proc_destroy(struct proc *proc)
 
 	}
 	filetable_destroy(proc->p_filetable);
+	cv_destroy(proc->p_waitcv);
+	cv_destroy(proc->p_uthread_cv);
+	lock_destroy(proc->p_uthread_lock);
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
 
-	array_destroy(proc->p_children);
-
 	kfree(proc->p_name);
 	kfree(proc);
 }
@@ -261,7 +288,10 @@ proc_create_runprogram(const char *name)
 	spinlock_release(&curproc->p_lock);
 
 	/* PID Fields */
-	configure_pid_fields(newproc);
+	if (configure_pid_fields(newproc)) {
+		proc_destroy(newproc);
+		return NULL;
+	}
 
 	return newproc;
 }
@@ -288,18 +318,31 @@ proc_create_fork(const char *name, int *error)
 	}
 
 	/* PID Fields */
-	configure_pid_fields(child_proc);
+	err = configure_pid_fields(child_proc);
+	if (err) {
+		proc_destroy(child_proc);
+		*error = err;
+		return NULL;
+	}
 	
 	/* Copy the address space of the parent */
     struct addrspace *child_as = (struct addrspace *)kmalloc(sizeof(struct addrspace));
     if (child_as == NULL) {
+		unconfigure_pid_fields(child_proc);
+		proc_destroy(child_proc);
 		*error = ENOMEM;
         return NULL;
     }
 
 	child_proc->p_addrspace = child_as;
     err = as_copy(curproc->p_addrspace, &child_proc->p_addrspace,child_proc->p_pid);
+	/* as_copy hands back a new address space; child_as was only a placeholder */
+	kfree(child_as);
     if(err) {
+		/* Nothing was copied, so don't let proc_destroy tear it down */
+		child_proc->p_addrspace = NULL;
+		unconfigure_pid_fields(child_proc);
+		proc_destroy(child_proc);
 		*error = err;
         return NULL;
     }
@@ -321,6 +364,54 @@ proc_create_fork(const char *name, int *error)
 	return child_proc;
 }
 
+/*
+ * Create a fresh proc for use by sys_spawn. Like a forked child it shares the current process's
+ * open files and inherits its p_cwd, but it starts out with no address space at all, since it
+ * is about to load a program of its own.
+ *
+ * Parameters: name (name of the new process)
+ * 			   error (variable in which error code will be stored)
+ * Returns: child_process (the created process)
+ * 			NULL (If any error occurs), error is set
+ */
+struct proc *
+proc_create_spawn(const char *name, int *error)
+{
+	struct proc *child_proc;
+	int err = 0;
+
+	child_proc = proc_create(name);
+	if (child_proc == NULL) {
+		*error = ENOMEM;
+		return NULL;
+	}
+
+	err = filetable_copy(child_proc->p_filetable, curproc->p_filetable);
+	if (err) {
+		proc_destroy(child_proc);
+		*error = err;
+		return NULL;
+	}
+
+	/* See proc_create_fork */
+	spinlock_acquire(&curproc->p_lock);
+	if (curproc->p_cwd != NULL) {
+		VOP_INCREF(curproc->p_cwd);
+		child_proc->p_cwd = curproc->p_cwd;
+	}
+	spinlock_release(&curproc->p_lock);
+
+	/* PID Fields */
+	err = configure_pid_fields(child_proc);
+	if (err) {
+		proc_destroy(child_proc);
+		*error = err;
+		return NULL;
+	}
+
+	return child_proc;
+}
+
 /*
  * Add a thread to a process. Either the thread or the process might
  * or might not be current.
@@ -375,6 +466,9 @@ proc_remthread(struct thread *t)
 	for (i=0; i<num; i++) {
 		if (threadarray_get(&proc->p_threads, i) == t) {
 			threadarray_remove(&proc->p_threads, i);
+			/* What it used stays with the process */
+			usage_add(&proc->p_usage, &t->t_usage);
+			usage_init(&t->t_usage);
 			spinlock_release(&proc->p_lock);
 			spl = splhigh();
 			t->t_proc = NULL;
@@ -387,6 +481,103 @@ proc_remthread(struct thread *t)
 	panic("Thread (%p) has escaped from its process (%p)\n", t, proc);
 }
 
+/*
+ * Total up the resources used by PROC: by threads that have left it,
+ * and by the ones still in it as of the last time they were charged.
+ */
+void
+proc_getusage(struct proc *proc, struct usage *ret)
+{
+	unsigned i, num;
+
+	spinlock_acquire(&proc->p_lock);
+	*ret = proc->p_usage;
+	num = threadarray_num(&proc->p_threads);
+	for (i=0; i<num; i++) {
+		usage_add(ret, &threadarray_get(&proc->p_threads, i)->t_usage);
+	}
+	spinlock_release(&proc->p_lock);
+}
+
+/*
+ * Add CHILD at the back of PARENT's list of children.
+ */
+void
+proc_addchild(struct proc *parent, struct proc *child)
+{
+	KASSERT(lock_do_i_hold(pid_table->pid_table_lk));
+
+	child->p_sibnext = NULL;
+	child->p_sibprev = parent->p_childtail;
+	if (parent->p_childtail != NULL) {
+		parent->p_childtail->p_sibnext = child;
+	}
+	else {
+		parent->p_childhead = child;
+	}
+	parent->p_childtail = child;
+}
+
+/*
+ * Take CHILD out of PARENT's list of children.
+ */
+void
+proc_remchild(struct proc *parent, struct proc *child)
+{
+	KASSERT(lock_do_i_hold(pid_table->pid_table_lk));
+
+	/* The zombies are all at the front, so the one before is one too */
+	if (parent->p_zombietail == child) {
+		parent->p_zombietail = child->p_sibprev;
+	}
+	if (child->p_sibprev != NULL) {
+		child->p_sibprev->p_sibnext = child->p_sibnext;
+	}
+	else {
+		KASSERT(parent->p_childhead == child);
+		parent->p_childhead = child->p_sibnext;
+	}
+	if (child->p_sibnext != NULL) {
+		child->p_sibnext->p_sibprev = child->p_sibprev;
+	}
+	else {
+		KASSERT(parent->p_childtail == child);
+		parent->p_childtail = child->p_sibprev;
+	}
+	child->p_sibnext = NULL;
+	child->p_sibprev = NULL;
+}
+
+/*
+ * CHILD has just become a zombie; move it up to just after the other
+ * zombies at the front of PARENT's list, so waitpid(-1) finds them in
+ * the order they exited.
+ */
+void
+proc_zombiechild(struct proc *parent, struct proc *child)
+{
+	struct proc *prev;
+
+	proc_remchild(parent, child);
+
+	prev = parent->p_zombietail;
+	child->p_sibprev = prev;
+	child->p_sibnext = prev != NULL ? prev->p_sibnext : parent->p_childhead;
+	if (child->p_sibnext != NULL) {
+		child->p_sibnext->p_sibprev = child;
+	}
+	else {
+		parent->p_childtail = child;
+	}
+	if (prev != NULL) {
+		prev->p_sibnext = child;
+	}
+	else {
+		parent->p_childhead = child;
+	}
+	parent->p_zombietail = child;
+}
+
 /*
  * Fetch the address space of (the current) process.
  *
@@ -434,53 +625,39 @@ proc_setas(struct addrspace *newas)
 /* Functions related to PID management */
 
 /* 
- * Returns a pid that is available to be used by a process by referencing the global pid table
+ * Returns a pid that is available to be used by a process by referencing the global pid table.
+ * Takes the oldest free slot off the free list, so this takes constant time.
  * 
  * Parameters: void
- * Returns: the newly assigned pid
+ * Returns: the newly assigned pid, or 0 if the table is full
  */
 pid_t
 issue_pid()
 {
+	struct pid_entry *entry;
 	pid_t new_pid = 0; /* If new_pid isn't assigned, return zero to signify error */
-	pid_t *pid_pointer = &new_pid;
+	unsigned slot;
 	
-	/* Lock whole PID table so that statuses dont change during check */
 	lock_acquire(pid_table->pid_table_lk); 
-	
-	// for (int i = __PID_MIN; i < __PID_MAX; i++){ 
-	// 	/* Make sure not to assign special PIDs by searching from __PID_MIN onwards*/
-	// 	if (pid_table->process_statuses[i] == AVAILABLE){
-	// 		new_pid = i;
-	// 		pid_table->process_statuses[i] = OCCUPIED;
-	// 		break;
-	// 	}
-	// }
-	
-	// First check if there are any available PIDs in the existing PID table
-	for (unsigned int i = __PID_MIN; i < array_num(pid_table->process_statuses); i++) {
-		if (array_get(pid_table->process_statuses, i) == AVAILABLE) {
-			new_pid = i;
-			array_set(pid_table->process_statuses, i, (void *)OCCUPIED);
-			break;
+	rwlock_acquire_write(pid_table->pid_table_rwlk);
+
+	slot = pid_table->pid_freehead;
+	if (slot != PID_TABLE_SIZE) {
+		entry = &pid_table->pid_entries[slot];
+		KASSERT(entry->pe_status == AVAILABLE);
+		pid_table->pid_freehead = entry->pe_nextfree;
+		if (pid_table->pid_freehead == PID_TABLE_SIZE) {
+			pid_table->pid_freetail = PID_TABLE_SIZE;
 		}
+		entry->pe_status = OCCUPIED;
+		entry->pe_exitcode = 0;
+		entry->pe_proc = NULL; /* Filled out in configure_pid_fields */
+		new_pid = entry->pe_pid;
 	}
 
+	rwlock_release_write(pid_table->pid_table_rwlk);
 	lock_release(pid_table->pid_table_lk);
-	
-	// There were no available PIDs in the table, add an entry to the table if not at max process capacity
-	if (new_pid == 0) {
-		// The PID table can be expanded
-		if (array_num(pid_table->process_statuses) < __PID_MAX) {
-			array_add(pid_table->process_statuses, (void *)OCCUPIED, (unsigned int *)pid_pointer);
-			array_add(pid_table->process_exitcodes, (void *)NULL, NULL); // The values for exitcode and processes will be filled out in configure_pid_fields
-			array_add(pid_table->processes, (void *)NULL, NULL);
-		}
-		/* Check that PID was correctly assigned, if not return error */
-		if (new_pid == 0) {
-			panic("No available PIDs to assign.");
-		}
-	}
+
 	return new_pid;
 }
 
@@ -488,24 +665,53 @@ issue_pid()
  * Configure the PID-related fields of a new process.
  * 
  * Parameters: the child process to initialize
- * Returns: void
+ * Returns: 0 on success, ENPROC if there are no PIDs left
  */
-void
+int
 configure_pid_fields(struct proc *child_proc)
 {
 	/* Issue the child process a PID */
 	child_proc->p_pid = issue_pid();
+	if (child_proc->p_pid == 0) {
+		return ENPROC;
+	}
 	
-	spinlock_acquire(&curproc->p_lock);
-	/* Add the child process to the parent's array of children */
-	array_add(curproc->p_children, (void *)child_proc->p_pid, NULL);
-	/* Add child process to pid table */
-	array_set(pid_table->processes, (unsigned int) child_proc->p_pid, (void *)child_proc);
-	spinlock_release(&curproc->p_lock);
+	/* Add child process to pid table, and to the parent's children */
+	lock_acquire(pid_table->pid_table_lk);
+	child_proc->p_parent = curproc;
+	proc_addchild(curproc, child_proc);
+	rwlock_acquire_write(pid_table->pid_table_rwlk);
+	pid_lookup(child_proc->p_pid)->pe_proc = child_proc;
+	rwlock_release_write(pid_table->pid_table_rwlk);
+	lock_release(pid_table->pid_table_lk);
+	return 0;
 }
 
 /* 
- * Removes a process specified by pid from the PID table.
+ * Undo configure_pid_fields for a child that failed to start, freeing its PID. The caller
+ * destroys the child afterwards.
+ * 
+ * Parameters: the child process
+ * Returns: void
+ */
+void
+unconfigure_pid_fields(struct proc *child_proc)
+{
+	lock_acquire(pid_table->pid_table_lk);
+	KASSERT(child_proc->p_parent == curproc);
+	proc_remchild(curproc, child_proc);
+	child_proc->p_parent = NULL;
+	rwlock_acquire_write(pid_table->pid_table_rwlk);
+	delete_pid_entry(child_proc->p_pid);
+	rwlock_release_write(pid_table->pid_table_rwlk);
+	/* Another of our threads may be waiting for any child, and this was the last */
+	cv_broadcast(curproc->p_waitcv, pid_table->pid_table_lk);
+	lock_release(pid_table->pid_table_lk);
+}
+
+/* 
+ * Removes a process specified by pid from the PID table, putting its slot at the back of
+ * the free list. The caller must hold pid_table_lk and hold pid_table_rwlk for writing.
  * 
  * Parameters: pid (the pid of the process to remove from the PID table)
  * Returns: void
@@ -513,9 +719,29 @@ configure_pid_fields(struct proc *child_proc)
 void
 delete_pid_entry(pid_t pid)
 {
-	array_set(pid_table->process_statuses, (unsigned int)pid, (void *)AVAILABLE);
-	array_set(pid_table->processes, (unsigned int)pid, (void *)NULL);
-	array_set(pid_table->process_exitcodes, (unsigned int)pid, (void *)NULL);
+	struct pid_entry *entry;
+	unsigned slot = (unsigned)pid % PID_TABLE_SIZE;
+
+	entry = pid_lookup(pid);
+	KASSERT(entry != NULL);
+
+	entry->pe_status = AVAILABLE;
+	entry->pe_proc = NULL;
+	entry->pe_exitcode = 0;
+	/* The next process in this slot gets a different PID */
+	entry->pe_pid += PID_TABLE_SIZE;
+	if (entry->pe_pid > __PID_MAX) {
+		entry->pe_pid = slot;
+	}
+
+	entry->pe_nextfree = PID_TABLE_SIZE;
+	if (pid_table->pid_freetail == PID_TABLE_SIZE) {
+		pid_table->pid_freehead = slot;
+	}
+	else {
+		pid_table->pid_entries[pid_table->pid_freetail].pe_nextfree = slot;
+	}
+	pid_table->pid_freetail = slot;
 }
 
 /* 
@@ -527,7 +753,9 @@ delete_pid_entry(pid_t pid)
 void 
 init_pid_table()
 {
-	kprintf("Size of pidtable %d", sizeof(struct pid_table));
+	struct pid_entry *entry;
+	unsigned i;
+
 	pid_table = kmalloc(sizeof(struct pid_table));
 	if (pid_table == NULL){
 		panic("Error trying to initialize pid table.\n");
@@ -538,41 +766,67 @@ init_pid_table()
 		panic("Error trying to make pid table lock.\n");
 	}
 
-	pid_table->pid_table_cv = cv_create("PID-table-cv");
-	if (pid_table->pid_table_cv == NULL){
-		panic("Error trying to make pid table condition variable.\n");
+	pid_table->pid_table_rwlk = rwlock_create("PID-table-rwlock");
+	if (pid_table->pid_table_rwlk == NULL){
+		panic("Error trying to make pid table rwlock.\n");
 	}
 
-	pid_table->process_statuses = array_create();
-	if (pid_table->process_statuses == NULL) {
-		panic("Error trying to initialize the process statuses array.\n");
+	/*
+	 * Slots below __PID_MIN hold the special PIDs and are never freed;
+	 * the rest go on the free list in order.
+	 */
+	KASSERT(PID_TABLE_SIZE > __PID_MIN && PID_TABLE_SIZE <= __PID_MAX);
+	for (i = 0; i < PID_TABLE_SIZE; i++) {
+		entry = &pid_table->pid_entries[i];
+		entry->pe_pid = i;
+		entry->pe_status = i < __PID_MIN ? OCCUPIED : AVAILABLE;
+		entry->pe_exitcode = 0;
+		entry->pe_proc = NULL;
+		entry->pe_nextfree = i + 1;
 	}
+	pid_table->pid_freehead = __PID_MIN;
+	pid_table->pid_freetail = PID_TABLE_SIZE - 1;
+}
 
-	pid_table->processes = array_create();
-	if (pid_table->processes == NULL) {
-		panic("Error trying to initialize the process array.\n");
-	}
+/* 
+ * Finds the PID table slot of a live pid. The caller must hold pid_table_lk, or
+ * pid_table_rwlk for reading.
+ * 
+ * Parameters: pid (the pid to look up)
+ * Returns: the slot, or NULL if no process has that pid
+ */
+struct pid_entry *
+pid_lookup(pid_t pid)
+{
+	struct pid_entry *entry;
 
-	pid_table->process_exitcodes = array_create();
-	if (pid_table->process_exitcodes == NULL) {
-		panic("Error trying to initialize the process exit codes.\n");
+	if (pid < __PID_MIN || pid > __PID_MAX) {
+		return NULL;
 	}
-
-	/* Assign special PID values to be occupied */
-	array_add(pid_table->process_statuses, (void *)OCCUPIED, NULL);
-	array_add(pid_table->process_exitcodes, NULL, NULL);
-	array_add(pid_table->processes, NULL, NULL);
-	array_add(pid_table->process_statuses, (void *)OCCUPIED, NULL);
-	array_add(pid_table->process_exitcodes, NULL, NULL);
-	array_add(pid_table->processes, NULL, NULL);
-	
-	// /* Loop over remaining PIDs and make them available */
-	// for (int i = __PID_MIN; i < __PID_MAX; i++){ /* Make sure not to assign special PIDs */
-	// 	pid_table->process_statuses[i] = AVAILABLE;
-	// }
+	entry = &pid_table->pid_entries[pid % PID_TABLE_SIZE];
+	if (entry->pe_status == AVAILABLE || entry->pe_pid != pid) {
+		return NULL;
+	}
+	return entry;
 }
 
+/* 
+ * Looks up the process with the given pid in the PID table.
+ * 
+ * Parameters: pid (the pid of the process to look up)
+ * Returns: the process, or NULL if there is none
+ */
 struct proc *get_process_from_pid(pid_t pid)
 {
-	return array_get(pid_table->processes,pid); 
+	struct proc *proc = NULL;
+	struct pid_entry *entry;
+
+	rwlock_acquire_read(pid_table->pid_table_rwlk);
+	entry = pid_lookup(pid);
+	if (entry != NULL) {
+		proc = entry->pe_proc;
+	}
+	rwlock_release_read(pid_table->pid_table_rwlk);
+
+	return proc;
 }
@@ -0,0 +1,485 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Exec image cache. See execcache.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vnode.h>
+#include <elf.h>
+#include <execcache.h>
+
+/* Most segment data to keep cached in all, and for any one image. */
+#define EXECCACHE_MAXBYTES	(256*1024)
+#define EXECCACHE_MAXIMAGE	(64*1024)
+
+/* Protects everything below, and the images' ei_refcount/ei_cached. */
+static struct lock *execcache_lock;
+
+static struct execimage *execcache_head;	/* most recently used first */
+static size_t execcache_bytes;			/* segment data cached */
+
+/* Stats. */
+static unsigned execcache_hits;
+static unsigned execcache_misses;
+static unsigned execcache_stale;		/* misses because file changed */
+static unsigned execcache_evictions;
+
+void
+execcache_bootstrap(void)
+{
+	execcache_lock = lock_create("execcache");
+	if (execcache_lock == NULL) {
+		panic("execcache_bootstrap: Out of memory\n");
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Images
+
+/*
+ * Read LEN bytes at file offset OFFSET into BUF, with WHAT saying
+ * what it is for the message if the file is short.
+ */
+static
+int
+execimage_readbytes(struct vnode *v, off_t offset, void *buf, size_t len,
+		    const char *what)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, buf, len, offset, UIO_READ);
+	result = VOP_READ(v, &ku);
+	if (result) {
+		return result;
+	}
+
+	if (ku.uio_resid != 0) {
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on %s - file truncated?\n", what);
+		return ENOEXEC;
+	}
+	return 0;
+}
+
+static
+void
+execimage_free(struct execimage *ei)
+{
+	unsigned i;
+
+	KASSERT(ei->ei_refcount == 0);
+	KASSERT(!ei->ei_cached);
+
+	for (i=0; i<ei->ei_nsegs; i++) {
+		kfree(ei->ei_segs[i].es_data);
+	}
+	kfree(ei->ei_segs);
+	VOP_DECREF(ei->ei_vn);
+	kfree(ei);
+}
+
+/*
+ * Read the executable V: check its header, collect its loadable
+ * segments, and if they're small enough read their contents too.
+ * The result has no references and isn't cached.
+ */
+static
+int
+execimage_read(struct vnode *v, struct execimage **ret)
+{
+	Elf_Ehdr eh;   /* Executable header */
+	Elf_Phdr ph;   /* "Program header" = segment header */
+	struct execimage *ei;
+	struct execseg *es;
+	size_t total;
+	unsigned i;
+	int result;
+
+	ei = kmalloc(sizeof(*ei));
+	if (ei == NULL) {
+		return ENOMEM;
+	}
+	ei->ei_gen = vnode_getgen(v);
+	VOP_INCREF(v);
+	ei->ei_vn = v;
+	ei->ei_nsegs = 0;
+	ei->ei_segs = NULL;
+	ei->ei_size = 0;
+	ei->ei_refcount = 0;
+	ei->ei_cached = false;
+	ei->ei_next = NULL;
+
+	/*
+	 * Read the executable header from offset 0 in the file.
+	 */
+	result = execimage_readbytes(v, 0, &eh, sizeof(eh), "header");
+	if (result) {
+		goto fail;
+	}
+
+	/*
+	 * Check to make sure it's a 32-bit ELF-version-1 executable
+	 * for our processor type. If it's not, we can't run it.
+	 *
+	 * Ignore EI_OSABI and EI_ABIVERSION - properly, we should
+	 * define our own, but that would require tinkering with the
+	 * linker to have it emit our magic numbers instead of the
+	 * default ones. (If the linker even supports these fields,
+	 * which were not in the original elf spec.)
+	 */
+	if (eh.e_ident[EI_MAG0] != ELFMAG0 ||
+	    eh.e_ident[EI_MAG1] != ELFMAG1 ||
+	    eh.e_ident[EI_MAG2] != ELFMAG2 ||
+	    eh.e_ident[EI_MAG3] != ELFMAG3 ||
+	    eh.e_ident[EI_CLASS] != ELFCLASS32 ||
+	    eh.e_ident[EI_DATA] != ELFDATA2MSB ||
+	    eh.e_ident[EI_VERSION] != EV_CURRENT ||
+	    eh.e_version != EV_CURRENT ||
+	    eh.e_type!=ET_EXEC ||
+	    eh.e_machine!=EM_MACHINE) {
+		result = ENOEXEC;
+		goto fail;
+	}
+	ei->ei_entry = eh.e_entry;
+
+	/* Room for every segment; only the loadable ones are kept. */
+	if (eh.e_phnum > 0) {
+		ei->ei_segs = kmalloc(eh.e_phnum * sizeof(struct execseg));
+		if (ei->ei_segs == NULL) {
+			result = ENOMEM;
+			goto fail;
+		}
+	}
+
+	/*
+	 * Go through the list of segments.
+	 *
+	 * Note that the expression eh.e_phoff + i*eh.e_phentsize is
+	 * mandated by the ELF standard - we use sizeof(ph) to load,
+	 * because that's the structure we know, but the file on disk
+	 * might have a larger structure, so we must use e_phentsize
+	 * to find where the phdr starts.
+	 */
+	total = 0;
+	for (i=0; i<eh.e_phnum; i++) {
+		off_t offset = eh.e_phoff + i*eh.e_phentsize;
+
+		result = execimage_readbytes(v, offset, &ph, sizeof(ph),
+					     "phdr");
+		if (result) {
+			goto fail;
+		}
+
+		switch (ph.p_type) {
+		    case PT_NULL: /* skip */ continue;
+		    case PT_PHDR: /* skip */ continue;
+		    case PT_MIPS_REGINFO: /* skip */ continue;
+		    case PT_LOAD: break;
+		    default:
+			kprintf("loadelf: unknown segment type %d\n",
+				ph.p_type);
+			result = ENOEXEC;
+			goto fail;
+		}
+
+		if (ph.p_filesz > ph.p_memsz) {
+			kprintf("ELF: warning: segment filesize > "
+				"segment memsize\n");
+			ph.p_filesz = ph.p_memsz;
+		}
+
+		es = &ei->ei_segs[ei->ei_nsegs++];
+		es->es_ph = ph;
+		es->es_data = NULL;
+		total += ph.p_filesz;
+	}
+
+	/*
+	 * Read the segments' contents, if they're small enough to
+	 * keep. If we run out of memory doing so, just go without.
+	 */
+	if (total <= EXECCACHE_MAXIMAGE) {
+		for (i=0; i<ei->ei_nsegs; i++) {
+			es = &ei->ei_segs[i];
+			if (es->es_ph.p_filesz == 0) {
+				continue;
+			}
+			es->es_data = kmalloc(es->es_ph.p_filesz);
+			if (es->es_data == NULL) {
+				break;
+			}
+			result = execimage_readbytes(v, es->es_ph.p_offset,
+						     es->es_data,
+						     es->es_ph.p_filesz,
+						     "segment");
+			if (result) {
+				goto fail;
+			}
+			ei->ei_size += es->es_ph.p_filesz;
+		}
+	}
+
+	*ret = ei;
+	return 0;
+
+ fail:
+	execimage_free(ei);
+	return result;
+}
+
+/*
+ * Whether an image is complete and can go in the cache: all its
+ * segment data is there, and the file didn't change while we read it.
+ */
+static
+bool
+execimage_cacheable(struct execimage *ei)
+{
+	unsigned i;
+
+	for (i=0; i<ei->ei_nsegs; i++) {
+		if (ei->ei_segs[i].es_ph.p_filesz > 0 &&
+		    ei->ei_segs[i].es_data == NULL) {
+			return false;
+		}
+	}
+	return vnode_getgen(ei->ei_vn) == ei->ei_gen;
+}
+
+////////////////////////////////////////////////////////////
+// The cache
+
+/*
+ * Take EI off the cache list; PREV is the one before it, or NULL.
+ * Returns true if it is now unused and should be freed, which the
+ * caller does after letting go of execcache_lock (freeing drops a
+ * vnode reference, which may need the VFS lock).
+ */
+static
+bool
+execcache_remove(struct execimage *prev, struct execimage *ei)
+{
+	KASSERT(lock_do_i_hold(execcache_lock));
+	KASSERT(ei->ei_cached);
+
+	if (prev == NULL) {
+		execcache_head = ei->ei_next;
+	}
+	else {
+		prev->ei_next = ei->ei_next;
+	}
+	ei->ei_next = NULL;
+	ei->ei_cached = false;
+	execcache_bytes -= ei->ei_size;
+	return ei->ei_refcount == 0;
+}
+
+/*
+ * Evict from the end of the list until the cache is within budget,
+ * not counting KEEP. Evicted images that are unused are chained onto
+ * *FREELIST for the caller to free.
+ */
+static
+void
+execcache_evict(struct execimage *keep, struct execimage **freelist)
+{
+	struct execimage *ei, *prev, *victim, *victimprev;
+
+	KASSERT(lock_do_i_hold(execcache_lock));
+
+	while (execcache_bytes > EXECCACHE_MAXBYTES) {
+		victim = victimprev = NULL;
+		for (prev = NULL, ei = execcache_head; ei != NULL;
+		     prev = ei, ei = ei->ei_next) {
+			if (ei != keep) {
+				victim = ei;
+				victimprev = prev;
+			}
+		}
+		if (victim == NULL) {
+			break;
+		}
+		execcache_evictions++;
+		if (execcache_remove(victimprev, victim)) {
+			victim->ei_next = *freelist;
+			*freelist = victim;
+		}
+	}
+}
+
+static
+void
+execcache_freelist(struct execimage *ei)
+{
+	struct execimage *next;
+
+	for (; ei != NULL; ei = next) {
+		next = ei->ei_next;
+		execimage_free(ei);
+	}
+}
+
+int
+execcache_get(struct vnode *v, struct execimage **ret)
+{
+	struct execimage *ei, *prev, *other, *dead;
+	unsigned gen;
+	int result;
+
+	dead = NULL;
+	gen = vnode_getgen(v);
+
+	lock_acquire(execcache_lock);
+	for (prev = NULL, ei = execcache_head; ei != NULL;
+	     prev = ei, ei = ei->ei_next) {
+		if (ei->ei_vn == v) {
+			break;
+		}
+	}
+	if (ei != NULL && ei->ei_gen == gen) {
+		/* Hit; move it to the front. */
+		if (prev != NULL) {
+			prev->ei_next = ei->ei_next;
+			ei->ei_next = execcache_head;
+			execcache_head = ei;
+		}
+		ei->ei_refcount++;
+		execcache_hits++;
+		lock_release(execcache_lock);
+		*ret = ei;
+		return 0;
+	}
+	if (ei != NULL) {
+		/* The file has been written since; drop the old image. */
+		execcache_stale++;
+		if (execcache_remove(prev, ei)) {
+			dead = ei;
+		}
+	}
+	execcache_misses++;
+	lock_release(execcache_lock);
+
+	if (dead != NULL) {
+		execimage_free(dead);
+		dead = NULL;
+	}
+
+	/* Read it without the lock, so other execs aren't held up. */
+	result = execimage_read(v, &ei);
+	if (result) {
+		return result;
+	}
+	ei->ei_refcount = 1;
+
+	if (execimage_cacheable(ei)) {
+		lock_acquire(execcache_lock);
+		/* Someone may have cached the same file meanwhile. */
+		for (other = execcache_head; other != NULL;
+		     other = other->ei_next) {
+			if (other->ei_vn == v) {
+				break;
+			}
+		}
+		if (other == NULL) {
+			ei->ei_cached = true;
+			ei->ei_next = execcache_head;
+			execcache_head = ei;
+			execcache_bytes += ei->ei_size;
+			execcache_evict(ei, &dead);
+		}
+		lock_release(execcache_lock);
+		execcache_freelist(dead);
+	}
+
+	*ret = ei;
+	return 0;
+}
+
+void
+execcache_put(struct execimage *ei)
+{
+	bool dofree;
+
+	lock_acquire(execcache_lock);
+	KASSERT(ei->ei_refcount > 0);
+	ei->ei_refcount--;
+	dofree = ei->ei_refcount == 0 && !ei->ei_cached;
+	lock_release(execcache_lock);
+
+	if (dofree) {
+		execimage_free(ei);
+	}
+}
+
+void
+execcache_flush(void)
+{
+	struct execimage *ei, *dead;
+
+	dead = NULL;
+	lock_acquire(execcache_lock);
+	while (execcache_head != NULL) {
+		ei = execcache_head;
+		if (execcache_remove(NULL, ei)) {
+			ei->ei_next = dead;
+			dead = ei;
+		}
+	}
+	KASSERT(execcache_bytes == 0);
+	lock_release(execcache_lock);
+	execcache_freelist(dead);
+}
+
+void
+execcache_printstats(void)
+{
+	struct execimage *ei;
+	unsigned n;
+
+	lock_acquire(execcache_lock);
+	n = 0;
+	for (ei = execcache_head; ei != NULL; ei = ei->ei_next) {
+		n++;
+	}
+	kprintf("exec cache: %u hits, %u misses (%u stale), "
+		"%u evictions\n", execcache_hits, execcache_misses,
+		execcache_stale, execcache_evictions);
+	kprintf("exec cache: %u images, %lu of %lu bytes\n", n,
+		(unsigned long)execcache_bytes,
+		(unsigned long)EXECCACHE_MAXBYTES);
+	lock_release(execcache_lock);
+}
@@ -114,42 +114,38 @@ sys_lseek(int fd, off_t higher_pos, off_t lower_pos, int whence, off_t *retval)
 {
     off_t pos;
     struct filetable *ft = curproc->p_filetable;
+    struct file_entry *fe;
     struct stat ft_stat;
-    int *kernel_whence;
+    int kernel_whence;
+    int err;
 
-    kernel_whence = (int *)kmalloc(sizeof(SEEK_END));
-    if (kernel_whence == NULL){
-        return ENOMEM;
-    }
-    
     /* Concatenate the higher and lower 32-bits into 64-bit variable pos */
     pos = ((off_t)higher_pos << 32 | lower_pos); 
-    copyin((const_userptr_t) whence, kernel_whence, sizeof(kernel_whence)); 
+    err = copyin((const_userptr_t) whence, &kernel_whence, sizeof(kernel_whence)); 
+    if (err) {
+        return err;
+    }
     
-    /* Check if fd is a valid file handle */
-    lock_acquire(ft->ft_lock);
-    if ((fd < 0) | (fd >= __OPEN_MAX)){
-        lock_release(ft->ft_lock);
-        return EBADF;
-    } else if (ft->ft_file_entries[fd] == NULL){
-        lock_release(ft->ft_lock);
-        return EBADF;
+    /* Check if fd is a valid file handle, and hold on to its file entry */
+    err = filetable_get(ft, fd, &fe);
+    if (err) {
+        return err;
     }
-    lock_release(ft->ft_lock); 
 
     /* Check if whence is valid */
-    if ((*kernel_whence != SEEK_SET) && (*kernel_whence != SEEK_CUR) && (*kernel_whence != SEEK_END))
+    if ((kernel_whence != SEEK_SET) && (kernel_whence != SEEK_CUR) && (kernel_whence != SEEK_END)) {
+        filetable_put(fe);
         return EINVAL;
+    }
 
     /* Check if file is seekable */
-    struct file_entry *fe = ft->ft_file_entries[fd];
-    lock_acquire(fe->fe_lock);
     if(!VOP_ISSEEKABLE(fe->fe_vn)){
-        lock_release(fe->fe_lock);
+        filetable_put(fe);
         return ESPIPE;
     }
 
-    switch (*kernel_whence){
+    lock_acquire(fe->fe_lock);
+    switch (kernel_whence){
         /* The new position is pos */
         case SEEK_SET:
         pos = pos;
@@ -170,16 +166,94 @@ sys_lseek(int fd, off_t higher_pos, off_t lower_pos, int whence, off_t *retval)
     /* Check that the new seek position is valid */
     if(pos < 0){
         lock_release(fe->fe_lock);
+        filetable_put(fe);
         return EINVAL;
     } else{
         fe->fe_offset = pos;
     }
     lock_release(fe->fe_lock);
+    filetable_put(fe);
 
     *retval = pos;
     return 0;
 }
 
+/*
+ * Common code for read, write, readv and writev: transfers the data described by user_uio
+ * between user memory and the file entry for fd, at the file entry's seek position, and
+ * advances the seek position by the number of bytes transferred. The seek position is
+ * only locked if the file is seekable; devices and pipes ignore it.
+ *
+ * Parameters: fd (file handle), user_uio (the user buffers, with uio_rw set; the offset is
+ * filled in here), pointer to return value address.
+ * Returns: On success, 0 and the number of bytes transferred in retval.  On failure,
+ * error code: EBADF if fd isn't open or isn't open the right way, or an I/O error.
+ */
+static
+int
+sequential_io(int fd, struct uio *user_uio, int *retval)
+{
+    int err = 0;
+    struct file_entry *fe;
+    bool locked;
+    off_t pos;
+
+    /* Check for invalid file descriptor or unopened files, and hold on to the file entry */
+    err = filetable_get(curproc->p_filetable, fd, &fe);
+    if (err) {
+        return err;
+    }
+
+    /* Check if file is opened the right way */
+    int how = fe->fe_status & O_ACCMODE;
+    if (how != O_RDWR && how != (user_uio->uio_rw == UIO_READ ? O_RDONLY : O_WRONLY)) {
+        filetable_put(fe);
+        return EBADF;
+    }
+
+    /* Only lock the seek position if we're really using it. */
+    locked = VOP_ISSEEKABLE(fe->fe_vn);
+    if (locked) {
+        lock_acquire(fe->fe_lock);
+        pos = fe->fe_offset;
+    }
+    else {
+        pos = 0;
+    }
+
+    /* Perform actual read or write operation */
+    user_uio->uio_offset = pos;
+    if (user_uio->uio_rw == UIO_READ) {
+        err = VOP_READ(fe->fe_vn, user_uio);
+    }
+    else {
+        err = VOP_WRITE(fe->fe_vn, user_uio);
+    }
+    if (err) {
+        if (locked) {
+            lock_release(fe->fe_lock);
+        }
+        filetable_put(fe);
+        return err;
+    }
+
+    *retval = user_uio->uio_offset - pos;
+    if (user_uio->uio_rw == UIO_READ) {
+        curthread->t_usage.u_inbytes += *retval;
+    }
+    else {
+        curthread->t_usage.u_outbytes += *retval;
+    }
+
+    if (locked) {
+        fe->fe_offset += *retval;
+        lock_release(fe->fe_lock);
+    }
+    filetable_put(fe);
+
+    return 0;
+}
+
 /* 
 * Reads up to buflen bytes from the file entry specified by fd, at the 
 * location specified by the file entry's seek position. The file must be open
@@ -195,118 +269,429 @@ sys_lseek(int fd, off_t higher_pos, off_t lower_pos, int whence, off_t *retval)
 int
 sys_read(int fd, userptr_t buf, size_t buflen, int *retval)
 {
-    int err = 0;
-    struct filetable *ft = curproc->p_filetable;
     struct iovec iov;
     struct uio user_uio;
 
-    /* Check for invalid file descriptor */
-    if (fd < 0 || fd > __OPEN_MAX-1)
-        return EBADF;
-    
-    lock_acquire(ft->ft_lock);
+    /* The offset is filled in once the seek position is locked */
+    uio_uinit(&iov, &user_uio, buf, buflen, 0, UIO_READ);
+    return sequential_io(fd, &user_uio, retval);
+}
 
-    if (ft->ft_file_entries[fd] == NULL || ft->ft_file_entries[fd]->fe_vn == NULL)
-    {
-        lock_release(ft->ft_lock);
-        return EBADF;
-    }
-    lock_release(ft->ft_lock);
+/* 
+ * Writes up to nbytes bytes to the file specified by fd , at the location in the file specified 
+ * by the current seek position of the file, taking the data from the space pointed to by buf.  Note 
+ * that the file must be open for writing.
+ * 
+ * Parameters: fd (file handle corresponding to file entry to write to), buf (pointer
+ * to space to store values to be written), nbytes (number of bytes to write), pointer to return value address
+ * Return: On succes, the number of bytes written (positive).  On failure, -1 and errno set.
+ */
+int
+sys_write(int fd, userptr_t buf, size_t nbytes, int *retval)
+{   
+    struct iovec iov;
+    struct uio user_uio;
 
-    /* Perform actual read operation */
-    struct file_entry *fe = ft->ft_file_entries[fd];
-    lock_acquire(fe->fe_lock);
-    int how = fe->fe_status & O_ACCMODE;
+    uio_uinit(&iov, &user_uio, buf, nbytes, 0, UIO_WRITE);
+    return sequential_io(fd, &user_uio, retval);
+}
 
-    /* Check if file is opened for reading */
-    if (how != O_RDONLY && how != O_RDWR) {
-        lock_release(fe->fe_lock);
-        return EBADF;
+/*
+ * Common code for readv and writev: copies in the user's array of iovcnt iovecs and
+ * transfers all of them in one VOP_READ or VOP_WRITE, filling or draining each buffer in
+ * turn. The whole transfer is done under one hold of the seek position, so no other
+ * read or write on the same open file can land between the buffers.
+ *
+ * Parameters: fd (file handle), iov (user address of the iovec array), iovcnt (number of
+ * iovecs), rw (UIO_READ or UIO_WRITE), pointer to return value address.
+ * Returns: On success, 0 and the number of bytes transferred in retval.  On failure,
+ * error code: EINVAL if iovcnt is out of range or the lengths add up to more than the
+ * return value can hold, ENOMEM, EFAULT, or anything read and write return.
+ */
+static
+int
+vector_io(int fd, const_userptr_t iov, int iovcnt, enum uio_rw rw, int *retval)
+{
+    int err = 0;
+    struct iovec *kiov;
+    struct uio user_uio;
+    size_t total;
+    int i;
+
+    if (iovcnt <= 0 || iovcnt > __IOV_MAX) {
+        return EINVAL;
     }
 
-    off_t pos = fe->fe_offset;
-    uio_uinit(&iov, &user_uio, buf, buflen, pos, UIO_READ);
-    err = VOP_READ(fe->fe_vn, &user_uio);
+    kiov = kmalloc(iovcnt * sizeof(*kiov));
+    if (kiov == NULL) {
+        return ENOMEM;
+    }
+    err = copyin(iov, kiov, iovcnt * sizeof(*kiov));
     if (err) {
-        lock_release(fe->fe_lock);
+        kfree(kiov);
         return err;
     }
 
-    *retval = user_uio.uio_offset - pos;
+    /* The byte count comes back as an int, so the total has to fit in one */
+    total = 0;
+    for (i = 0; i < iovcnt; i++) {
+        if (kiov[i].iov_len > (size_t)0x7fffffff - total) {
+            kfree(kiov);
+            return EINVAL;
+        }
+        total += kiov[i].iov_len;
+    }
 
-    fe->fe_offset += *retval;
-    lock_release(fe->fe_lock);
+    /* The offset is filled in once the seek position is locked */
+    user_uio.uio_iov = kiov;
+    user_uio.uio_iovcnt = iovcnt;
+    user_uio.uio_offset = 0;
+    user_uio.uio_resid = total;
+    user_uio.uio_segflg = UIO_USERSPACE;
+    user_uio.uio_rw = rw;
+    user_uio.uio_space = proc_getas();
+
+    err = sequential_io(fd, &user_uio, retval);
+    kfree(kiov);
+    return err;
+}
 
-    return 0;
+/*
+ * Reads from the file specified by fd into iovcnt buffers, filling each before moving on
+ * to the next, as one read at the seek position.
+ *
+ * Parameters: fd (file handle of file to be read from), iov (user address of an array of
+ * iovcnt iovecs giving the buffers), iovcnt (number of buffers), pointer to return value
+ * address.
+ * Returns: On success, count of bytes read (positive) & 0 if at end of file.  On failure, -1
+ * and errno set.
+ */
+int
+sys_readv(int fd, const_userptr_t iov, int iovcnt, int *retval)
+{
+    return vector_io(fd, iov, iovcnt, UIO_READ, retval);
 }
 
-/* 
- * Writes up to nbytes bytes to the file specified by fd , at the location in the file specified 
- * by the current seek position of the file, taking the data from the space pointed to by buf.  Note 
- * that the file must be open for writing.
- * 
- * Parameters: fd (file handle corresponding to file entry to write to), buf (pointer
- * to space to store values to be written), nbytes (number of bytes to write), pointer to return value address
- * Return: On succes, the number of bytes written (positive).  On failure, -1 and errno set.
+/*
+ * Writes the contents of iovcnt buffers, in order, to the file specified by fd as one
+ * write at the seek position.
+ *
+ * Parameters: fd (file handle of file to write to), iov (user address of an array of
+ * iovcnt iovecs giving the buffers), iovcnt (number of buffers), pointer to return value
+ * address.
+ * Returns: On success, the number of bytes written (positive).  On failure, -1 and errno set.
  */
 int
-sys_write(int fd, userptr_t buf, size_t nbytes, int *retval)
-{   
+sys_writev(int fd, const_userptr_t iov, int iovcnt, int *retval)
+{
+    return vector_io(fd, iov, iovcnt, UIO_WRITE, retval);
+}
+
+/*
+ * Common code for pread and pwrite: transfers up to len bytes between buf and the file
+ * entry for fd at the offset stored at user address posptr. The seek position is neither
+ * used nor changed, so fe_lock isn't taken and any number of these can run on one open
+ * file at once; only the file's own locking applies.
+ *
+ * Parameters: fd (file handle), buf (user buffer), len (number of bytes), posptr (user
+ * address of the 64-bit offset, which is on the stack past the register arguments), rw
+ * (UIO_READ or UIO_WRITE), pointer to return value address.
+ * Returns: On success, 0 and the number of bytes transferred in retval.  On failure,
+ * error code: EBADF, ESPIPE if the file isn't seekable, EINVAL if the offset is negative.
+ */
+static
+int
+positional_io(int fd, userptr_t buf, size_t len, const_userptr_t posptr, enum uio_rw rw,
+              int *retval)
+{
     int err = 0;
-    struct filetable *ft = curproc->p_filetable;
+    struct file_entry *fe;
     struct iovec iov;
     struct uio user_uio;
-    bool locked;
     off_t pos;
 
-    /* Check for invalid file descriptor or unopened files */
-    if (fd < 0 || fd > __OPEN_MAX-1) { 
-        return EBADF;
+    err = copyin(posptr, &pos, sizeof(pos));
+    if (err) {
+        return err;
+    }
+    if (pos < 0) {
+        return EINVAL;
     }
 
-    lock_acquire(ft->ft_lock);
-    if (ft->ft_file_entries[fd] == NULL || ft->ft_file_entries[fd]->fe_vn == NULL)
-    {
-        lock_release(ft->ft_lock);
+    /* Check for invalid file descriptor, and hold on to its file entry */
+    err = filetable_get(curproc->p_filetable, fd, &fe);
+    if (err) {
+        return err;
+    }
+
+    /* Check if file is opened the right way */
+    int how = fe->fe_status & O_ACCMODE;
+    if (how != O_RDWR && how != (rw == UIO_READ ? O_RDONLY : O_WRONLY)) {
+        filetable_put(fe);
         return EBADF;
     }
-    lock_release(ft->ft_lock);
 
-    struct file_entry *fe = ft->ft_file_entries[fd];
-    /* Only lock the seek position if we're really using it. */
-    locked = VOP_ISSEEKABLE(fe->fe_vn);
-    if (locked) {
-        lock_acquire(fe->fe_lock);
-        pos = fe->fe_offset;
+    /* An offset means nothing to a device or pipe */
+    if (!VOP_ISSEEKABLE(fe->fe_vn)) {
+        filetable_put(fe);
+        return ESPIPE;
+    }
+
+    uio_uinit(&iov, &user_uio, buf, len, pos, rw);
+    if (rw == UIO_READ) {
+        err = VOP_READ(fe->fe_vn, &user_uio);
     }
     else {
-        pos = 0;
+        err = VOP_WRITE(fe->fe_vn, &user_uio);
+    }
+    filetable_put(fe);
+    if (err) {
+        return err;
     }
 
-    int how = fe->fe_status & O_ACCMODE;
+    *retval = user_uio.uio_offset - pos;
+    if (rw == UIO_READ) {
+        curthread->t_usage.u_inbytes += *retval;
+    }
+    else {
+        curthread->t_usage.u_outbytes += *retval;
+    }
+    return 0;
+}
 
-    /* Check if file is opened for writing */
-    if (how != O_WRONLY && how != O_RDWR) {
-        lock_release(fe->fe_lock);
-        return EBADF;
+/*
+ * Reads up to buflen bytes from the file specified by fd, starting at offset pos, without
+ * using or changing the seek position. Reads of the same open file by other threads or
+ * processes aren't held up waiting for each other.
+ *
+ * Parameters: fd (file handle of file to be read from), buf (pointer to location where
+ * read values are to be stored), buflen (number of bytes to read), posptr (user address of
+ * the offset to read at), pointer to return value address.
+ * Returns: On success, count of bytes read (positive) & 0 if at end of file.  On failure, -1
+ * and errno set.
+ */
+int
+sys_pread(int fd, userptr_t buf, size_t buflen, const_userptr_t posptr, int *retval)
+{
+    return positional_io(fd, buf, buflen, posptr, UIO_READ, retval);
+}
+
+/*
+ * Writes up to nbytes bytes to the file specified by fd, starting at offset pos, without
+ * using or changing the seek position.
+ *
+ * Parameters: fd (file handle of file to write to), buf (pointer to the values to be
+ * written), nbytes (number of bytes to write), posptr (user address of the offset to write
+ * at), pointer to return value address.
+ * Returns: On success, the number of bytes written (positive).  On failure, -1 and errno set.
+ */
+int
+sys_pwrite(int fd, userptr_t buf, size_t nbytes, const_userptr_t posptr, int *retval)
+{
+    return positional_io(fd, buf, nbytes, posptr, UIO_WRITE, retval);
+}
+
+/*
+ * Size of the kernel buffer copy_file_range moves data through. A
+ * multiple of the SFS block size, so that whole blocks are read and
+ * written once the copy is aligned.
+ */
+#define COPY_BUFSIZE (16 * 1024)
+
+/*
+ * Copies up to len bytes from the file specified by infd to the file specified by outfd,
+ * through a kernel buffer, without passing the data through user memory. For each side,
+ * if the position pointer is NULL the file's seek position is used and advanced;
+ * otherwise the offset it points to is used and updated, and the seek position is left
+ * alone. Seek positions in use are locked for the whole copy, in address order so that
+ * two copies going opposite ways between the same files can't deadlock.
+ *
+ * Parameters: infd (file handle to copy from), inposp (user address of the offset to
+ * copy from, or NULL), outfd (file handle to copy to), outposp (user address of the offset
+ * to copy to, or NULL), stackargs (user address of the remaining arguments, len and flags,
+ * which are on the stack past the register arguments), pointer to return value address.
+ * Returns: On success, the number of bytes copied, which is 0 at end of file. If an error
+ * happens after some bytes were copied, the count so far.  On failure, -1 and errno set:
+ * EBADF, ESPIPE if an offset is given for a file that isn't seekable, EINVAL if flags
+ * isn't 0, an offset is negative, or the two ranges overlap in the same file.
+ */
+int
+sys_copy_file_range(int infd, userptr_t inposp, int outfd, userptr_t outposp,
+                    const_userptr_t stackargs, int *retval)
+{
+    int err = 0;
+    struct filetable *ft = curproc->p_filetable;
+    struct file_entry *infe, *outfe;
+    struct lock *locks[2];
+    unsigned nlocks, i;
+    uint32_t args[2];
+    size_t len, done, chunk, got;
+    off_t inpos, outpos;
+    struct iovec iov;
+    struct uio kuio;
+    char *buf;
+
+    err = copyin(stackargs, args, sizeof(args));
+    if (err) {
+        return err;
+    }
+    /* The byte count comes back as an int, so copy no more than fits in one */
+    len = args[0] > 0x7fffffff ? 0x7fffffff : args[0];
+    if (args[1] != 0) {
+        return EINVAL;
     }
 
-    /* Perform actual write opperation */
-    uio_uinit(&iov, &user_uio, buf, nbytes, pos, UIO_WRITE);
-    err = VOP_WRITE(fe->fe_vn, &user_uio);
+    /* Check both file descriptors, and hold on to their file entries */
+    err = filetable_get(ft, infd, &infe);
     if (err) {
-        lock_release(fe->fe_lock);
+        return err;
+    }
+    err = filetable_get(ft, outfd, &outfe);
+    if (err) {
+        filetable_put(infe);
         return err;
     }
 
-    *retval = user_uio.uio_offset - pos;
-    
-    if(locked) {
-        fe->fe_offset += *retval;
-        lock_release(fe->fe_lock);
+    /* Check the files are opened the right way */
+    int inhow = infe->fe_status & O_ACCMODE;
+    int outhow = outfe->fe_status & O_ACCMODE;
+    if ((inhow != O_RDONLY && inhow != O_RDWR) ||
+        (outhow != O_WRONLY && outhow != O_RDWR)) {
+        err = EBADF;
+        goto out;
     }
 
-    return 0;
+    /* An offset means nothing to a device or pipe */
+    if ((inposp != NULL && !VOP_ISSEEKABLE(infe->fe_vn)) ||
+        (outposp != NULL && !VOP_ISSEEKABLE(outfe->fe_vn))) {
+        err = ESPIPE;
+        goto out;
+    }
+
+    inpos = outpos = 0;
+    if (inposp != NULL) {
+        err = copyin(inposp, &inpos, sizeof(inpos));
+        if (err) {
+            goto out;
+        }
+    }
+    if (outposp != NULL) {
+        err = copyin(outposp, &outpos, sizeof(outpos));
+        if (err) {
+            goto out;
+        }
+    }
+    if (inpos < 0 || outpos < 0) {
+        err = EINVAL;
+        goto out;
+    }
+
+    buf = kmalloc(COPY_BUFSIZE);
+    if (buf == NULL) {
+        err = ENOMEM;
+        goto out;
+    }
+
+    /* Lock the seek positions we're really using, lower address first */
+    nlocks = 0;
+    if (inposp == NULL && VOP_ISSEEKABLE(infe->fe_vn)) {
+        locks[nlocks++] = infe->fe_lock;
+    }
+    /* Unless it's the same file entry and we already have its lock */
+    if (outposp == NULL && VOP_ISSEEKABLE(outfe->fe_vn) &&
+        !(outfe == infe && nlocks == 1)) {
+        locks[nlocks++] = outfe->fe_lock;
+    }
+    if (nlocks == 2 && (vaddr_t)locks[1] < (vaddr_t)locks[0]) {
+        locks[1] = infe->fe_lock;
+        locks[0] = outfe->fe_lock;
+    }
+    for (i = 0; i < nlocks; i++) {
+        lock_acquire(locks[i]);
+    }
+    if (inposp == NULL && VOP_ISSEEKABLE(infe->fe_vn)) {
+        inpos = infe->fe_offset;
+    }
+    if (outposp == NULL && VOP_ISSEEKABLE(outfe->fe_vn)) {
+        outpos = outfe->fe_offset;
+    }
+
+    /* Copying a range onto part of itself would read back what it just wrote */
+    if (infe->fe_vn == outfe->fe_vn && VOP_ISSEEKABLE(infe->fe_vn) &&
+        inpos < outpos + (off_t)len && outpos < inpos + (off_t)len) {
+        err = EINVAL;
+        done = 0;
+        goto unlock;
+    }
+
+    for (done = 0; done < len; done += got) {
+        chunk = len - done < COPY_BUFSIZE ? len - done : COPY_BUFSIZE;
+
+        uio_kinit(&iov, &kuio, buf, chunk, inpos, UIO_READ);
+        err = VOP_READ(infe->fe_vn, &kuio);
+        if (err) {
+            break;
+        }
+        got = chunk - kuio.uio_resid;
+        if (got == 0) {
+            /* End of file */
+            break;
+        }
+
+        uio_kinit(&iov, &kuio, buf, got, outpos, UIO_WRITE);
+        err = VOP_WRITE(outfe->fe_vn, &kuio);
+        /* Only what was written counts as copied */
+        got -= kuio.uio_resid;
+        if (VOP_ISSEEKABLE(infe->fe_vn)) {
+            inpos += got;
+        }
+        if (VOP_ISSEEKABLE(outfe->fe_vn)) {
+            outpos += got;
+        }
+        if (err || kuio.uio_resid > 0) {
+            done += got;
+            break;
+        }
+    }
+
+    /* Report a failure only if nothing got copied */
+    if (done > 0) {
+        err = 0;
+    }
+    if (inposp == NULL && VOP_ISSEEKABLE(infe->fe_vn)) {
+        infe->fe_offset = inpos;
+    }
+    if (outposp == NULL && VOP_ISSEEKABLE(outfe->fe_vn)) {
+        outfe->fe_offset = outpos;
+    }
+
+ unlock:
+    for (i = nlocks; i-- > 0; ) {
+        lock_release(locks[i]);
+    }
+    kfree(buf);
+    if (err) {
+        goto out;
+    }
+
+    if (inposp != NULL) {
+        err = copyout(&inpos, inposp, sizeof(inpos));
+    }
+    if (!err && outposp != NULL) {
+        err = copyout(&outpos, outposp, sizeof(outpos));
+    }
+    if (err) {
+        goto out;
+    }
+
+    *retval = done;
+    curthread->t_usage.u_inbytes += done;
+    curthread->t_usage.u_outbytes += done;
+
+ out:
+    filetable_put(outfe);
+    filetable_put(infe);
+    return err;
 }
 
 /* 
@@ -318,44 +703,14 @@ sys_write(int fd, userptr_t buf, size_t nbytes, int *retval)
 int
 sys_dup2(int oldfd, int newfd, int *retval)
 {   
-    struct filetable *ft = curproc->p_filetable;
     int result = 0;
 
-    /* Check for invalid file descriptors */
-    if (oldfd < 0 || oldfd > __OPEN_MAX-1)
-        return EBADF;
-    
-    if (newfd < 0 || newfd > __OPEN_MAX-1)
-        return EBADF;
-
-    if (newfd == oldfd){
-        *retval = newfd;
-        return 0;
-    }
-    
-    lock_acquire(ft->ft_lock);
-    if (ft->ft_file_entries[oldfd] == NULL || ft->ft_file_entries[oldfd]->fe_vn == NULL)
-    {
-        lock_release(ft->ft_lock);
-        return EBADF;
-    }
-    lock_release(ft->ft_lock);
-
-    /* If newfd is open close it */
-    lock_acquire(ft->ft_lock);
-    if (ft->ft_file_entries[newfd] != NULL){
-        result = dup_file_close(newfd);
-        if(result) {
-            lock_release(ft->ft_lock);
-            return result;
-        }
+    result = filetable_dup2(curproc->p_filetable, oldfd, newfd);
+    if (result) {
+        return result;
     }
 
-    ft->ft_file_entries[oldfd]->fe_refcount += 1;
-    ft->ft_file_entries[newfd] = ft->ft_file_entries[oldfd];
     *retval = newfd;
-    lock_release(ft->ft_lock);
-
     return 0;
 }
 
@@ -21,20 +21,148 @@ filetable_init()
     }
 
     /* Create filetable lock */
-    ft->ft_lock = lock_create("filetable-lock");
-    if(ft->ft_lock == NULL) {
+    ft->ft_rwlock = rwlock_create("filetable-lock");
+    if(ft->ft_rwlock == NULL) {
         kfree(ft);
         return NULL;
     }
+    spinlock_init(&ft->ft_slotlock);
+
+    ft->ft_file_entries = kmalloc(FT_INITSIZE * sizeof(struct file_entry *));
+    if (ft->ft_file_entries == NULL) {
+        spinlock_cleanup(&ft->ft_slotlock);
+        rwlock_destroy(ft->ft_rwlock);
+        kfree(ft);
+        return NULL;
+    }
+    ft->ft_size = FT_INITSIZE;
 
     /* Initialize file entries in the file table to be NULL*/
-    for (int fd = 0; fd < __OPEN_MAX; fd++) {
+    for (int fd = 0; fd < FT_INITSIZE; fd++) {
         ft->ft_file_entries[fd] = NULL;
     }
+    for (int i = 0; i < FT_MAPWORDS; i++) {
+        ft->ft_inuse[i] = 0;
+    }
 
     return ft;
 }
 
+/*
+ * Returns the index of the lowest set bit in w, which must not be 0. Binary search, so it
+ * takes the same five steps for any word.
+ */
+static
+unsigned
+lowest_bit(uint32_t w)
+{
+    unsigned bit = 0;
+
+    KASSERT(w != 0);
+    if ((w & 0xffff) == 0) {
+        w >>= 16;
+        bit += 16;
+    }
+    if ((w & 0xff) == 0) {
+        w >>= 8;
+        bit += 8;
+    }
+    if ((w & 0xf) == 0) {
+        w >>= 4;
+        bit += 4;
+    }
+    if ((w & 0x3) == 0) {
+        w >>= 2;
+        bit += 2;
+    }
+    if ((w & 0x1) == 0) {
+        bit += 1;
+    }
+    return bit;
+}
+
+/*
+ * Makes sure file table ft has a slot for file handle fd, doubling the array as many times
+ * as needed. The caller holds ft_rwlock for writing (or has the only reference to ft), so the
+ * slots can't change while they're copied; only the switch to the new array needs
+ * ft_slotlock.
+ *
+ * Parameters: ft (the file table), fd (the file handle that needs a slot)
+ * Returns: On success, 0.  On failure, ENOMEM.
+ */
+static
+int
+filetable_grow(struct filetable *ft, int fd)
+{
+    struct file_entry **entries, **old;
+    unsigned size, i;
+
+    KASSERT(fd >= 0 && fd < __OPEN_MAX);
+    if ((unsigned)fd < ft->ft_size) {
+        return 0;
+    }
+
+    size = ft->ft_size;
+    while (size <= (unsigned)fd) {
+        size *= 2;
+    }
+    if (size > __OPEN_MAX) {
+        size = __OPEN_MAX;
+    }
+
+    entries = kmalloc(size * sizeof(struct file_entry *));
+    if (entries == NULL) {
+        return ENOMEM;
+    }
+    for (i = 0; i < ft->ft_size; i++) {
+        entries[i] = ft->ft_file_entries[i];
+    }
+    for (; i < size; i++) {
+        entries[i] = NULL;
+    }
+
+    spinlock_acquire(&ft->ft_slotlock);
+    old = ft->ft_file_entries;
+    ft->ft_file_entries = entries;
+    ft->ft_size = size;
+    spinlock_release(&ft->ft_slotlock);
+
+    kfree(old);
+    return 0;
+}
+
+/*
+ * Takes the lowest free file handle in file table ft, making room for it if need be. The
+ * caller holds ft_rwlock for writing, and puts the file entry in the slot.
+ *
+ * Parameters: ft (the file table), retfd (where to put the file handle)
+ * Returns: On success, 0.  On failure, EMFILE if all __OPEN_MAX are taken, or ENOMEM.
+ */
+static
+int
+filetable_allocfd(struct filetable *ft, int *retfd)
+{
+    int fd, i, err;
+
+    for (i = 0; i < FT_MAPWORDS; i++) {
+        if (ft->ft_inuse[i] == 0xffffffff) {
+            continue;
+        }
+        fd = i*32 + lowest_bit(~ft->ft_inuse[i]);
+        if (fd >= __OPEN_MAX) {
+            break;
+        }
+        err = filetable_grow(ft, fd);
+        if (err) {
+            return err;
+        }
+        ft->ft_inuse[i] |= (uint32_t)1 << (fd % 32);
+        *retfd = fd;
+        return 0;
+    }
+    return EMFILE;
+}
+
 /* 
  * Initialize the first three filedescriptors for STDIN, STDOUT, STDERR.
  * Parameters: pointer to ft (the file table for which to init the special file entries)
@@ -74,6 +202,7 @@ filetable_init_std(struct filetable *ft){
     std_in_fe->fe_offset = 0;
     std_in_fe->fe_status = O_RDONLY;
     std_in_fe->fe_refcount = 1; 
+    spinlock_init(&std_in_fe->fe_countlock);
     std_in_fe->fe_lock = lock_create("std-in-lock"); 
     if (std_in_fe->fe_lock == NULL){
         kfree(std_in_fe);
@@ -86,6 +215,7 @@ filetable_init_std(struct filetable *ft){
     std_out_fe->fe_offset = 0;
     std_out_fe->fe_status = O_WRONLY;
     std_out_fe->fe_refcount = 1; 
+    spinlock_init(&std_out_fe->fe_countlock);
     std_out_fe->fe_lock = lock_create("std-out-lock"); 
     if (std_out_fe->fe_lock == NULL){
         kfree(std_out_fe);
@@ -97,19 +227,50 @@ filetable_init_std(struct filetable *ft){
     std_err_fe->fe_offset = 0;
     std_err_fe->fe_status = O_WRONLY;
     std_err_fe->fe_refcount = 1; 
+    spinlock_init(&std_err_fe->fe_countlock);
     std_err_fe->fe_lock = lock_create("std-err-lock"); 
     if (std_err_fe->fe_lock == NULL){
         kfree(std_err_fe);
         return ENOMEM;
     }    
 
+    KASSERT(ft->ft_size >= 3);
     ft->ft_file_entries[0] = std_in_fe;
     ft->ft_file_entries[1] = std_out_fe;
     ft->ft_file_entries[2] = std_err_fe;
+    ft->ft_inuse[0] |= 0x7;
     
     return 0;
 }
 
+/*
+ * Gives back file handle fd in file table ft; the caller has emptied its slot, and holds
+ * ft_rwlock for writing.
+ *
+ * Parameters: ft (the file table), fd (the file handle)
+ */
+static
+void
+filetable_freefd(struct filetable *ft, int fd)
+{
+    ft->ft_inuse[fd / 32] &= ~((uint32_t)1 << (fd % 32));
+}
+
+/*
+ * Takes another reference to a file entry the caller already has one to.
+ *
+ * Parameters: fe (the file entry)
+ */
+static
+void
+file_entry_incref(struct file_entry *fe)
+{
+    spinlock_acquire(&fe->fe_countlock);
+    KASSERT(fe->fe_refcount > 0);
+    fe->fe_refcount++;
+    spinlock_release(&fe->fe_countlock);
+}
+
 /*
  * Opens a file from a file table.  Calls vfs_open on the filename stored in a buffer kernel
  * Stores the open file as a file entry in the process's filetable.
@@ -123,158 +284,319 @@ file_open(char *filename, int flags, mode_t mode, int *retfd) {
     int err;
     char buf[32];
     struct vnode *ft_vnode;
+    struct file_entry *fe;
 
     /* Check if flags are right */
     int how = flags & O_ACCMODE;
     if (how != O_WRONLY && how != O_RDONLY && how != O_RDWR)
         return EINVAL;
     
-    /* Find an empty row in the filetable */
+    /* Take the lowest free file handle, or fail if the filetable is full */
     struct filetable *filetable = curproc->p_filetable;
-    int fd = 3;
-    lock_acquire(filetable->ft_lock);
-    for (fd = 3; fd < __OPEN_MAX; fd++){
-        if(filetable->ft_file_entries[fd] == NULL) {
-            break;
-        }
-    }
-    /* File table is full */
-    if(fd == __OPEN_MAX) {
-        lock_release(filetable->ft_lock);
-        return EMFILE; 
+    int fd;
+    rwlock_acquire_write(filetable->ft_rwlock);
+    err = filetable_allocfd(filetable, &fd);
+    if (err) {
+        rwlock_release_write(filetable->ft_rwlock);
+        return err;
     }
 
     /* vfs_open destroys the string passed into it, let's copy*/
     strcpy(buf, filename);
     err = vfs_open(buf, flags, mode, &ft_vnode);
     if (err) {
-        lock_release(filetable->ft_lock);
+        filetable_freefd(filetable, fd);
+        rwlock_release_write(filetable->ft_rwlock);
         return err;
     }
-    /* Update the file table with the vnode */
-    filetable->ft_file_entries[fd] = (struct file_entry *)kmalloc(sizeof(struct file_entry));
-    filetable->ft_file_entries[fd]->fe_status = flags;
-    filetable->ft_file_entries[fd]->fe_offset = 0;
-    filetable->ft_file_entries[fd]->fe_vn= ft_vnode;
-    filetable->ft_file_entries[fd]->fe_filename = filename;
-    filetable->ft_file_entries[fd]->fe_refcount = 1;
+    /* Set up the file entry for the vnode */
+    fe = (struct file_entry *)kmalloc(sizeof(struct file_entry));
+    if (fe == NULL) {
+        vfs_close(ft_vnode);
+        filetable_freefd(filetable, fd);
+        rwlock_release_write(filetable->ft_rwlock);
+        return ENOMEM;
+    }
+    fe->fe_status = flags;
+    fe->fe_offset = 0;
+    fe->fe_vn= ft_vnode;
+    fe->fe_filename = filename;
+    fe->fe_refcount = 1;
+    spinlock_init(&fe->fe_countlock);
     /* Create the file entry lock */
-    char fe_lock_name[__OPEN_MAX+10];
-	snprintf(fe_lock_name, __OPEN_MAX+10, "fe-lock-%d", fd);
-	filetable->ft_file_entries[fd]->fe_lock = lock_create(fe_lock_name);
-    lock_release(filetable->ft_lock);
+    char fe_lock_name[16];
+	snprintf(fe_lock_name, sizeof(fe_lock_name), "fe-lock-%d", fd);
+	fe->fe_lock = lock_create(fe_lock_name);
+    if (fe->fe_lock == NULL) {
+        spinlock_cleanup(&fe->fe_countlock);
+        kfree(fe);
+        vfs_close(ft_vnode);
+        filetable_freefd(filetable, fd);
+        rwlock_release_write(filetable->ft_rwlock);
+        return ENOMEM;
+    }
+
+    /* Only now, once it's all set up, can filetable_get find it */
+    spinlock_acquire(&filetable->ft_slotlock);
+    filetable->ft_file_entries[fd] = fe;
+    spinlock_release(&filetable->ft_slotlock);
+    rwlock_release_write(filetable->ft_rwlock);
     *retfd = fd;
 
     return 0;
 }
 
 /* 
- * Closes the file with file handle fd
+ * Closes the file with file handle fd in the current process
  *
  * Parameters: fd (file handle to close)
  * Returns: On success, 0.  On failure, error code.
  */
 int
 file_close(int fd)
+{
+    return filetable_close(curproc->p_filetable, fd);
+}
+
+/* 
+ * Closes the file with file handle fd in file table ft
+ *
+ * Parameters: ft (the file table), fd (file handle to close)
+ * Returns: On success, 0.  On failure, error code.
+ */
+int
+filetable_close(struct filetable *ft, int fd)
 {
     int err = 0;
-    struct filetable *ft = curproc->p_filetable;
-    struct file_entry *fe;
 
     /* Making sure no one changes the filetable while we access it */
-    lock_acquire(ft->ft_lock);
-    fe = ft->ft_file_entries[fd];
-    /* Check if the file is already closed */
-    if (fe == NULL) {
-        lock_release(ft->ft_lock);
-        return EBADF;
-    }
-    /* If it's open let's close it */
-    fe->fe_refcount --;
-    /* If there are no more references close it */
-    if (fe->fe_refcount == 0) {
-        vfs_close(ft->ft_file_entries[fd]->fe_vn);
-        lock_destroy(fe->fe_lock);
-        kfree(fe);
-    }
-
-    ft->ft_file_entries[fd] = NULL;
-    lock_release(ft->ft_lock);
+    rwlock_acquire_write(ft->ft_rwlock);
+    err = dup_file_close(ft, fd);
+    rwlock_release_write(ft->ft_rwlock);
 
     return err;
 }
 
 /* 
- * UNSYNCHRONIZED method used to close a file in dup2.  Same as file_close but not atomic since
- *  dup2 is atomic already.
+ * UNSYNCHRONIZED method used to close a file in dup2.  Same as filetable_close but not atomic,
+ * the caller holds ft_rwlock for writing.
  * 
- * Parameters: fd (file handle to close)
+ * Parameters: ft (the file table), fd (file handle to close)
  * Returns: On success, 0.  On failure, error code.
  */
 int
-dup_file_close(int fd)
+dup_file_close(struct filetable *ft, int fd)
 {
-
-    int err = 0;
-    struct filetable *ft = curproc->p_filetable;
     struct file_entry *fe;
 
+    /* Past the end of the table is never open */
+    if (fd < 0 || (unsigned)fd >= ft->ft_size) {
+        return EBADF;
+    }
+
+    spinlock_acquire(&ft->ft_slotlock);
     fe = ft->ft_file_entries[fd];
+    ft->ft_file_entries[fd] = NULL;
+    spinlock_release(&ft->ft_slotlock);
+
     /* Check if the file is already closed */
     if (fe == NULL) {
         return EBADF;
     }
-    /* If it's open let's close it */
-    fe->fe_refcount --;
-    /* If there are no more references close it */
-    if (fe->fe_refcount == 0) {
-        vfs_close(ft->ft_file_entries[fd]->fe_vn);
-        kfree(fe);
+    filetable_freefd(ft, fd);
+    /*
+     * Drop the table's reference. Other processes may share the entry, and a read or
+     * write already under way still holds its own, so it isn't necessarily closed yet.
+     */
+    filetable_put(fe);
+
+    return 0;
+}
+
+/* 
+ * Clones the file handle oldfd onto the file handle newfd in file table ft. If newfd names an
+ * already-open file, that file is closed. If newfd and old fd are the same, nothing happens.
+ *
+ * Parameters: ft (the file table), oldfd (file handle to be cloned), newfd (file handle to be
+ * cloned onto)
+ * Returns: On success, 0.  On failure, error code.
+ */
+int
+filetable_dup2(struct filetable *ft, int oldfd, int newfd)
+{
+    struct file_entry *fe;
+    int result = 0;
+
+    /* Check for invalid file descriptors */
+    if (oldfd < 0 || oldfd > __OPEN_MAX-1)
+        return EBADF;
+    
+    if (newfd < 0 || newfd > __OPEN_MAX-1)
+        return EBADF;
+
+    rwlock_acquire_write(ft->ft_rwlock);
+    fe = (unsigned)oldfd < ft->ft_size ? ft->ft_file_entries[oldfd] : NULL;
+    if (fe == NULL || fe->fe_vn == NULL)
+    {
+        rwlock_release_write(ft->ft_rwlock);
+        return EBADF;
     }
 
-    ft->ft_file_entries[fd] = NULL;
+    if (newfd == oldfd){
+        rwlock_release_write(ft->ft_rwlock);
+        return 0;
+    }
 
-    return err;
+    /* Make room for newfd */
+    result = filetable_grow(ft, newfd);
+    if (result) {
+        rwlock_release_write(ft->ft_rwlock);
+        return result;
+    }
+
+    /* If newfd is open close it */
+    if (ft->ft_file_entries[newfd] != NULL){
+        result = dup_file_close(ft, newfd);
+        if(result) {
+            rwlock_release_write(ft->ft_rwlock);
+            return result;
+        }
+    }
+
+    file_entry_incref(fe);
+    ft->ft_inuse[newfd / 32] |= (uint32_t)1 << (newfd % 32);
+    spinlock_acquire(&ft->ft_slotlock);
+    ft->ft_file_entries[newfd] = fe;
+    spinlock_release(&ft->ft_slotlock);
+    rwlock_release_write(ft->ft_rwlock);
+
+    return 0;
 }
 
 /* 
- *Destroys a filetable.
-
+ * Destroys a filetable, closing whatever is still open in it.
+ *
  * Parameters: ft (filetable to destroy)
  * Returns: void
  */
 void filetable_destroy(struct filetable *ft)
 {
+    uint32_t open;
+    int i;
+
     KASSERT(ft != NULL);
 
-    /* Iterate over file table and destroy file entries */
-    for (int i = __OPEN_MAX - 1; i <= 0; i--){
-        /* We can just call file_close, since it destroys the file entry's lock and kfrees it */
-        if(ft->ft_file_entries[i] != NULL)
-            file_close(i);
+    /* Close the open file handles, found from the bitmap */
+    for (i = 0; i < FT_MAPWORDS; i++) {
+        open = ft->ft_inuse[i];
+        while (open != 0) {
+            /* We can just call filetable_close, since it destroys the file entry's lock and kfrees it */
+            filetable_close(ft, i*32 + lowest_bit(open));
+            open &= open - 1;
+        }
     }
 
-    lock_destroy(ft->ft_lock);
+    rwlock_destroy(ft->ft_rwlock);
+    spinlock_cleanup(&ft->ft_slotlock);
+    kfree(ft->ft_file_entries);
     kfree(ft);
 }
 
-void
+/*
+ * Gives new_ft, a fresh file table no one else can see yet, a copy of ft's open files, for
+ * fork and spawn. Only the open file handles are visited.
+ *
+ * Parameters: new_ft (the new file table), ft (the file table to copy)
+ * Returns: On success, 0.  On failure, ENOMEM, and new_ft is left empty.
+ */
+int
 filetable_copy(struct filetable *new_ft, struct filetable *ft)
 {
-    lock_acquire(ft->ft_lock);
-    for (int i=0; i< __OPEN_MAX; i++) {
-        struct file_entry *fe = ft->ft_file_entries[i];
+    struct file_entry *fe;
+    uint32_t open;
+    int i, fd, err;
 
-        if(fe == NULL) {
-            continue;
+    rwlock_acquire_read(ft->ft_rwlock);
+
+    /* Make new_ft as big as ft up front, so nothing after this can fail */
+    err = filetable_grow(new_ft, ft->ft_size - 1);
+    if (err) {
+        rwlock_release_read(ft->ft_rwlock);
+        return err;
+    }
+
+    for (i = 0; i < FT_MAPWORDS; i++) {
+        open = ft->ft_inuse[i];
+        new_ft->ft_inuse[i] = open;
+        while (open != 0) {
+            fd = i*32 + lowest_bit(open);
+            open &= open - 1;
+
+            fe = ft->ft_file_entries[fd];
+            KASSERT(fe != NULL);
+            file_entry_incref(fe);
+            new_ft->ft_file_entries[fd] = fe;
         }
+    }
 
-        lock_acquire(fe->fe_lock);
-        fe->fe_refcount = fe->fe_refcount + 1;
-        lock_release(fe->fe_lock);
-    
-        new_ft->ft_file_entries[i] = fe;
+    rwlock_release_read(ft->ft_rwlock);
+    return 0;
+}
+
+/*
+ * Looks up the file entry for file handle fd in file table ft and takes a reference to it,
+ * so it stays valid even if another thread closes fd meanwhile. This is the fast path for
+ * read, write and lseek: it only holds ft_slotlock, a spinlock, for the lookup itself.
+ * Give the reference back with filetable_put.
+ *
+ * Parameters: ft (the file table), fd (file handle to look up), ret (where to put the
+ * file entry)
+ * Returns: On success, 0.  On failure, EBADF.
+ */
+int
+filetable_get(struct filetable *ft, int fd, struct file_entry **ret)
+{
+    struct file_entry *fe;
+
+    if (fd < 0 || fd > __OPEN_MAX-1) {
+        return EBADF;
     }
 
-    lock_release(ft->ft_lock);
-}
\ No newline at end of file
+    spinlock_acquire(&ft->ft_slotlock);
+    fe = (unsigned)fd < ft->ft_size ? ft->ft_file_entries[fd] : NULL;
+    if (fe == NULL || fe->fe_vn == NULL) {
+        spinlock_release(&ft->ft_slotlock);
+        return EBADF;
+    }
+    file_entry_incref(fe);
+    spinlock_release(&ft->ft_slotlock);
+
+    *ret = fe;
+    return 0;
+}
+
+/*
+ * Drops a reference to a file entry, from filetable_get or from a file table slot. The
+ * last one closes the file and frees the entry.
+ *
+ * Parameters: fe (the file entry)
+ */
+void
+filetable_put(struct file_entry *fe)
+{
+    int refcount;
+
+    spinlock_acquire(&fe->fe_countlock);
+    KASSERT(fe->fe_refcount > 0);
+    fe->fe_refcount--;
+    refcount = fe->fe_refcount;
+    spinlock_release(&fe->fe_countlock);
+
+    /* If there are no more references close it */
+    if (refcount == 0) {
+        vfs_close(fe->fe_vn);
+        lock_destroy(fe->fe_lock);
+        spinlock_cleanup(&fe->fe_countlock);
+        kfree(fe);
+    }
+}
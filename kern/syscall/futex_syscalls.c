@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Futexes: wait and wake on a word of user memory.
+ *
+ * User code keeps its lock or semaphore state in an ordinary int and
+ * updates it with atomic instructions, so uncontended operations
+ * never enter the kernel. Only a thread that has to block calls
+ * futex_wait, which sleeps as long as the word still holds the value
+ * it expected; whoever changes the word then calls futex_wake.
+ *
+ * Waiters are keyed by (address space, user address), so a futex is
+ * shared by the threads of one process. They are hashed into a fixed
+ * table of buckets, each with a spinlock, a wait channel, and a list
+ * of waiters. Different futexes can share a bucket; a wakeup marks
+ * the waiters it is meant for and wakes the whole channel, and the
+ * others go back to sleep.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <lib.h>
+#include <clock.h>
+#include <copyinout.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <current.h>
+#include <proc.h>
+#include <futex_syscalls.h>
+
+#define FUTEX_BUCKETS 64
+
+struct futex_waiter {
+    struct addrspace *fw_as;
+    vaddr_t fw_addr;
+    bool fw_woken;
+    struct futex_waiter *fw_next;
+};
+
+struct futex_bucket {
+    struct spinlock fb_lock;
+    struct wchan *fb_wchan;
+    struct futex_waiter *fb_waiters;    /* in arrival order */
+};
+
+static struct futex_bucket futex_table[FUTEX_BUCKETS];
+
+/*
+ * Creates the wait channels for the futex table. Called once at boot.
+ *
+ * Parameters: void
+ * Returns: void
+ */
+void
+futex_bootstrap(void)
+{
+    for (int i = 0; i < FUTEX_BUCKETS; i++) {
+        spinlock_init(&futex_table[i].fb_lock);
+        futex_table[i].fb_wchan = wchan_create("futex");
+        if (futex_table[i].fb_wchan == NULL) {
+            panic("futex_bootstrap: wchan_create failed\n");
+        }
+        futex_table[i].fb_waiters = NULL;
+    }
+}
+
+/*
+ * Finds the bucket for a futex. Words are 4-aligned, so the low bits
+ * of the address are dropped; the address space pointer is mixed in
+ * so the same address in different processes spreads out.
+ *
+ * Parameters: as (the address space), addr (the user address)
+ * Returns: the bucket
+ */
+static
+struct futex_bucket *
+futex_hash(struct addrspace *as, vaddr_t addr)
+{
+    uint32_t h;
+
+    h = (addr >> 2) ^ ((vaddr_t)as >> 4);
+    h *= 2654435761U;
+    return &futex_table[h >> 26];
+}
+
+/*
+ * Takes a waiter off its bucket's list. Must hold the bucket lock.
+ *
+ * Parameters: fb (the bucket), fw (the waiter)
+ * Returns: void
+ */
+static
+void
+futex_unlink(struct futex_bucket *fb, struct futex_waiter *fw)
+{
+    struct futex_waiter **p;
+
+    KASSERT(spinlock_do_i_hold(&fb->fb_lock));
+    for (p = &fb->fb_waiters; *p != fw; p = &(*p)->fw_next) {
+        KASSERT(*p != NULL);
+    }
+    *p = fw->fw_next;
+}
+
+/*
+ * Sleeps until woken by futex_wake on the same address, provided the word at
+ * uaddr still holds val.
+ *
+ * Parameters: uaddr (user address of the word, must be 4-aligned), val (the
+ * value the caller last saw there), timeout (user pointer to a struct timespec
+ * giving the longest time to wait, or NULL for no limit)
+ * Returns: 0 if woken.  On failure, error code (EAGAIN if the word no longer
+ * held val, ETIMEDOUT if the timeout ran out)
+ */
+int
+sys_futex_wait(userptr_t uaddr, int val, const_userptr_t timeout)
+{
+    struct futex_waiter fw;
+    struct futex_bucket *fb;
+    struct timespec ts;
+    uint64_t deadline = 0;
+    int cur, err;
+
+    if ((vaddr_t)uaddr % sizeof(int) != 0) {
+        return EINVAL;
+    }
+    if (timeout != NULL) {
+        err = copyin(timeout, &ts, sizeof(ts));
+        if (err) {
+            return err;
+        }
+        if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+            return EINVAL;
+        }
+        deadline = timer_now() + timer_ns2ticks((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+    }
+
+    fw.fw_as = curproc->p_addrspace;
+    fw.fw_addr = (vaddr_t)uaddr;
+    fw.fw_woken = false;
+    fw.fw_next = NULL;
+    fb = futex_hash(fw.fw_as, fw.fw_addr);
+
+    /*
+     * Get on the list before looking at the word. copyin can fault, so it
+     * can't be done with the bucket lock held; but a waker changes the word
+     * before calling futex_wake, so if we miss the change we're already on
+     * the list to be marked woken.
+     */
+    spinlock_acquire(&fb->fb_lock);
+    struct futex_waiter **p = &fb->fb_waiters;
+    while (*p != NULL) {
+        p = &(*p)->fw_next;
+    }
+    *p = &fw;
+    spinlock_release(&fb->fb_lock);
+
+    err = copyin(uaddr, &cur, sizeof(cur));
+    if (err == 0 && cur != val) {
+        err = EAGAIN;
+    }
+
+    spinlock_acquire(&fb->fb_lock);
+    while (err == 0 && !fw.fw_woken) {
+        if (timeout != NULL) {
+            err = wchan_sleep_until(fb->fb_wchan, &fb->fb_lock, deadline);
+        }
+        else {
+            wchan_sleep(fb->fb_wchan, &fb->fb_lock);
+        }
+    }
+    if (fw.fw_woken) {
+        /* The wakeup already took us off the list; it wins over errors */
+        err = 0;
+    }
+    else {
+        futex_unlink(fb, &fw);
+    }
+    spinlock_release(&fb->fb_lock);
+
+    return err;
+}
+
+/*
+ * Wakes up to count threads waiting on the word at uaddr.
+ *
+ * Parameters: uaddr (user address of the word), count (most threads to wake),
+ * retval (pointer to return value address)
+ * Returns: On success, 0 and retval is set to the number woken.  On failure,
+ * error code
+ */
+int
+sys_futex_wake(userptr_t uaddr, int count, int *retval)
+{
+    struct futex_waiter **p, *fw;
+    struct futex_bucket *fb;
+    struct addrspace *as;
+    int woken = 0;
+
+    if ((vaddr_t)uaddr % sizeof(int) != 0) {
+        return EINVAL;
+    }
+
+    as = curproc->p_addrspace;
+    fb = futex_hash(as, (vaddr_t)uaddr);
+
+    spinlock_acquire(&fb->fb_lock);
+    p = &fb->fb_waiters;
+    while ((fw = *p) != NULL && woken < count) {
+        if (fw->fw_as == as && fw->fw_addr == (vaddr_t)uaddr) {
+            *p = fw->fw_next;
+            fw->fw_woken = true;
+            woken++;
+        }
+        else {
+            p = &fw->fw_next;
+        }
+    }
+    if (woken > 0) {
+        wchan_wakeall(fb->fb_wchan, &fb->fb_lock);
+    }
+    spinlock_release(&fb->fb_lock);
+
+    *retval = woken;
+    return 0;
+}
@@ -59,6 +59,7 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <elf.h>
+#include <execcache.h>
 
 /*
  * Load a segment at virtual address VADDR. The segment in memory
@@ -69,6 +70,10 @@
  * FILESIZE may be less than MEMSIZE; if so the remaining portion of
  * the in-memory segment should be zero-filled.
  *
+ * If the exec cache has the segment's contents at DATA, they're
+ * copied from there; otherwise (DATA is NULL) they're read from the
+ * file.
+ *
  * Note that uiomove will catch it if someone tries to load an
  * executable whose load address is in kernel space. If you should
  * change this code to not use uiomove, be sure to check for this case
@@ -79,16 +84,13 @@ int
 load_segment(struct addrspace *as, struct vnode *v,
 	     off_t offset, vaddr_t vaddr,
 	     size_t memsize, size_t filesize,
-	     int is_executable)
+	     const char *data, int is_executable)
 {
 	struct iovec iov;
 	struct uio u;
 	int result;
 
-	if (filesize > memsize) {
-		kprintf("ELF: warning: segment filesize > segment memsize\n");
-		filesize = memsize;
-	}
+	KASSERT(filesize <= memsize);
 
 	DEBUG(DB_EXEC, "ELF: Loading %lu bytes to 0x%lx\n",
 	      (unsigned long) filesize, (unsigned long) vaddr);
@@ -103,7 +105,12 @@ load_segment(struct addrspace *as, struct vnode *v,
 	u.uio_rw = UIO_READ;
 	u.uio_space = as;
 
-	result = VOP_READ(v, &u);
+	if (data != NULL) {
+		result = uiomove((void *)data, filesize, &u);
+	}
+	else {
+		result = VOP_READ(v, &u);
+	}
 	if (result) {
 		return result;
 	}
@@ -153,55 +160,23 @@ load_segment(struct addrspace *as, struct vnode *v,
 int
 load_elf(struct vnode *v, vaddr_t *entrypoint)
 {
-	Elf_Ehdr eh;   /* Executable header */
-	Elf_Phdr ph;   /* "Program header" = segment header */
-	int result, i;
-	struct iovec iov;
-	struct uio ku;
+	struct execimage *ei;
+	const Elf_Phdr *ph;
 	struct addrspace *as;
+	unsigned i;
+	int result;
 
 	as = proc_getas();
 
 	/*
-	 * Read the executable header from offset 0 in the file.
+	 * Get the checked headers, and maybe the segment contents,
+	 * from the exec cache; it reads the file if need be.
 	 */
-
-	uio_kinit(&iov, &ku, &eh, sizeof(eh), 0, UIO_READ);
-	result = VOP_READ(v, &ku);
+	result = execcache_get(v, &ei);
 	if (result) {
 		return result;
 	}
 
-	if (ku.uio_resid != 0) {
-		/* short read; problem with executable? */
-		kprintf("ELF: short read on header - file truncated?\n");
-		return ENOEXEC;
-	}
-
-	/*
-	 * Check to make sure it's a 32-bit ELF-version-1 executable
-	 * for our processor type. If it's not, we can't run it.
-	 *
-	 * Ignore EI_OSABI and EI_ABIVERSION - properly, we should
-	 * define our own, but that would require tinkering with the
-	 * linker to have it emit our magic numbers instead of the
-	 * default ones. (If the linker even supports these fields,
-	 * which were not in the original elf spec.)
-	 */
-
-	if (eh.e_ident[EI_MAG0] != ELFMAG0 ||
-	    eh.e_ident[EI_MAG1] != ELFMAG1 ||
-	    eh.e_ident[EI_MAG2] != ELFMAG2 ||
-	    eh.e_ident[EI_MAG3] != ELFMAG3 ||
-	    eh.e_ident[EI_CLASS] != ELFCLASS32 ||
-	    eh.e_ident[EI_DATA] != ELFDATA2MSB ||
-	    eh.e_ident[EI_VERSION] != EV_CURRENT ||
-	    eh.e_version != EV_CURRENT ||
-	    eh.e_type!=ET_EXEC ||
-	    eh.e_machine!=EM_MACHINE) {
-		return ENOEXEC;
-	}
-
 	/*
 	 * Go through the list of segments and set up the address space.
 	 *
@@ -209,99 +184,48 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	 * data segment, and one data/bss segment, but there might
 	 * conceivably be more. You don't need to support such files
 	 * if it's unduly awkward to do so.
-	 *
-	 * Note that the expression eh.e_phoff + i*eh.e_phentsize is
-	 * mandated by the ELF standard - we use sizeof(ph) to load,
-	 * because that's the structure we know, but the file on disk
-	 * might have a larger structure, so we must use e_phentsize
-	 * to find where the phdr starts.
 	 */
 
-	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
-
-		result = VOP_READ(v, &ku);
-		if (result) {
-			return result;
-		}
-
-		if (ku.uio_resid != 0) {
-			/* short read; problem with executable? */
-			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
-		}
-
-		switch (ph.p_type) {
-		    case PT_NULL: /* skip */ continue;
-		    case PT_PHDR: /* skip */ continue;
-		    case PT_MIPS_REGINFO: /* skip */ continue;
-		    case PT_LOAD: break;
-		    default:
-			kprintf("loadelf: unknown segment type %d\n",
-				ph.p_type);
-			return ENOEXEC;
-		}
-
+	for (i=0; i<ei->ei_nsegs; i++) {
+		ph = &ei->ei_segs[i].es_ph;
 		result = as_define_region(as,
-					  ph.p_vaddr, ph.p_memsz,
-					  ph.p_flags & PF_R,
-					  ph.p_flags & PF_W,
-					  ph.p_flags & PF_X);
+					  ph->p_vaddr, ph->p_memsz,
+					  ph->p_flags & PF_R,
+					  ph->p_flags & PF_W,
+					  ph->p_flags & PF_X);
 		if (result) {
-			return result;
+			goto done;
 		}
 	}
 
 	result = as_prepare_load(as);
 	if (result) {
-		return result;
+		goto done;
 	}
 
 	/*
 	 * Now actually load each segment.
 	 */
 
-	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
-
-		result = VOP_READ(v, &ku);
+	for (i=0; i<ei->ei_nsegs; i++) {
+		ph = &ei->ei_segs[i].es_ph;
+		result = load_segment(as, v, ph->p_offset, ph->p_vaddr,
+				      ph->p_memsz, ph->p_filesz,
+				      ei->ei_segs[i].es_data,
+				      ph->p_flags & PF_X);
 		if (result) {
-			return result;
-		}
-
-		if (ku.uio_resid != 0) {
-			/* short read; problem with executable? */
-			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
-		}
-
-		switch (ph.p_type) {
-		    case PT_NULL: /* skip */ continue;
-		    case PT_PHDR: /* skip */ continue;
-		    case PT_MIPS_REGINFO: /* skip */ continue;
-		    case PT_LOAD: break;
-		    default:
-			kprintf("loadelf: unknown segment type %d\n",
-				ph.p_type);
-			return ENOEXEC;
-		}
-
-		result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
-				      ph.p_memsz, ph.p_filesz,
-				      ph.p_flags & PF_X);
-		if (result) {
-			return result;
+			goto done;
 		}
 	}
 
 	result = as_complete_load(as);
 	if (result) {
-		return result;
+		goto done;
 	}
 
-	*entrypoint = eh.e_entry;
+	*entrypoint = ei->ei_entry;
 
-	return 0;
+ done:
+	execcache_put(ei);
+	return result;
 }
@@ -28,6 +28,7 @@
  */
 #include <types.h>
 #include <clock.h>
+#include <spl.h>
 #include <copyinout.h>
 #include <syscall.h>
 #include <kern/errno.h>
@@ -39,6 +40,9 @@
 #include <current.h>
 #include <vnode.h>
 #include <kern/seek.h>
+#include <kern/wait.h>
+#include <kern/spawn.h>
+#include <kern/resource.h>
 #include <stat.h>
 #include <file_entry.h>
 #include <proc.h>
@@ -48,14 +52,35 @@
 #include <addrspace.h>
 #include <mips/trapframe.h>
 #include <vfs.h>
+#include <synch.h>
+#include <thread_syscalls.h>
 
 
-int copy_in_args(char **args, char **kargs, int argc, int *size_arr);
-int copy_out_args(char **kargs, vaddr_t *stackptr, int argc, int *size_arr);
-int get_argc(char **args, int *argc);
-int pad_argument(char *arg, int size);
-int total_size_args(int *size_arr, int argc);
-int arg_length(const char *arg,size_t max_size, size_t *size);
+/*
+ * A program name and its arguments, copied in from userspace. The arguments are packed into
+ * ea_buf just as they will be laid out on the new user stack: argc+1 argv pointers (held as
+ * offsets into ea_buf until the stack address is known), then the strings, each padded to a
+ * multiple of 4 bytes. Pointers and strings together count against ARG_MAX.
+ */
+struct exec_args {
+    char *ea_progname;
+    char *ea_buf;       /* ARG_MAX bytes */
+    size_t ea_len;      /* bytes of ea_buf in use */
+    int ea_argc;
+};
+
+/* Handed to a spawned child's thread, which loads the program and reports back */
+struct spawn_args {
+    struct exec_args sa_args;
+    struct semaphore *sa_done;
+    int sa_result;
+};
+
+int exec_args_copyin(userptr_t program, char **args, struct exec_args *ea);
+void exec_args_free(struct exec_args *ea);
+int exec_load(struct exec_args *ea, vaddr_t *entrypoint, vaddr_t *stackptr);
+int exec_args_pack(char **args, struct exec_args *ea);
+int exec_args_copyout(struct exec_args *ea, vaddr_t *stackptr);
 
 /* 
  * Duplicates the currently running process as the child of the current process
@@ -80,11 +105,18 @@ sys_fork(struct trapframe *tf, int *retval)
     child_pid = child_proc->p_pid;
 
     /* Copy the parent's filetable */
-    filetable_copy(child_proc->p_filetable, curproc->p_filetable);
+    err = filetable_copy(child_proc->p_filetable, curproc->p_filetable);
+    if (err) {
+        unconfigure_pid_fields(child_proc);
+        proc_destroy(child_proc);
+        return err;
+    }
 
     /* Copy the parent's trapframe */
     struct trapframe *child_tf = (struct trapframe *)kmalloc(sizeof(struct trapframe));
     if(child_tf == NULL) {
+        unconfigure_pid_fields(child_proc);
+        proc_destroy(child_proc);
         return ENOMEM;
     }
     memcpy((void *)child_tf, (const void *)tf, sizeof(struct trapframe));
@@ -99,6 +131,7 @@ sys_fork(struct trapframe *tf, int *retval)
 
     if(err) {
         kfree(child_tf);
+        unconfigure_pid_fields(child_proc);
         proc_destroy(child_proc);
         return err;
     }
@@ -138,39 +171,89 @@ sys_getpid(int *retval){
 }
 
 /* 
- * Waits for a specific process to exit, and return an encoded exit status.  If that process does not 
- * exist, waitpid fails. Note that status == NULL is expressly allowed and indicates that waitpid 
- * operates as normal but doesn't produce a status value.
+ * Waits for a child process to exit, and return an encoded exit status.  The child is then
+ * reaped: its PID is freed and its process destroyed. If pid is -1 (WAIT_ANY), any child will
+ * do. With WNOHANG, returns 0 at once if no suitable child has exited yet. Note that status ==
+ * NULL is expressly allowed and indicates that waitpid operates as normal but doesn't produce
+ * a status value.
  * 
- * Parameters: pid (the pid of the process on which to wait), *status (the pointer to integer storing the processes
- * exitcode), options (should always be zero, not implementing options)
- * Returns: the process id whose exit status is reported in status (pid)
+ * Parameters: pid (the pid of the process on which to wait, or -1 for any child), *status
+ * (the pointer to integer storing the processes exitcode), options (0 or WNOHANG)
+ * Returns: the process id whose exit status is reported in status (pid), or 0 if WNOHANG
+ * was given and there is none yet
  */
 pid_t
 sys_waitpid(pid_t pid, int *status, int options, int *retval)
 {
+    struct pid_entry *entry;
+    struct proc *child;
     int exitcode;
 
-    /* Options are not supported */
-    if (options != 0){
+    if ((options & ~WNOHANG) != 0){
         return EINVAL;
     }
-    /* Make sure waitpid being called on an existant process */
-    if (pid > __PID_MAX || pid < __PID_MIN || array_get(pid_table->process_statuses, pid) == AVAILABLE || array_get(pid_table->process_statuses, pid) == NULL) {
+    /* Make sure waitpid being called on an existant process; no process groups */
+    if (pid != WAIT_ANY && (pid > __PID_MAX || pid < __PID_MIN)) {
         return ESRCH;
     }
-    /* Make sure that pid argument names a process that is a child of curent process */
-    if (!is_child(pid)){
-        return ECHILD;
-    }
+
     lock_acquire(pid_table->pid_table_lk);
-    while ((int)array_get(pid_table->process_statuses, pid) != ZOMBIE){
-        cv_wait(pid_table->pid_table_cv, pid_table->pid_table_lk);
+    while (1) {
+        /*
+         * Look again each time around: another of our threads may have
+         * reaped the child while we slept.
+         */
+        if (pid == WAIT_ANY) {
+            /* Zombies are kept first, so the head is the one to check */
+            child = curproc->p_childhead;
+            if (child == NULL) {
+                lock_release(pid_table->pid_table_lk);
+                return ECHILD;
+            }
+        }
+        else {
+            if (pid_lookup(pid) == NULL) {
+                lock_release(pid_table->pid_table_lk);
+                return ESRCH;
+            }
+            /* Make sure that pid argument names a process that is a child of curent process */
+            if (!is_child(pid)) {
+                lock_release(pid_table->pid_table_lk);
+                return ECHILD;
+            }
+            child = pid_lookup(pid)->pe_proc;
+        }
+
+        entry = pid_lookup(child->p_pid);
+        if (entry->pe_status == ZOMBIE) {
+            break;
+        }
+        if (options & WNOHANG) {
+            lock_release(pid_table->pid_table_lk);
+            *retval = 0;
+            return 0;
+        }
+        cv_wait(curproc->p_waitcv, pid_table->pid_table_lk);
     }
-    exitcode = (int)array_get(pid_table->process_exitcodes, pid);
 
+    /* Reap it */
+    pid = child->p_pid;
+    exitcode = entry->pe_exitcode;
+    proc_remchild(curproc, child);
+    rwlock_acquire_write(pid_table->pid_table_rwlk);
+    delete_pid_entry(pid);
+    rwlock_release_write(pid_table->pid_table_rwlk);
     lock_release(pid_table->pid_table_lk);
 
+    /* What it and its own children used now counts as ours */
+    spinlock_acquire(&curproc->p_lock);
+    usage_add(&curproc->p_childusage, &child->p_usage);
+    usage_add(&curproc->p_childusage, &child->p_childusage);
+    spinlock_release(&curproc->p_lock);
+
+    /* Nobody else can find it now */
+    proc_destroy(child);
+
     if (status != NULL){
         int retval = copyout(&exitcode, (userptr_t)status, sizeof(exitcode));
         if (retval){
@@ -181,7 +264,46 @@ sys_waitpid(pid_t pid, int *status, int options, int *retval)
     return 0;
 }
 
-/* Checks if process with PID pid is a child of curent process.
+/*
+ * Reports the resources used by the current process (RUSAGE_SELF), or by all of its children
+ * that have exited and been reaped by waitpid, along with their own reaped children
+ * (RUSAGE_CHILDREN). Threads other than the caller are counted as of when they last trapped
+ * or were switched out.
+ *
+ * Parameters: who (RUSAGE_SELF or RUSAGE_CHILDREN), usage (pointer to the struct rusage
+ * to fill in)
+ * Returns: On success, 0. On failure, EINVAL if who is neither, or EFAULT.
+ */
+int
+sys_getrusage(int who, userptr_t usage)
+{
+    struct usage u;
+    struct rusage ru;
+    int spl;
+
+    switch (who) {
+    case RUSAGE_SELF:
+        /* Bring our own time up to now first */
+        spl = splhigh();
+        usage_charge(false);
+        splx(spl);
+        proc_getusage(curproc, &u);
+        break;
+    case RUSAGE_CHILDREN:
+        spinlock_acquire(&curproc->p_lock);
+        u = curproc->p_childusage;
+        spinlock_release(&curproc->p_lock);
+        break;
+    default:
+        return EINVAL;
+    }
+
+    usage_export(&u, &ru);
+    return copyout(&ru, usage, sizeof(ru));
+}
+
+/* Checks if process with PID pid is a child of curent process. The caller must hold
+ * pid_table_lk.
  *
  * Parameters: pid (the pid of the child process to verify)
  * Returns: true if process is a child or curproc, false otherwise
@@ -189,21 +311,18 @@ sys_waitpid(pid_t pid, int *status, int options, int *retval)
 bool
 is_child(pid_t pid)
 {
-    bool is_child = false;
-    int num_children = array_num(curproc->p_children);
-    
-    for (int i = 0; i < num_children; i++){
-        if ((pid_t)array_get(curproc->p_children,i) == pid){
-            is_child = true;
-            break;
-        }
-    }
+    struct pid_entry *entry;
+
+    KASSERT(lock_do_i_hold(pid_table->pid_table_lk));
 
-    return is_child;
+    entry = pid_lookup(pid);
+    return entry != NULL && entry->pe_proc != NULL &&
+        entry->pe_proc->p_parent == curproc;
 }
 
 /* 
- * Causes the current process to exit
+ * Causes the current thread to exit, and with it the process if it is the
+ * last thread (see thread_syscalls.c)
  *
  * Parameters: exitcode (exitcode to report back to other processes via waitpid)
  * Returns: Exit does not return!
@@ -211,44 +330,98 @@ is_child(pid_t pid)
 void
 sys__exit(int exitcode)
 {
+    if (!uthread_exit(exitcode, true, &exitcode)) {
+        /* Other threads are still running; just this one goes */
+        thread_exit();
+    }
+    proc_exit(exitcode);
+}
+
+/* 
+ * Causes the current process to exit. Called by the last thread to go.
+ *
+ * Parameters: exitcode (exitcode to report back to other processes via waitpid)
+ * Returns: Exit does not return!
+ */
+void
+proc_exit(int exitcode)
+{
+    struct proc *proc = curproc;
+    struct proc *child, *next;
+    struct pid_entry *entry;
+
+    /*
+     * Leave the process first. Once we're a zombie, our parent may
+     * reap us and destroy the process at any moment, even before this
+     * thread is finished exiting.
+     */
+    proc_remthread(curthread);
+
+    /*
+     * Holding pid_table_lk keeps the table stable for us to read; the
+     * rwlock is only taken for writing around the actual updates, and
+     * never across proc_destroy, since as_copy looks up pids while
+     * holding vm_lock.
+     */
     lock_acquire(pid_table->pid_table_lk);
 
     /* Update statuses of exiting process' children */
-    for (unsigned i = 0; i < array_num(curproc->p_children); i++){
+    for (child = proc->p_childhead; child != NULL; child = next) {
+        next = child->p_sibnext;
+        entry = pid_lookup(child->p_pid);
+        KASSERT(entry != NULL);
         /* If child is still running, make an orphan */
-        pid_t child_pid = (int)array_get(curproc->p_children,i);
-        if ((int)array_get(pid_table->process_statuses, child_pid) == OCCUPIED) {
-            array_set(pid_table->process_statuses, child_pid, (void *)ORPHAN);
+        if (entry->pe_status == OCCUPIED) {
+            rwlock_acquire_write(pid_table->pid_table_rwlk);
+            entry->pe_status = ORPHAN;
+            rwlock_release_write(pid_table->pid_table_rwlk);
+            child->p_parent = NULL;
         } 
         /* If child is already a zombie, destroy it */
-        else if ((int)array_get(pid_table->process_statuses, child_pid) == ZOMBIE) { 
-            proc_destroy(array_get(pid_table->processes, child_pid));
-            delete_pid_entry(child_pid);
+        else if (entry->pe_status == ZOMBIE) { 
+            rwlock_acquire_write(pid_table->pid_table_rwlk);
+            delete_pid_entry(child->p_pid);
+            rwlock_release_write(pid_table->pid_table_rwlk);
+            proc_destroy(child);
         } else {
             /* Child process has an invalid status */
             lock_release(pid_table->pid_table_lk);
             panic("Exiting process' child has invalid status"); /* Can't return an error code here since exit should not return */
         }  
     }
+    proc->p_childhead = NULL;
+    proc->p_childtail = NULL;
+    proc->p_zombietail = NULL;
 
     /* Update process: */
     /* Process is orphan - no parent waiting on it, proceed by destroying */
-    if ((int)array_get(pid_table->process_statuses, curproc->p_pid) == ORPHAN) {
-        delete_pid_entry(curproc->p_pid);
-        proc_destroy(curproc);
+    entry = pid_lookup(proc->p_pid);
+    KASSERT(entry != NULL);
+    if (entry->pe_status == ORPHAN) {
+        rwlock_acquire_write(pid_table->pid_table_rwlk);
+        delete_pid_entry(proc->p_pid);
+        rwlock_release_write(pid_table->pid_table_rwlk);
+        proc_destroy(proc);
     }
     /* Process has a parent - signal to parent that the process has finished & don't destroy yet*/
-    else if ((int)array_get(pid_table->process_statuses, curproc->p_pid) == OCCUPIED){
-        array_set(pid_table->process_exitcodes, curproc->p_pid, (void *)exitcode);
-        array_set(pid_table->process_statuses, curproc->p_pid, (void *)ZOMBIE);
+    else if (entry->pe_status == OCCUPIED){
+        rwlock_acquire_write(pid_table->pid_table_rwlk);
+        entry->pe_exitcode = exitcode;
+        entry->pe_status = ZOMBIE;
+        rwlock_release_write(pid_table->pid_table_rwlk);
+        proc_zombiechild(proc->p_parent, proc);
+        /*
+         * Wake only our parent, which is still around since we're not
+         * an orphan. Broadcast, since more than one of its threads may
+         * be waiting, on different children.
+         */
+        cv_broadcast(proc->p_parent->p_waitcv, pid_table->pid_table_lk);
     } else {
         /* Parent process has invalid status */
         lock_release(pid_table->pid_table_lk);
         panic("Exiting process status is invalid"); /* Can't return an error code here since exit should not return */
     }
 
-    cv_broadcast(pid_table->pid_table_cv, pid_table->pid_table_lk);
-
     lock_release(pid_table->pid_table_lk);
 
     /* Last command that should run, shouldn't return */
@@ -270,308 +443,423 @@ sys__exit(int exitcode)
 int 
 sys_execv(userptr_t program, char **args)
 {
-
-    struct addrspace *as;
-    struct vnode *v;
+    struct exec_args ea;
     vaddr_t entrypoint, stackptr;
     int result;
-    int argc = 0;
-
-    /* Copy program name in*/
-    char *kernel_progname;
+    int argc;
 
-    kernel_progname = (char *)kmalloc(PATH_MAX);
-    if (kernel_progname == NULL) {
-        return ENOMEM;
+    /* The other threads would be left running in the old image */
+    lock_acquire(curproc->p_uthread_lock);
+    if (curproc->p_nuthreads > 1) {
+        lock_release(curproc->p_uthread_lock);
+        return EBUSY;
     }
+    lock_release(curproc->p_uthread_lock);
 
-    result = copyinstr(program, kernel_progname, PATH_MAX, NULL);
+    /* Copy the program name and arguments in */
+    result = exec_args_copyin(program, args, &ea);
     if (result) {
-        kfree(kernel_progname);
         return result;
     }
 
-    /* Get the size of the arguments array */
-    result = get_argc(args, &argc);
+    /* Load the executable in place of the current one */
+    result = exec_load(&ea, &entrypoint, &stackptr);
+    argc = ea.ea_argc;
+    exec_args_free(&ea);
     if (result) {
-        kfree(kernel_progname);
         return result;
     }
 
-    /* Malloc the kernel argument array */ 
-    char **kargs;
-    kargs = kmalloc(argc*(sizeof(char *)));
-    if (kargs == NULL) {
-        kfree(kernel_progname);
-        return ENOMEM;
+    /* Return to user mode */
+    enter_new_process(argc, (userptr_t)stackptr, NULL, stackptr, entrypoint);
+    /* enter process does not return. */
+    panic("enter_new_process returned \n");
+    return EINVAL; // should never get here
+}
+
+/* Creates a child process running the given program, as fork followed by execv in the child
+ * would, but without copying the current address space only to throw it away. The child gets
+ * a copy of the file table, to which the file actions (dup2 and close, see kern/spawn.h) are
+ * applied in order before the program is loaded.
+ *
+ * Parameters: program (user pointer to the name of the program)
+ *             args (arguments of the given program, also in userspace)
+ *             actions (user pointer to an array of file actions, may be NULL if nactions is 0)
+ *             nactions (the number of file actions)
+ *             retval (the return value)
+ * Returns: On success: 0, and retval is set to the child's PID
+ *          On failure: error code, and no child is left behind
+ */
+int
+sys_spawn(userptr_t program, char **args, const_userptr_t actions, int nactions, int *retval)
+{
+    struct spawn_action *kactions = NULL;
+    struct spawn_args sa;
+    struct proc *child_proc;
+    struct filetable *ft;
+    pid_t child_pid;
+    int result = 0;
+
+    if (nactions < 0 || nactions > SPAWN_MAXACTIONS) {
+        return EINVAL;
     }
 
-    /* Malloc a size array to store the size of all arguments */
-    int *size_arr = kmalloc(argc*(sizeof(int)));
-    if (size_arr == NULL) {
-        kfree(kargs);
-        kfree(kernel_progname);
-        return ENOMEM;
+    /* Copy the file actions in */
+    if (nactions > 0) {
+        kactions = kmalloc(nactions * sizeof(struct spawn_action));
+        if (kactions == NULL) {
+            return ENOMEM;
+        }
+        result = copyin(actions, kactions, nactions * sizeof(struct spawn_action));
+        if (result) {
+            kfree(kactions);
+            return result;
+        }
     }
 
-    /* Copy in arguments into the kernel buffer */
-    result = copy_in_args(args, kargs, argc, size_arr);
+    /* Copy the program name and arguments in */
+    result = exec_args_copyin(program, args, &sa.sa_args);
     if (result) {
-        kfree(kargs);
-        kfree(size_arr);
-        kfree(kernel_progname);
+        kfree(kactions);
         return result;
     }
 
-    /* Open the file */
-    result = vfs_open(kernel_progname, O_RDONLY, 0, &v);
-    if (result) {
+    /* Create the new process, with no address space yet */
+    child_proc = proc_create_spawn(sa.sa_args.ea_progname, &result);
+    if (child_proc == NULL) {
         goto fail;
     }
+    child_pid = child_proc->p_pid;
 
-    /* Create a new address space */
-    as = as_create();
-    if (as == NULL) {
-        result = ENOMEM;
-        goto fail;
+    /* Apply the file actions to the child's file table */
+    ft = child_proc->p_filetable;
+    for (int i=0; i<nactions; i++) {
+        switch (kactions[i].sa_op) {
+            case SPAWN_DUP2:
+                result = filetable_dup2(ft, kactions[i].sa_fd, kactions[i].sa_newfd);
+                break;
+            case SPAWN_CLOSE:
+                if (kactions[i].sa_fd < 0 || kactions[i].sa_fd > __OPEN_MAX-1) {
+                    result = EBADF;
+                    break;
+                }
+                result = filetable_close(ft, kactions[i].sa_fd);
+                break;
+            default:
+                result = EINVAL;
+                break;
+        }
+        if (result) {
+            goto fail_proc;
+        }
     }
-    
-    /* Switch to it and activate it. */
-    struct addrspace *old_as = proc_setas(as);
-    as_activate();
 
-    /* Load the executable and run it */
-    result = load_elf(v, &entrypoint);
-    if (result) {
-        vfs_close(v);
-        proc_setas(old_as);
-        as_activate();
-        goto fail;
+    sa.sa_done = sem_create("spawn", 0);
+    if (sa.sa_done == NULL) {
+        result = ENOMEM;
+        goto fail_proc;
     }
 
-    vfs_close(v);
-
-    /* Define the user stack in the address space */
-    result = as_define_stack(as, &stackptr);
+    /* Make kernel thread for child, which loads the program itself */
+    result = thread_fork("child-thread", child_proc, enter_new_spawned_process, &sa, 0);
     if (result) {
-        proc_setas(old_as);
-        as_activate();
-        goto fail;
+        sem_destroy(sa.sa_done);
+        goto fail_proc;
     }
 
-    /* Copy arguments from kernel buffer to user stack */
-    result = copy_out_args(kargs, &stackptr, argc, size_arr);
+    /* Wait until the program is loaded, so that failures are reported here */
+    P(sa.sa_done);
+    sem_destroy(sa.sa_done);
+    result = sa.sa_result;
     if (result) {
-        proc_setas(old_as);
-        as_activate();
-        goto fail;
+        /* The child's thread has already left it */
+        goto fail_proc;
     }
 
-    /* Clean up before user mode*/
-    for(int i=0; i<argc; i++) {
-        kfree(kargs[i]);
+    exec_args_free(&sa.sa_args);
+    kfree(kactions);
+    *retval = (int) child_pid;
+    return 0;
+
+fail_proc:
+    unconfigure_pid_fields(child_proc);
+    proc_destroy(child_proc);
+fail:
+    exec_args_free(&sa.sa_args);
+    kfree(kactions);
+    return result;
+}
+
+/* 
+ * Used by sys_spawn, loads the program into the new process and enters usermode
+ * Parameters: data1: the spawn_args, which belong to the parent
+ *             data2: unused, for convention
+ * Returns: this function should not return
+ */
+void
+enter_new_spawned_process(void *data1, unsigned long data2)
+{
+    struct spawn_args *sa = data1;
+    vaddr_t entrypoint, stackptr;
+    int argc;
+
+    (void)data2;
+
+    argc = sa->sa_args.ea_argc;
+    sa->sa_result = exec_load(&sa->sa_args, &entrypoint, &stackptr);
+    if (sa->sa_result) {
+        /* Leave the process first, so the parent can destroy it as soon as it hears */
+        proc_remthread(curthread);
+        V(sa->sa_done);
+        thread_exit();
     }
-    as_destroy(old_as);
-    kfree(kernel_progname);
-    kfree(kargs);
-    kfree(size_arr);
-    /* Return to user mode */
+
+    /* Once the parent hears, sa is gone */
+    V(sa->sa_done);
     enter_new_process(argc, (userptr_t)stackptr, NULL, stackptr, entrypoint);
     /* enter process does not return. */
     panic("enter_new_process returned \n");
-    return EINVAL; // should never get here
-
-fail:
-    for(int i=0; i<argc; i++) {
-        kfree(kargs[i]);
-    }
-    kfree(kernel_progname);
-    kfree(kargs);
-    kfree(size_arr);
-    return result;
 }
 
 /* execv helper functions */
 
-/* Returns the total number of arguments in the userspace args array by copying a few characters 
- * Parameters: args (array of arguments in the userspace)
- *             argc (the variable in which the number will be stored)
- * Returns: On success: 0, and argc is updated
+/* Copies in the program name and arguments for execv or spawn
+ * Parameters: program (user pointer to the name of the program)
+ *             args (array of arguments in the userspace)
+ *             ea (where to store the kernel copies)
+ * Returns: On success: 0, and ea is filled in; free it with exec_args_free
  *          On failure: error code
  */
 int
-get_argc(char **args, int *argc)
+exec_args_copyin(userptr_t program, char **args, struct exec_args *ea)
 {
-    char *copied_val;
-    int i = 0;
-    char err = 0;
-
-    do {
-        err = copyin((const_userptr_t) &args[i], (void *) &copied_val, (size_t) (sizeof(char *)));
-        if (err) {
-            return err;
-        }
-        i++;
-    } 
-    while(copied_val != NULL && i < ARG_MAX);
+    int result;
 
-    if(i==ARG_MAX) {
-        return E2BIG; // too many arguments
+    /* Copy program name in*/
+    ea->ea_progname = (char *)kmalloc(PATH_MAX);
+    if (ea->ea_progname == NULL) {
+        return ENOMEM;
+    }
+
+    result = copyinstr(program, ea->ea_progname, PATH_MAX, NULL);
+    if (result) {
+        kfree(ea->ea_progname);
+        return result;
+    }
+
+    /* Copy the arguments in, ready to go on the stack */
+    ea->ea_buf = kmalloc(ARG_MAX);
+    if (ea->ea_buf == NULL) {
+        kfree(ea->ea_progname);
+        return ENOMEM;
+    }
+
+    result = exec_args_pack(args, ea);
+    if (result) {
+        kfree(ea->ea_buf);
+        kfree(ea->ea_progname);
+        return result;
     }
 
-    *argc = i-1; // null is not included
     return 0;
+}
 
+/* Frees what exec_args_copyin allocated
+ * Parameters: ea (the program name and arguments)
+ * Returns: void
+ */
+void
+exec_args_free(struct exec_args *ea)
+{
+    kfree(ea->ea_progname);
+    kfree(ea->ea_buf);
 }
 
-/* Copies in the arguments from userspace to the kernel buffer
- * Parameters: args (array of arguments in the userspace)
- *             kargs (array in kernel space to store the arguments)
- *             argc (the number of arguments to be copied in)
- *             size_arr (the array that stores the size of all arguments)
- * Returns: On success: 0, and kargs, size_arr are updated
+/* Loads a program into a new address space for the current process, and copies its arguments
+ * onto the new user stack. On success the old address space, if any, is destroyed; on failure
+ * the process is left as it was.
+ * Parameters: ea (the program name and arguments; note vfs_open clobbers the name)
+ *             entrypoint, stackptr (where to store the program's entry point and stack pointer)
+ * Returns: On success: 0, and entrypoint, stackptr are updated
  *          On failure: error code
  */
 int
-copy_in_args(char **args, char **kargs, int argc, int *size_arr)
+exec_load(struct exec_args *ea, vaddr_t *entrypoint, vaddr_t *stackptr)
 {
-    int err = 0;
-    size_t actual_size;
-    size_t max_size = ARG_MAX;
-
-    for (int i=0; i<argc; i++) {
-        /* get the actual size of the argument while making sure we don't exceed ARG_MAX */
-        err = arg_length((const char *) args[i], max_size, &actual_size);
-        if (err) {
-            return err;
-        }
+    struct addrspace *as, *old_as;
+    struct vnode *v;
+    int result;
 
-        max_size-=actual_size;
-        size_t pad_room = 4 - (actual_size % 4); // each argument is padded so the length is divisble by 4
+    /* Open the file */
+    result = vfs_open(ea->ea_progname, O_RDONLY, 0, &v);
+    if (result) {
+        return result;
+    }
 
-        kargs[i] = kmalloc((actual_size+pad_room)*sizeof(char));
-        if (kargs[i] == NULL) {
-            return ENOMEM;
-        }
+    /* Create a new address space */
+    as = as_create();
+    if (as == NULL) {
+        vfs_close(v);
+        return ENOMEM;
+    }
 
-        err = copyinstr((const_userptr_t) args[i], kargs[i], actual_size, NULL);
+    /* Switch to it and activate it. */
+    old_as = proc_setas(as);
+    as_activate();
 
-        if(err) {
-            for (int j=0; j<i; j++) {
-                kfree(kargs[i]);
-            }
-            return err;
-        }
+    /* Load the executable */
+    result = load_elf(v, entrypoint);
+    vfs_close(v);
+    if (result) {
+        goto fail;
+    }
+
+    /* Define the user stack in the address space */
+    result = as_define_stack(as, stackptr);
+    if (result) {
+        goto fail;
+    }
 
-        /* Pad the arguments after copy in and store the padded_size in size_arr */
-        int padded_size = pad_argument(kargs[i], (int) actual_size);
-        size_arr[i] = padded_size;
+    /* Copy arguments from kernel buffer to user stack */
+    result = exec_args_copyout(ea, stackptr);
+    if (result) {
+        goto fail;
     }
 
+    if (old_as != NULL) {
+        as_destroy(old_as);
+    }
     return 0;
+
+fail:
+    proc_setas(old_as);
+    as_activate();
+    as_destroy(as);
+    return result;
 }
 
-/* Copies out the arguments from ukernel buffer to user stack.
+/* Number of argv pointers to copy in at a time */
+#define ARGV_CHUNK 64
+
+/* Copies the userspace argv array and its strings into ea->ea_buf, laid out as described at
+ * struct exec_args. The pointers are copied in a chunk at a time and each string with one
+ * copyinstr, straight to where it goes; nothing is copied twice from userspace. A chunk never
+ * runs past the end of the page the pointers are on, so reading ahead of the NULL that ends
+ * argv can't fault.
  *
- * Parameters: kargs (array in kernel space that has the arguments)
- *             stackptr (the current address of the stackpointer)
- *             argc (the number of arguments to be copied in)
- *             size_arr (the array that has the size of all arguments)
- * Returns: On success: 0, and stackptr is updated
- *          On failure: error code
+ * Parameters: args (array of arguments in the userspace)
+ *             ea (ea_buf must be ARG_MAX bytes)
+ * Returns: On success: 0, and ea_len, ea_argc are set
+ *          On failure: error code (E2BIG if the arguments don't fit in ARG_MAX)
  */
 int
-copy_out_args(char **kargs, vaddr_t *stackptr, int argc, int *size_arr)
+exec_args_pack(char **args, struct exec_args *ea)
 {
-    int result =0;
-
-    /* Setup pointers to the address of arguments (arg_pointer) and the pointer (arg_addr) that points to the start of the argument */
-    userptr_t arg_addr = (userptr_t) (*stackptr);
-    userptr_t *arg_pointer = (userptr_t *) (arg_addr-total_size_args(size_arr,argc));
-
-    /* Manually set the last pointer to NULL */
-    arg_pointer --;
-    *arg_pointer = NULL;
-
-    /* Decrement arg_addr by the size of the argument, copyout the argument, and store the address in arg_pointer */
-    for (int i=argc-1; i>=0; i--) { // store from last to first to keep consistency between arg_pointer and the arguments
-        arg_pointer --; // decrement since we are going down the stack
-        arg_addr -= size_arr[i];
-        *arg_pointer = arg_addr;
-        result = copyout((void *)kargs[i], arg_addr, size_arr[i]);
-        if(result) {
+    userptr_t chunk[ARGV_CHUNK];
+    userptr_t *uargv = (userptr_t *)args;
+    size_t strsize = 0;     /* bytes of strings so far, after padding */
+    size_t got, room, ptrsize;
+    unsigned n, i;
+    int argc = 0;
+    int result;
+
+    while (1) {
+        /* As many pointers as are left on this page, up to a chunk */
+        n = (PAGE_SIZE - ((vaddr_t)uargv % PAGE_SIZE)) / sizeof(userptr_t);
+        if (n == 0) {
+            /* argv itself is misaligned; go one at a time */
+            n = 1;
+        }
+        else if (n > ARGV_CHUNK) {
+            n = ARGV_CHUNK;
+        }
+        result = copyin((const_userptr_t)uargv, chunk, n * sizeof(userptr_t));
+        if (result) {
             return result;
         }
-    }
-    /* Update stack pointer */
-    *stackptr = (vaddr_t)arg_pointer;
-    
-    return result;
-}
 
-/* 
- * Pads arguments for the size to be divisible by 4 to align before copying to user stack
- *
- * Paramters: arg (the argument to be padded), size (size of the argument before padding)
- * Returns: padded_size (size of the array after padding), updates the actual argument
- */
-int
-pad_argument(char *arg, int size)
-{
-    int pad_count = 4 - (size % 4);
-    for (int i=size; i<size+pad_count; i++) {
-        arg[i] = '\0';
-    }
+        for (i=0; i<n; i++) {
+            if (chunk[i] == NULL) {
+                goto done;
+            }
 
-    return size+pad_count;
-}
+            /* Leave room for this pointer and the NULL after it */
+            ptrsize = (argc + 2) * sizeof(userptr_t);
+            if (ptrsize + strsize >= ARG_MAX) {
+                return E2BIG;
+            }
+            room = ARG_MAX - ptrsize - strsize;
 
-/* 
- * Returns the total size of the arguments
- * 
- * Parameter: size_arr (the array the stores the size of all the arguments)
- *            argc (the number of arguments)
- * Returns: ttotal_size (the sum of the size of all arguments)
- */
-int
-total_size_args(int *size_arr, int argc)
-{
-    int total_size = 0;
-    for (int i=0; i<argc; i++) {
-        total_size+=size_arr[i];
+            /* Strings go at the front for now; they are moved up below */
+            result = copyinstr(chunk[i], ea->ea_buf + strsize, room, &got);
+            if (result == ENAMETOOLONG) {
+                return E2BIG;
+            }
+            if (result) {
+                return result;
+            }
+
+            /* got counts the NUL; pad to a multiple of 4 */
+            while (got % 4 != 0) {
+                if (got == room) {
+                    return E2BIG;
+                }
+                ea->ea_buf[strsize + got] = '\0';
+                got++;
+            }
+            strsize += got;
+            argc++;
+        }
+        uargv += n;
     }
 
-    return total_size;
+done:
+    /* Make room for the pointers in front, and fill them in with the offsets of the strings */
+    ptrsize = (argc + 1) * sizeof(userptr_t);
+    KASSERT(ptrsize + strsize <= ARG_MAX);
+    memmove(ea->ea_buf + ptrsize, ea->ea_buf, strsize);
+
+    vaddr_t *ptrs = (vaddr_t *)ea->ea_buf;
+    size_t offset = ptrsize;
+    for (i=0; i<(unsigned)argc; i++) {
+        ptrs[i] = offset;
+        offset += ROUNDUP(strlen(ea->ea_buf + offset) + 1, 4);
+    }
+    ptrs[argc] = 0;
+    KASSERT(offset == ptrsize + strsize);
+
+    ea->ea_len = ptrsize + strsize;
+    ea->ea_argc = argc;
+    return 0;
 }
-/* 
- * Calculates the length of a given argument in userspace by copying in one character at a time until it hits NULL
- * 
- * Parameter: arg (the argument)
- *            max_size (maximum allowed size to ensure the total length of all arguments does not exceed ARGMAX)
- *            size (the variable to store the actual size)
- * Returns: On success: 0, updated the size variable
+
+/* Copies the packed arguments out onto the new user stack in one go, turning the argv offsets
+ * into user addresses on the way.
+ *
+ * Parameters: ea (the packed arguments)
+ *             stackptr (the current address of the stackpointer)
+ * Returns: On success: 0, and stackptr is updated to point at argv
  *          On failure: error code
  */
 int
-arg_length(const char *arg, size_t max_size, size_t *size)
+exec_args_copyout(struct exec_args *ea, vaddr_t *stackptr)
 {
-    char next_char;
-    size_t i=0;
-    int err =0;
-
-    do {
-        err = copyin((const_userptr_t)&arg[i], (void *)&next_char, (size_t)sizeof(char));
-        if (err) {
-            return err;
-        }
-        i++;
+    vaddr_t *ptrs = (vaddr_t *)ea->ea_buf;
+    vaddr_t base;
+    int result;
 
-    }while(next_char != 0 && i < max_size);
+    /* Keep the stack 8-byte aligned */
+    base = (*stackptr - ea->ea_len) & ~(vaddr_t)7;
+    for (int i=0; i<ea->ea_argc; i++) {
+        ptrs[i] += base;
+    }
 
-    if(next_char != 0) {
-        return E2BIG;
+    result = copyout(ea->ea_buf, (userptr_t)base, ea->ea_len);
+    if (result) {
+        return result;
     }
 
-    *size=i;
+    /* Update stack pointer */
+    *stackptr = base;
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * User-level threads.
+ *
+ * A process starts out with one thread, thread 0, and can add more
+ * with __threadfork, up to USER_THREAD_MAX at once. They share the
+ * address space, file table, and everything else; each gets its own
+ * stack region (see as_define_thread_stack). A thread ends by calling
+ * threadexit or _exit, and its slot then keeps its exit status until
+ * another thread collects it with threadjoin.
+ *
+ * The process keeps going until its last thread has ended; the exit
+ * code is the one last passed to _exit, or 0 if there wasn't one.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include <current.h>
+#include <proc.h>
+#include <thread.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <thread_syscalls.h>
+#include <mips/trapframe.h>
+
+/*
+ * Used by sys___threadfork, copies the trapframe onto the new thread's
+ * stack, and enters usermode
+ * Parameters: data1: the trapframe
+ *             data2: the thread id
+ * Returns: this function should not return
+ */
+static
+void
+enter_new_uthread(void *data1, unsigned long data2)
+{
+    struct trapframe tf;
+
+    curthread->t_utid = data2;
+
+    memcpy(&tf, data1, sizeof(tf));
+    kfree(data1);
+
+    /* Activate the address space and enter user mode */
+    as_activate();
+    mips_usermode(&tf);
+}
+
+/*
+ * Starts a new thread in the current process, running at entry with
+ * arg as its only argument, on a stack of its own.
+ *
+ * Parameters: tf (the trapframe of the calling thread), entry (user address to
+ * start at), arg (passed in a0), retval (pointer to return value address)
+ * Returns: On success, 0 and retval is set to the new thread's id.  On failure,
+ * error code (EAGAIN if the process has too many threads)
+ */
+int
+sys___threadfork(struct trapframe *tf, userptr_t entry, userptr_t arg, int *retval)
+{
+    struct proc *p = curproc;
+    struct trapframe *child_tf;
+    vaddr_t stackptr;
+    unsigned tid;
+    uint32_t used;
+    int err;
+
+    lock_acquire(p->p_uthread_lock);
+
+    /* Find a free slot */
+    used = p->p_uthreads_running | p->p_uthreads_exited;
+    for (tid = 1; tid < USER_THREAD_MAX; tid++) {
+        if ((used & (1U << tid)) == 0) {
+            break;
+        }
+    }
+    if (tid == USER_THREAD_MAX) {
+        lock_release(p->p_uthread_lock);
+        return EAGAIN;
+    }
+
+    err = as_define_thread_stack(p->p_addrspace, tid, &stackptr);
+    if (err) {
+        lock_release(p->p_uthread_lock);
+        return err;
+    }
+
+    /* Start from a clean trapframe, keeping the user mode status and gp */
+    child_tf = kmalloc(sizeof(struct trapframe));
+    if (child_tf == NULL) {
+        lock_release(p->p_uthread_lock);
+        return ENOMEM;
+    }
+    bzero(child_tf, sizeof(struct trapframe));
+    child_tf->tf_status = tf->tf_status;
+    child_tf->tf_gp = tf->tf_gp;
+    child_tf->tf_epc = (vaddr_t)entry;
+    child_tf->tf_a0 = (vaddr_t)arg;
+    child_tf->tf_sp = stackptr;
+
+    err = thread_fork("user-thread", p, enter_new_uthread, child_tf, tid);
+    if (err) {
+        kfree(child_tf);
+        lock_release(p->p_uthread_lock);
+        return err;
+    }
+
+    p->p_uthreads_running |= 1U << tid;
+    p->p_nuthreads++;
+    lock_release(p->p_uthread_lock);
+
+    *retval = tid;
+    return 0;
+}
+
+/*
+ * Waits for thread tid of the current process to end, and collects its exit
+ * status. A thread can only be joined once.
+ *
+ * Parameters: tid (the thread to wait for), status (user pointer to store the
+ * exit status at, may be NULL), retval (pointer to return value address)
+ * Returns: On success, 0.  On failure, error code (ESRCH if there is no such
+ * thread, or it has already been joined)
+ */
+int
+sys_threadjoin(int tid, userptr_t status, int *retval)
+{
+    struct proc *p = curproc;
+    uint32_t bit;
+    int exitstatus;
+
+    if (tid < 0 || tid >= USER_THREAD_MAX) {
+        return ESRCH;
+    }
+    if ((unsigned)tid == curthread->t_utid) {
+        return EINVAL;
+    }
+    bit = 1U << tid;
+
+    lock_acquire(p->p_uthread_lock);
+    while (p->p_uthreads_running & bit) {
+        cv_wait(p->p_uthread_cv, p->p_uthread_lock);
+    }
+    if ((p->p_uthreads_exited & bit) == 0) {
+        lock_release(p->p_uthread_lock);
+        return ESRCH;
+    }
+    exitstatus = p->p_uthread_status[tid];
+    p->p_uthreads_exited &= ~bit;
+    lock_release(p->p_uthread_lock);
+
+    if (status != NULL) {
+        int err = copyout(&exitstatus, status, sizeof(exitstatus));
+        if (err) {
+            return err;
+        }
+    }
+    *retval = 0;
+    return 0;
+}
+
+/*
+ * Records that the current thread is ending, with the given status, and wakes
+ * anyone joining it.
+ *
+ * Parameters: status (the thread's exit status), setcode (true if this is _exit,
+ * in which case status also becomes the process exit code), exitcode (pointer
+ * to store the process exit code at)
+ * Returns: true if this was the last thread, in which case the caller should
+ * exit the process with *exitcode; false otherwise, in which case the thread has
+ * already left the process and the caller should just thread_exit
+ */
+bool
+uthread_exit(int status, bool setcode, int *exitcode)
+{
+    struct proc *p = curproc;
+    unsigned tid = curthread->t_utid;
+    bool last;
+
+    lock_acquire(p->p_uthread_lock);
+    KASSERT(p->p_uthreads_running & (1U << tid));
+    p->p_uthreads_running &= ~(1U << tid);
+    p->p_uthreads_exited |= 1U << tid;
+    p->p_uthread_status[tid] = status;
+    if (setcode) {
+        p->p_exitcode = status;
+    }
+    KASSERT(p->p_nuthreads > 0);
+    p->p_nuthreads--;
+    last = (p->p_nuthreads == 0);
+    *exitcode = p->p_exitcode;
+    cv_broadcast(p->p_uthread_cv, p->p_uthread_lock);
+    if (!last) {
+        /*
+         * Leave the process before the last thread can see we're
+         * gone, since once it exits the process may be destroyed.
+         */
+        proc_remthread(curthread);
+    }
+    lock_release(p->p_uthread_lock);
+
+    return last;
+}
+
+/*
+ * Ends the current thread. If it's the last one, the process exits too.
+ *
+ * Parameters: status (exit status to report to threadjoin)
+ * Returns: does not return
+ */
+void
+sys_threadexit(int status)
+{
+    int exitcode;
+
+    if (uthread_exit(status, false, &exitcode)) {
+        proc_exit(exitcode);
+    }
+    thread_exit();
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Scheduler test code.
+ *
+ * Measures interactive latency under load: a pair of threads bounce a
+ * token back and forth through semaphores, which is roughly what an
+ * interactive program waiting on input looks like, and we time each
+ * round trip. This is done first on an idle system and then again
+ * with a number of cpu-bound hog threads running. With a scheduler
+ * that favors threads that sleep, the second set of numbers should
+ * not be much worse than the first.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define DEFAULT_HOGS	4	/* hog threads if not given on command line */
+#define NROUNDS		200	/* ping-pong round trips per measurement */
+#define THINKLOOPS	1000	/* work done per round by the pinger */
+
+static struct semaphore *pingsem;
+static struct semaphore *pongsem;
+static struct semaphore *donesem;
+static volatile bool hogs_stop;
+
+static
+void
+inititems(void)
+{
+	if (pingsem == NULL) {
+		pingsem = sem_create("schedtest ping", 0);
+		if (pingsem == NULL) {
+			panic("schedtest: sem_create failed\n");
+		}
+	}
+	if (pongsem == NULL) {
+		pongsem = sem_create("schedtest pong", 0);
+		if (pongsem == NULL) {
+			panic("schedtest: sem_create failed\n");
+		}
+	}
+	if (donesem == NULL) {
+		donesem = sem_create("schedtest done", 0);
+		if (donesem == NULL) {
+			panic("schedtest: sem_create failed\n");
+		}
+	}
+}
+
+/*
+ * Convert a timespec to microseconds.
+ */
+static
+uint64_t
+ts_to_usec(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+}
+
+/*
+ * Burn cpu until told to stop.
+ */
+static
+void
+hogthread(void *junk, unsigned long num)
+{
+	volatile unsigned long count;
+
+	(void)junk;
+	(void)num;
+
+	count = 0;
+	while (!hogs_stop) {
+		count++;
+	}
+	V(donesem);
+}
+
+static
+void
+pongthread(void *junk, unsigned long num)
+{
+	unsigned long i;
+
+	(void)junk;
+
+	for (i=0; i<num; i++) {
+		P(pingsem);
+		V(pongsem);
+	}
+	V(donesem);
+}
+
+/*
+ * Run NROUNDS ping-pong round trips and print the average and
+ * worst-case latency.
+ */
+static
+void
+measure(const char *label)
+{
+	struct timespec before, after, diff;
+	uint64_t usec, total, max;
+	volatile unsigned think;
+	unsigned i, j;
+	int result;
+
+	result = thread_fork("schedtest pong", NULL, pongthread,
+			     NULL, NROUNDS);
+	if (result) {
+		panic("schedtest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+
+	total = max = 0;
+	for (i=0; i<NROUNDS; i++) {
+		for (j=0, think=0; j<THINKLOOPS; j++) {
+			think++;
+		}
+		gettime(&before);
+		V(pingsem);
+		P(pongsem);
+		gettime(&after);
+
+		timespec_sub(&after, &before, &diff);
+		usec = ts_to_usec(&diff);
+		total += usec;
+		if (usec > max) {
+			max = usec;
+		}
+	}
+	P(donesem);
+
+	kprintf("%s: %u round trips, avg %llu us, max %llu us\n",
+		label, NROUNDS,
+		(unsigned long long)(total / NROUNDS),
+		(unsigned long long)max);
+}
+
+int
+schedtest(int nargs, char **args)
+{
+	char name[32];
+	unsigned long nhogs, i;
+	int result;
+
+	nhogs = DEFAULT_HOGS;
+	if (nargs > 1) {
+		nhogs = atoi(args[1]);
+	}
+
+	inititems();
+	kprintf("Starting scheduler latency test...\n");
+
+	measure("unloaded");
+
+	hogs_stop = false;
+	for (i=0; i<nhogs; i++) {
+		snprintf(name, sizeof(name), "schedtest hog %lu", i);
+		result = thread_fork(name, NULL, hogthread, NULL, i);
+		if (result) {
+			panic("schedtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	snprintf(name, sizeof(name), "%lu hogs", nhogs);
+	measure(name);
+
+	hogs_stop = true;
+	for (i=0; i<nhogs; i++) {
+		P(donesem);
+	}
+
+	kprintf("Scheduler latency test done.\n");
+	return 0;
+}
@@ -36,6 +36,7 @@
 #include <clock.h>
 #include <thread.h>
 #include <synch.h>
+#include <current.h>
 #include <test.h>
 
 #define NSEMLOOPS     63
@@ -215,6 +216,7 @@ locktest(int nargs, char **args)
 		P(donesem);
 	}
 
+	lock_printstats(testlock);
 	kprintf("Lock test done.\n");
 
 	return 0;
@@ -399,3 +401,359 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Reader-writer lock tests.
+ *
+ * rwtest runs a mix of readers and writers over the same values as
+ * locktest. Writers must see no one else inside; readers must see no
+ * writer inside and consistent values. We also report the largest
+ * number of readers seen inside at once, which should be more than
+ * one if readers really do share.
+ *
+ * rwtest2 checks writer preference: with a reader holding the lock
+ * and a writer waiting, a newly arriving reader must wait for the
+ * writer.
+ */
+
+#define NRWLOOPS	60
+#define RWWRITERS	4	/* one in this many threads is a writer */
+
+static struct rwlock *testrwlock;
+static struct spinlock rwstat_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned rw_readers_in;
+static volatile unsigned rw_writers_in;
+static volatile unsigned rw_maxreaders;
+static volatile unsigned rw_failures;
+
+static
+void
+rwinititems(void)
+{
+	inititems();
+	if (testrwlock == NULL) {
+		testrwlock = rwlock_create("testrwlock");
+		if (testrwlock == NULL) {
+			panic("synchtest: rwlock_create failed\n");
+		}
+	}
+	rw_readers_in = rw_writers_in = rw_maxreaders = rw_failures = 0;
+}
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: Mismatch on %s\n", num, msg);
+	spinlock_acquire(&rwstat_lock);
+	rw_failures++;
+	spinlock_release(&rwstat_lock);
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	unsigned long v1, v2, v3;
+	unsigned readers, writers;
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		if (num % RWWRITERS == 0) {
+			rwlock_acquire_write(testrwlock);
+
+			spinlock_acquire(&rwstat_lock);
+			readers = rw_readers_in;
+			writers = ++rw_writers_in;
+			spinlock_release(&rwstat_lock);
+			if (readers != 0 || writers != 1) {
+				rwfail(num, "writer exclusion");
+			}
+
+			testval1 = num;
+			thread_yield();
+			testval2 = num*num;
+			testval3 = num%3;
+
+			spinlock_acquire(&rwstat_lock);
+			rw_writers_in--;
+			spinlock_release(&rwstat_lock);
+
+			rwlock_release_write(testrwlock);
+		}
+		else {
+			rwlock_acquire_read(testrwlock);
+
+			spinlock_acquire(&rwstat_lock);
+			readers = ++rw_readers_in;
+			writers = rw_writers_in;
+			if (readers > rw_maxreaders) {
+				rw_maxreaders = readers;
+			}
+			spinlock_release(&rwstat_lock);
+			if (writers != 0) {
+				rwfail(num, "reader/writer exclusion");
+			}
+
+			v1 = testval1;
+			/* give other readers a chance to get in too */
+			thread_yield();
+			v2 = testval2;
+			v3 = testval3;
+			if (v2 != v1*v1 || v3 != v1%3) {
+				rwfail(num, "testvals");
+			}
+
+			spinlock_acquire(&rwstat_lock);
+			rw_readers_in--;
+			spinlock_release(&rwstat_lock);
+
+			rwlock_release_read(testrwlock);
+		}
+	}
+	V(donesem);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	rwinititems();
+	kprintf("Starting rwlock test...\n");
+
+	testval1 = testval2 = testval3 = 0;
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("rwtest", NULL, rwtestthread, NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	kprintf("Most readers inside at once: %u\n", rw_maxreaders);
+	if (rw_failures > 0) {
+		kprintf("Test failed\n");
+	}
+	kprintf("Rwlock test done.\n");
+
+	return 0;
+}
+
+static volatile bool rw2_writer_in;
+static volatile bool rw2_reader_in;
+static volatile bool rw2_reader_saw_writer;
+
+static
+void
+rw2writer(void *junk1, unsigned long junk2)
+{
+	(void)junk1;
+	(void)junk2;
+
+	rwlock_acquire_write(testrwlock);
+	rw2_writer_in = true;
+	rwlock_release_write(testrwlock);
+	V(donesem);
+}
+
+static
+void
+rw2reader(void *junk1, unsigned long junk2)
+{
+	(void)junk1;
+	(void)junk2;
+
+	rwlock_acquire_read(testrwlock);
+	rw2_reader_saw_writer = rw2_writer_in;
+	rw2_reader_in = true;
+	rwlock_release_read(testrwlock);
+	V(donesem);
+}
+
+int
+rwtest2(int nargs, char **args)
+{
+	int i, result;
+	bool ok;
+
+	(void)nargs;
+	(void)args;
+
+	rwinititems();
+	kprintf("Starting rwlock writer-preference test...\n");
+
+	rw2_writer_in = rw2_reader_in = rw2_reader_saw_writer = false;
+
+	rwlock_acquire_read(testrwlock);
+
+	result = thread_fork("rwtest2 writer", NULL, rw2writer, NULL, 0);
+	if (result) {
+		panic("rwtest2: thread_fork failed: %s\n", strerror(result));
+	}
+	/* Wait for the writer to queue up behind us. */
+	while (testrwlock->rwlock_waitwriters == 0) {
+		thread_yield();
+	}
+
+	result = thread_fork("rwtest2 reader", NULL, rw2reader, NULL, 0);
+	if (result) {
+		panic("rwtest2: thread_fork failed: %s\n", strerror(result));
+	}
+	/* Give the new reader plenty of chances to (wrongly) get in. */
+	for (i=0; i<100; i++) {
+		thread_yield();
+	}
+	ok = !rw2_reader_in && !rw2_writer_in;
+
+	rwlock_release_read(testrwlock);
+	P(donesem);
+	P(donesem);
+
+	if (!ok || !rw2_reader_saw_writer) {
+		kprintf("Reader got in ahead of a waiting writer\n");
+		kprintf("Test failed\n");
+	}
+	kprintf("Rwlock writer-preference test done.\n");
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// priority inheritance test
+
+/*
+ * We hold pilock1; a middle thread takes pilock2 and waits for
+ * pilock1; a high thread waits for pilock2. We and the middle thread
+ * run at the lowest level, so the only way the high thread's level
+ * can reach us is through the middle thread. It should, and go away
+ * again when we release pilock1.
+ */
+
+static struct lock *pilock1;
+static struct lock *pilock2;
+static struct thread *volatile pi_middle;
+static struct thread *volatile pi_high;
+
+static
+void
+piinititems(void)
+{
+	inititems();
+	if (pilock1 == NULL) {
+		pilock1 = lock_create("pilock1");
+		if (pilock1 == NULL) {
+			panic("synchtest: lock_create failed\n");
+		}
+	}
+	if (pilock2 == NULL) {
+		pilock2 = lock_create("pilock2");
+		if (pilock2 == NULL) {
+			panic("synchtest: lock_create failed\n");
+		}
+	}
+	pi_middle = pi_high = NULL;
+}
+
+static
+void
+pimiddle(void *junk1, unsigned long junk2)
+{
+	(void)junk1;
+	(void)junk2;
+
+	pi_middle = curthread;
+	curthread->t_priority = SCHED_NLEVELS - 1;
+	lock_acquire(pilock2);
+	lock_acquire(pilock1);
+	lock_release(pilock1);
+	lock_release(pilock2);
+	V(donesem);
+}
+
+static
+void
+pihigh(void *junk1, unsigned long junk2)
+{
+	(void)junk1;
+	(void)junk2;
+
+	pi_high = curthread;
+	curthread->t_priority = 0;
+	lock_acquire(pilock2);
+	lock_release(pilock2);
+	V(donesem);
+}
+
+int
+pitest(int nargs, char **args)
+{
+	unsigned inherited, oldprio;
+	int result;
+	bool ok;
+
+	(void)nargs;
+	(void)args;
+
+	piinititems();
+	kprintf("Starting priority inheritance test...\n");
+
+	oldprio = curthread->t_priority;
+	curthread->t_priority = SCHED_NLEVELS - 1;
+	lock_acquire(pilock1);
+
+	result = thread_fork("pitest middle", NULL, pimiddle, NULL, 0);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+	while (pilock1->lk_nwaiters == 0) {
+		thread_yield();
+	}
+
+	result = thread_fork("pitest high", NULL, pihigh, NULL, 0);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+	while (pilock2->lk_nwaiters == 0) {
+		thread_yield();
+	}
+
+	/*
+	 * Both are asleep, so their lent priorities hold still. The
+	 * middle thread should now be lending what the high thread
+	 * lent it, not its own low level, and that should be ours.
+	 */
+	inherited = curthread->t_inherit;
+	ok = inherited == pi_high->t_waitprio &&
+		pi_middle->t_waitprio == pi_high->t_waitprio &&
+		inherited < SCHED_NLEVELS - 1;
+	kprintf("inherited priority %u (middle thread lent %u, "
+		"high thread lent %u)\n", inherited,
+		pi_middle->t_waitprio, pi_high->t_waitprio);
+
+	lock_release(pilock1);
+	if (curthread->t_inherit != SCHED_NLEVELS) {
+		kprintf("Priority not restored on release\n");
+		ok = false;
+	}
+	P(donesem);
+	P(donesem);
+	curthread->t_priority = oldprio;
+
+	if (!ok) {
+		kprintf("Test failed\n");
+	}
+	kprintf("Priority inheritance test done.\n");
+
+	return 0;
+}
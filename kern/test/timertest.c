@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Timer test code.
+ *
+ * Checks that timed sleeps last about as long as asked for: never
+ * shorter, and not more than a couple of ticks longer. Then checks
+ * that cv_timedwait times out when nobody signals, and returns early
+ * when someone does.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+/* Slack allowed past the requested time, in ticks. */
+#define SLACK_TICKS	2
+
+static struct lock *tmlock;
+static struct cv *tmcv;
+static struct semaphore *tmdone;
+
+static
+void
+inititems(void)
+{
+	if (tmlock == NULL) {
+		tmlock = lock_create("timertest lock");
+		if (tmlock == NULL) {
+			panic("timertest: lock_create failed\n");
+		}
+	}
+	if (tmcv == NULL) {
+		tmcv = cv_create("timertest cv");
+		if (tmcv == NULL) {
+			panic("timertest: cv_create failed\n");
+		}
+	}
+	if (tmdone == NULL) {
+		tmdone = sem_create("timertest done", 0);
+		if (tmdone == NULL) {
+			panic("timertest: sem_create failed\n");
+		}
+	}
+}
+
+/*
+ * Nanoseconds from BEFORE to AFTER.
+ */
+static
+uint64_t
+elapsed_ns(const struct timespec *before, const struct timespec *after)
+{
+	struct timespec diff;
+
+	timespec_sub(after, before, &diff);
+	return (uint64_t)diff.tv_sec * 1000000000 + diff.tv_nsec;
+}
+
+/*
+ * Sleep for NSECS and check how long it took.
+ */
+static
+void
+check_sleep(uint64_t nsecs)
+{
+	struct timespec before, after;
+	uint64_t took, limit;
+
+	gettime(&before);
+	thread_sleep_ns(nsecs);
+	gettime(&after);
+
+	took = elapsed_ns(&before, &after);
+	limit = nsecs + (uint64_t)SLACK_TICKS * (1000000000 / HZ);
+	kprintf("sleep %llu us: took %llu us\n",
+		(unsigned long long)(nsecs / 1000),
+		(unsigned long long)(took / 1000));
+	if (took < nsecs) {
+		panic("timertest: woke up early\n");
+	}
+	if (took > limit) {
+		kprintf("timertest: overslept (system busy?)\n");
+	}
+}
+
+static
+void
+signalthread(void *junk, unsigned long nsecs)
+{
+	(void)junk;
+
+	thread_sleep_ns(nsecs);
+	lock_acquire(tmlock);
+	cv_signal(tmcv, tmlock);
+	lock_release(tmlock);
+	V(tmdone);
+}
+
+int
+timertest(int nargs, char **args)
+{
+	uint64_t deadline;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting timer test...\n");
+
+	check_sleep(0);
+	check_sleep(1000000);		/* 1 ms, less than a tick */
+	check_sleep(25000000);		/* 25 ms */
+	check_sleep(300000000);		/* 300 ms */
+	/* longer than one turn of the timer wheel */
+	check_sleep(3000000000ULL);
+
+	/* Nobody signals: must time out. */
+	lock_acquire(tmlock);
+	deadline = timer_now() + timer_ns2ticks(50000000);
+	result = cv_timedwait(tmcv, tmlock, deadline);
+	if (result != ETIMEDOUT) {
+		panic("timertest: cv_timedwait returned %d, not ETIMEDOUT\n",
+		      result);
+	}
+	if (timer_now() < deadline) {
+		panic("timertest: cv_timedwait timed out early\n");
+	}
+	lock_release(tmlock);
+	kprintf("cv_timedwait timed out ok\n");
+
+	/* Signalled well before the deadline: must not time out. */
+	result = thread_fork("timertest signal", NULL, signalthread,
+			     NULL, 20000000);
+	if (result) {
+		panic("timertest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+	lock_acquire(tmlock);
+	deadline = timer_now() + timer_ns2ticks(5000000000ULL);
+	result = cv_timedwait(tmcv, tmlock, deadline);
+	lock_release(tmlock);
+	P(tmdone);
+	if (result == ETIMEDOUT) {
+		/* The signal can be lost if it came before we waited. */
+		kprintf("timertest: cv_timedwait missed the signal\n");
+	}
+	else {
+		kprintf("cv_timedwait signalled ok\n");
+	}
+
+	kprintf("Timer test done.\n");
+	return 0;
+}
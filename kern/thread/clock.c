@@ -34,13 +34,14 @@
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <usage.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * Timed callbacks are kept on a hashed timer wheel (see "Timers"
+ * below) that advances once per hardclock on cpu 0, so they have a
+ * resolution of 1/HZ seconds.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -50,8 +51,9 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
+#define SCHEDULE_HARDCLOCKS	50	/* Boost priorities every 50 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
+#define TICKLESS_HARDCLOCKS	HZ	/* Idle cpus tick once a second. */
 
 /*
  * Once a second, everything waiting on lbolt is awakened by CPU 0.
@@ -59,6 +61,33 @@
 static struct wchan *lbolt;
 static struct spinlock lbolt_lock;
 
+/*
+ * Nobody ever wakes up naptime; threads sleep on it with a timeout
+ * in thread_sleep_ns.
+ */
+static struct wchan *naptime;
+static struct spinlock naptime_lock;
+
+/*
+ * The timer wheel. A timer due at tick T goes in slot T mod
+ * TIMER_WHEEL_SLOTS; each tick, the slot for that tick is scanned
+ * and anything due is run. Timers further out than one turn of the
+ * wheel just get passed over until their turn comes.
+ *
+ * timer_lock protects the wheel, timer_ticks, and the tm_state and
+ * links of every timer.
+ */
+#define TIMER_WHEEL_SLOTS	256
+
+/* Values for tm_state */
+#define TIMER_IDLE	0	/* not armed */
+#define TIMER_PENDING	1	/* on the wheel */
+#define TIMER_FIRING	2	/* off the wheel, function being called */
+
+static struct spinlock timer_lock = SPINLOCK_INITIALIZER;
+static struct timer *timer_wheel[TIMER_WHEEL_SLOTS];
+static uint64_t timer_ticks;
+
 /*
  * Setup.
  */
@@ -70,6 +99,12 @@ hardclock_bootstrap(void)
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+
+	spinlock_init(&naptime_lock);
+	naptime = wchan_create("naptime");
+	if (naptime == NULL) {
+		panic("Couldn't create naptime\n");
+	}
 }
 
 /*
@@ -85,25 +120,120 @@ timerclock(void)
 	spinlock_release(&lbolt_lock);
 }
 
+/*
+ * Take a timer off the wheel. Must hold timer_lock.
+ */
+static
+void
+timer_unlink(struct timer *t)
+{
+	KASSERT(spinlock_do_i_hold(&timer_lock));
+	KASSERT(t->tm_state == TIMER_PENDING);
+
+	if (t->tm_prev != NULL) {
+		t->tm_prev->tm_next = t->tm_next;
+	}
+	else {
+		timer_wheel[t->tm_when % TIMER_WHEEL_SLOTS] = t->tm_next;
+	}
+	if (t->tm_next != NULL) {
+		t->tm_next->tm_prev = t->tm_prev;
+	}
+	t->tm_next = t->tm_prev = NULL;
+}
+
+/*
+ * Advance the timer wheel by one tick and run whatever is due.
+ * Called from hardclock on cpu 0.
+ */
+static
+void
+timer_tick(void)
+{
+	struct timer *t, *next, *due;
+	unsigned slot;
+
+	due = NULL;
+
+	spinlock_acquire(&timer_lock);
+	timer_ticks++;
+	slot = timer_ticks % TIMER_WHEEL_SLOTS;
+	for (t = timer_wheel[slot]; t != NULL; t = next) {
+		next = t->tm_next;
+		if (t->tm_when > timer_ticks) {
+			/* Not this time around */
+			continue;
+		}
+		timer_unlink(t);
+		t->tm_state = TIMER_FIRING;
+		t->tm_next = due;
+		due = t;
+	}
+	spinlock_release(&timer_lock);
+
+	/*
+	 * Run them without the lock, so they can do things like wake
+	 * threads up. Once the state goes back to idle the timer may
+	 * be freed by whoever is waiting in timer_stop, so don't touch
+	 * it after that.
+	 */
+	while ((t = due) != NULL) {
+		due = t->tm_next;
+		t->tm_func(t->tm_data);
+		spinlock_acquire(&timer_lock);
+		t->tm_state = TIMER_IDLE;
+		spinlock_release(&timer_lock);
+	}
+}
+
+/*
+ * Number of multiples of PERIOD in (OLD, NEW].
+ */
+static
+unsigned
+hardclock_crossed(unsigned old, unsigned new, unsigned period)
+{
+	return new / period - old / period;
+}
+
 /*
  * This is called HZ times a second (on each processor) by the timer
- * code.
+ * code, except on cpus with nothing queued, which may skip ticks (see
+ * thread_tick_defer). In that case we catch up here: the periodic
+ * work is done once if its period came round while we weren't
+ * ticking, and the running thread is charged for all the ticks.
  */
 void
 hardclock(void)
 {
+	unsigned ticks, old, n;
+
 	/*
 	 * Collect statistics here as desired.
 	 */
 
-	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
+	ticks = thread_tick_resume();
+	old = curcpu->c_hardclocks;
+	curcpu->c_hardclocks += ticks;
+	if (curcpu->c_number == 0) {
+		timer_tick();
+	}
+	n = hardclock_crossed(old, curcpu->c_hardclocks, MIGRATE_HARDCLOCKS);
+	if (n > 0) {
+		curcpu->c_migrations_skipped += n - 1;
 		thread_consider_migration();
 	}
-	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
+	if (hardclock_crossed(old, curcpu->c_hardclocks,
+			      SCHEDULE_HARDCLOCKS) > 0) {
 		schedule();
 	}
-	thread_yield();
+	usage_tick(ticks);
+	if (thread_tick(ticks)) {
+		thread_yield();
+	}
+	else {
+		thread_tick_defer(TICKLESS_HARDCLOCKS, MIGRATE_HARDCLOCKS);
+	}
 }
 
 /*
@@ -119,3 +249,109 @@ clocksleep(int num_secs)
 	}
 	spinlock_release(&lbolt_lock);
 }
+
+/*
+ * Suspend execution for at least nsecs nanoseconds.
+ */
+void
+thread_sleep_ns(uint64_t nsecs)
+{
+	uint64_t deadline;
+
+	deadline = timer_now() + timer_ns2ticks(nsecs);
+
+	spinlock_acquire(&naptime_lock);
+	while (wchan_sleep_until(naptime, &naptime_lock, deadline) == 0) {
+		/* nobody should wake naptime, but just in case */
+	}
+	spinlock_release(&naptime_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Timers
+
+/*
+ * Current time in ticks.
+ */
+uint64_t
+timer_now(void)
+{
+	uint64_t now;
+
+	/* 64-bit reads aren't atomic on a 32-bit machine */
+	spinlock_acquire(&timer_lock);
+	now = timer_ticks;
+	spinlock_release(&timer_lock);
+
+	return now;
+}
+
+/*
+ * Convert nanoseconds to ticks, rounding up. Add one more tick for
+ * the part of the current one that has already gone by, so a timer
+ * set this many ticks from now goes off no sooner than asked.
+ */
+uint64_t
+timer_ns2ticks(uint64_t nsecs)
+{
+	const uint64_t ticknsecs = 1000000000 / HZ;
+
+	return (nsecs + ticknsecs - 1) / ticknsecs + 1;
+}
+
+void
+timer_init(struct timer *t, void (*func)(void *), void *data)
+{
+	t->tm_next = NULL;
+	t->tm_prev = NULL;
+	t->tm_when = 0;
+	t->tm_func = func;
+	t->tm_data = data;
+	t->tm_state = TIMER_IDLE;
+}
+
+void
+timer_start(struct timer *t, uint64_t when)
+{
+	unsigned slot;
+
+	spinlock_acquire(&timer_lock);
+	KASSERT(t->tm_state == TIMER_IDLE);
+
+	/* The slot for the current tick has already been scanned. */
+	if (when <= timer_ticks) {
+		when = timer_ticks + 1;
+	}
+	t->tm_when = when;
+	t->tm_state = TIMER_PENDING;
+
+	slot = when % TIMER_WHEEL_SLOTS;
+	t->tm_prev = NULL;
+	t->tm_next = timer_wheel[slot];
+	if (t->tm_next != NULL) {
+		t->tm_next->tm_prev = t;
+	}
+	timer_wheel[slot] = t;
+	spinlock_release(&timer_lock);
+}
+
+bool
+timer_stop(struct timer *t)
+{
+	spinlock_acquire(&timer_lock);
+	if (t->tm_state == TIMER_PENDING) {
+		timer_unlink(t);
+		t->tm_state = TIMER_IDLE;
+		spinlock_release(&timer_lock);
+		return true;
+	}
+
+	/* If it's going off right now on cpu 0, wait for it to finish. */
+	while (t->tm_state == TIMER_FIRING) {
+		spinlock_release(&timer_lock);
+		spinlock_acquire(&timer_lock);
+	}
+	spinlock_release(&timer_lock);
+	return false;
+}
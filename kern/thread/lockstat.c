@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock contention profiling. See lockstat.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <lockstat.h>
+
+/*
+ * A lock class: all the locks with the same name. Holds the live
+ * lockstats of that name, plus the summed counts of ones that have
+ * been cleaned up. Classes are never freed, so once found a class
+ * pointer stays good.
+ */
+struct lockstat_class {
+	char lc_name[LOCKSTAT_NAMELEN];
+	bool lc_spin;
+	struct lockstat_class *lc_next;	/* all classes */
+	struct lockstat *lc_live;	/* live locks */
+	unsigned lc_acquires;		/* counts of dead locks */
+	unsigned lc_contended;
+	uint64_t lc_waitns;
+	uint64_t lc_maxholdns;
+};
+
+/*
+ * Totals for one class, for reporting.
+ */
+struct lockstat_totals {
+	const char *lt_name;
+	bool lt_spin;
+	unsigned lt_acquires;
+	unsigned lt_contended;
+	uint64_t lt_waitns;
+	uint64_t lt_maxholdns;
+};
+
+/*
+ * lockstat_lock protects the class list and each class's live list
+ * and retired counts. It is itself not profiled.
+ */
+static struct spinlock lockstat_lock = SPINLOCK_INITIALIZER;
+static struct lockstat_class *lockstat_classes;
+static unsigned lockstat_nclasses;
+
+/* Used if we run out of memory making a class. */
+static struct lockstat_class lockstat_overflow = {
+	.lc_name = "(other)",
+};
+
+/* Whether the clock can be read yet, for timing waits. */
+static volatile bool lockstat_clockok;
+
+/* Whether to time holds; off until turned on from the menu. */
+static volatile bool lockstat_timing;
+
+/*
+ * Convert a timespec to nanoseconds.
+ */
+static
+uint64_t
+ts_to_nsec(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+/*
+ * Nanoseconds from START to now.
+ */
+static
+uint64_t
+lockstat_since(const struct timespec *start)
+{
+	struct timespec now, diff;
+
+	gettime(&now);
+	timespec_sub(&now, start, &diff);
+	return ts_to_nsec(&diff);
+}
+
+void
+lockstat_bootstrap(void)
+{
+	lockstat_clockok = true;
+}
+
+void
+lockstat_settiming(bool on)
+{
+	lockstat_timing = on;
+}
+
+////////////////////////////////////////////////////////////
+// Setup and teardown
+
+/*
+ * Find the class named NAME, which should already be truncated to
+ * LOCKSTAT_NAMELEN. Must hold lockstat_lock.
+ */
+static
+struct lockstat_class *
+lockstat_findclass(const char *name, bool spin)
+{
+	struct lockstat_class *lc;
+
+	KASSERT(spinlock_do_i_hold(&lockstat_lock));
+
+	for (lc = lockstat_classes; lc != NULL; lc = lc->lc_next) {
+		if (lc->lc_spin == spin &&
+		    !strcmp(lc->lc_name, name)) {
+			return lc;
+		}
+	}
+	return NULL;
+}
+
+void
+lockstat_init(struct lockstat *ls, const char *name, bool spin)
+{
+	struct lockstat_class *lc, *newlc;
+	char shortname[LOCKSTAT_NAMELEN];
+
+	snprintf(shortname, sizeof(shortname), "%s", name);
+
+	ls->ls_acquires = 0;
+	ls->ls_contended = 0;
+	ls->ls_waitns = 0;
+	ls->ls_maxholdns = 0;
+	ls->ls_holdtimed = false;
+
+	/*
+	 * Look for an existing class; if there isn't one, make one
+	 * with the lock released (kmalloc might sleep) and check
+	 * again, in case someone else made it meanwhile.
+	 */
+	newlc = NULL;
+	spinlock_acquire(&lockstat_lock);
+	lc = lockstat_findclass(shortname, spin);
+	if (lc == NULL) {
+		spinlock_release(&lockstat_lock);
+		newlc = kmalloc(sizeof(*newlc));
+		if (newlc != NULL) {
+			bzero(newlc, sizeof(*newlc));
+			strcpy(newlc->lc_name, shortname);
+			newlc->lc_spin = spin;
+		}
+		spinlock_acquire(&lockstat_lock);
+		lc = lockstat_findclass(shortname, spin);
+		if (lc == NULL && newlc != NULL) {
+			lc = newlc;
+			newlc = NULL;
+			lc->lc_next = lockstat_classes;
+			lockstat_classes = lc;
+			lockstat_nclasses++;
+		}
+		if (lc == NULL) {
+			lc = &lockstat_overflow;
+		}
+	}
+
+	ls->ls_class = lc;
+	ls->ls_prev = NULL;
+	ls->ls_next = lc->lc_live;
+	if (ls->ls_next != NULL) {
+		ls->ls_next->ls_prev = ls;
+	}
+	lc->lc_live = ls;
+	spinlock_release(&lockstat_lock);
+
+	if (newlc != NULL) {
+		kfree(newlc);
+	}
+}
+
+void
+lockstat_cleanup(struct lockstat *ls)
+{
+	struct lockstat_class *lc = ls->ls_class;
+
+	spinlock_acquire(&lockstat_lock);
+	lc->lc_acquires += ls->ls_acquires;
+	lc->lc_contended += ls->ls_contended;
+	lc->lc_waitns += ls->ls_waitns;
+	if (ls->ls_maxholdns > lc->lc_maxholdns) {
+		lc->lc_maxholdns = ls->ls_maxholdns;
+	}
+
+	if (ls->ls_prev != NULL) {
+		ls->ls_prev->ls_next = ls->ls_next;
+	}
+	else {
+		KASSERT(lc->lc_live == ls);
+		lc->lc_live = ls->ls_next;
+	}
+	if (ls->ls_next != NULL) {
+		ls->ls_next->ls_prev = ls->ls_prev;
+	}
+	spinlock_release(&lockstat_lock);
+
+	ls->ls_class = NULL;
+}
+
+////////////////////////////////////////////////////////////
+// Hooks
+
+void
+lockstat_waitstart(struct timespec *start)
+{
+	/* We're about to wait anyway, so reading the clock is cheap. */
+	if (lockstat_clockok) {
+		gettime(start);
+	}
+	else {
+		start->tv_sec = 0;
+		start->tv_nsec = 0;
+	}
+}
+
+void
+lockstat_acquired(struct lockstat *ls, bool contended,
+		  const struct timespec *start, bool hold)
+{
+	ls->ls_acquires++;
+	if (contended) {
+		ls->ls_contended++;
+		/* A zero start means the clock wasn't there when we began. */
+		if (start->tv_sec != 0 || start->tv_nsec != 0) {
+			ls->ls_waitns += lockstat_since(start);
+		}
+	}
+
+	ls->ls_holdtimed = hold && lockstat_timing;
+	if (ls->ls_holdtimed) {
+		gettime(&ls->ls_holdstart);
+	}
+}
+
+void
+lockstat_released(struct lockstat *ls)
+{
+	uint64_t held;
+
+	if (ls->ls_holdtimed) {
+		ls->ls_holdtimed = false;
+		held = lockstat_since(&ls->ls_holdstart);
+		if (held > ls->ls_maxholdns) {
+			ls->ls_maxholdns = held;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Reporting
+
+/*
+ * Add up the counts for a class. Must hold lockstat_lock. The live
+ * counters are read without their locks, so the totals for a class
+ * that's busy at the moment are approximate.
+ */
+static
+void
+lockstat_sum(struct lockstat_class *lc, struct lockstat_totals *lt)
+{
+	struct lockstat *ls;
+
+	KASSERT(spinlock_do_i_hold(&lockstat_lock));
+
+	lt->lt_name = lc->lc_name;
+	lt->lt_spin = lc->lc_spin;
+	lt->lt_acquires = lc->lc_acquires;
+	lt->lt_contended = lc->lc_contended;
+	lt->lt_waitns = lc->lc_waitns;
+	lt->lt_maxholdns = lc->lc_maxholdns;
+	for (ls = lc->lc_live; ls != NULL; ls = ls->ls_next) {
+		lt->lt_acquires += ls->ls_acquires;
+		lt->lt_contended += ls->ls_contended;
+		lt->lt_waitns += ls->ls_waitns;
+		if (ls->ls_maxholdns > lt->lt_maxholdns) {
+			lt->lt_maxholdns = ls->ls_maxholdns;
+		}
+	}
+}
+
+/*
+ * Sort order for the report: most contended acquisitions first, then
+ * most time spent waiting.
+ */
+static
+bool
+lockstat_worse(const struct lockstat_totals *a,
+	       const struct lockstat_totals *b)
+{
+	if (a->lt_contended != b->lt_contended) {
+		return a->lt_contended > b->lt_contended;
+	}
+	return a->lt_waitns > b->lt_waitns;
+}
+
+void
+lockstat_print(unsigned n)
+{
+	struct lockstat_totals *all, tmp;
+	struct lockstat_class *lc;
+	unsigned max, num, i, j;
+
+	/*
+	 * Classes are only ever added, so a count taken now is enough
+	 * room for at least that many; any made after this are left
+	 * out of the report.
+	 */
+	spinlock_acquire(&lockstat_lock);
+	max = lockstat_nclasses + 1;
+	spinlock_release(&lockstat_lock);
+
+	all = kmalloc(max * sizeof(*all));
+	if (all == NULL) {
+		kprintf("lockstat: Out of memory\n");
+		return;
+	}
+
+	num = 0;
+	spinlock_acquire(&lockstat_lock);
+	for (lc = lockstat_classes; lc != NULL && num < max-1;
+	     lc = lc->lc_next) {
+		lockstat_sum(lc, &all[num++]);
+	}
+	lockstat_sum(&lockstat_overflow, &all[num++]);
+	spinlock_release(&lockstat_lock);
+
+	/* Insertion sort; there are not many classes. */
+	for (i=1; i<num; i++) {
+		tmp = all[i];
+		for (j=i; j>0 && lockstat_worse(&tmp, &all[j-1]); j--) {
+			all[j] = all[j-1];
+		}
+		all[j] = tmp;
+	}
+
+	if (n > num) {
+		n = num;
+	}
+	kprintf("%-24s %5s %10s %10s %12s %10s\n", "lock", "kind",
+		"acquires", "contended", "wait (us)", "maxhold");
+	for (i=0; i<n; i++) {
+		kprintf("%-24s %5s %10u %10u %12llu %10llu\n",
+			all[i].lt_name, all[i].lt_spin ? "spin" : "sleep",
+			all[i].lt_acquires, all[i].lt_contended,
+			(unsigned long long)(all[i].lt_waitns / 1000),
+			(unsigned long long)(all[i].lt_maxholdns / 1000));
+	}
+	if (!lockstat_timing) {
+		kprintf("(hold timing is off; \"ls on\" turns it on)\n");
+	}
+
+	kfree(all);
+}
+
+/*
+ * Zero the counters of a class and its live locks. Must hold
+ * lockstat_lock. As with lockstat_sum, the live counters aren't
+ * locked, so an update racing with this may survive it.
+ */
+static
+void
+lockstat_zero(struct lockstat_class *lc)
+{
+	struct lockstat *ls;
+
+	KASSERT(spinlock_do_i_hold(&lockstat_lock));
+
+	lc->lc_acquires = 0;
+	lc->lc_contended = 0;
+	lc->lc_waitns = 0;
+	lc->lc_maxholdns = 0;
+	for (ls = lc->lc_live; ls != NULL; ls = ls->ls_next) {
+		ls->ls_acquires = 0;
+		ls->ls_contended = 0;
+		ls->ls_waitns = 0;
+		ls->ls_maxholdns = 0;
+	}
+}
+
+void
+lockstat_reset(void)
+{
+	struct lockstat_class *lc;
+
+	spinlock_acquire(&lockstat_lock);
+	for (lc = lockstat_classes; lc != NULL; lc = lc->lc_next) {
+		lockstat_zero(lc);
+	}
+	lockstat_zero(&lockstat_overflow);
+	spinlock_release(&lockstat_lock);
+}
@@ -38,6 +38,7 @@
 #include <spinlock.h>
 #include <membar.h>
 #include <current.h>	/* for curcpu */
+#include <lockstat.h>
 
 /*
  * Spinlocks.
@@ -52,6 +53,9 @@ spinlock_init(struct spinlock *splk)
 {
 	spinlock_data_set(&splk->splk_lock, 0);
 	splk->splk_holder = NULL;
+#if OPT_LOCKSTAT
+	splk->splk_stat = NULL;
+#endif
 }
 
 /*
@@ -75,6 +79,10 @@ void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+#if OPT_LOCKSTAT
+	struct timespec waitstart;
+	bool contended = false;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -101,10 +109,14 @@ spinlock_acquire(struct spinlock *splk)
 		 * previously unheld and we now own it. If it was 1,
 		 * we don't.
 		 */
-		if (spinlock_data_get(&splk->splk_lock) != 0) {
-			continue;
-		}
-		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
+		if (spinlock_data_get(&splk->splk_lock) != 0 ||
+		    spinlock_data_testandset(&splk->splk_lock) != 0) {
+#if OPT_LOCKSTAT
+			if (!contended && splk->splk_stat != NULL) {
+				contended = true;
+				lockstat_waitstart(&waitstart);
+			}
+#endif
 			continue;
 		}
 		break;
@@ -112,6 +124,12 @@ spinlock_acquire(struct spinlock *splk)
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
+#if OPT_LOCKSTAT
+	if (splk->splk_stat != NULL) {
+		lockstat_acquired(splk->splk_stat, contended, &waitstart,
+				  true);
+	}
+#endif
 }
 
 /*
@@ -127,6 +145,11 @@ spinlock_release(struct spinlock *splk)
 		curcpu->c_spinlocks--;
 	}
 
+#if OPT_LOCKSTAT
+	if (splk->splk_stat != NULL) {
+		lockstat_released(splk->splk_stat);
+	}
+#endif
 	splk->splk_holder = NULL;
 	membar_any_store();
 	spinlock_data_set(&splk->splk_lock, 0);
@@ -146,3 +169,14 @@ spinlock_do_i_hold(struct spinlock *splk)
 	/* Assume we can read splk_holder atomically enough for this to work */
 	return (splk->splk_holder == curcpu->c_self);
 }
+
+#if OPT_LOCKSTAT
+/*
+ * Start profiling the lock.
+ */
+void
+spinlock_setstat(struct spinlock *splk, struct lockstat *ls)
+{
+	splk->splk_stat = ls;
+}
+#endif
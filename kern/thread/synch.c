@@ -34,12 +34,23 @@
 
 #include <types.h>
 #include <lib.h>
+#include <cpu.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
 
+/*
+ * Adaptive lock tuning. A waiter whose lock holder is running on
+ * another cpu spins in rounds of LOCK_SPIN_ROUND polls, rechecking
+ * the holder between rounds, for at most LOCK_SPIN_MAX polls in all
+ * before giving up and sleeping. A context switch costs a few
+ * thousand cycles, so spinning much longer than that is a loss.
+ */
+#define LOCK_SPIN_ROUND		50
+#define LOCK_SPIN_MAX		1000
+
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
@@ -138,10 +149,177 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+/*
+ * Priority inheritance.
+ *
+ * A thread that goes to sleep waiting for a lock lends its priority
+ * to the holder, so a high-priority thread isn't stuck behind a
+ * low-priority holder that never gets to run. If the holder is itself
+ * asleep waiting for a lock, the priority is passed on to that lock's
+ * holder, and so on down the chain.
+ *
+ * Each lock counts its sleeping waiters by the priority they lent it
+ * (lk_nwaiting), and each thread keeps a list of the locks it holds
+ * that have waiters (t_heldlocks), so that when it releases one, the
+ * priority it should still inherit can be worked out from the rest.
+ * A lock is on its holder's list exactly when it has both a holder
+ * and waiters.
+ *
+ * pi_lock protects all of this, for all locks at once, since a chain
+ * can run through any number of them. It is taken after lk_lock and
+ * before the runqueue locks. lk_nwaiters only changes with both
+ * lk_lock and pi_lock held, and while a lock has waiters its holder
+ * only changes with pi_lock held; so the chain can be followed under
+ * pi_lock alone, and a lock with no waiters can be taken and released
+ * without pi_lock at all.
+ */
+static struct spinlock pi_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Best priority lent to LOCK by its waiters, or SCHED_NLEVELS if none.
+ */
+static
+unsigned
+lock_pi_best(struct lock *lock)
+{
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&pi_lock));
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		if (lock->lk_nwaiting[i] > 0) {
+			break;
+		}
+	}
+	return i;
+}
+
+/*
+ * Lend the priority of the current thread, which is about to sleep
+ * waiting for LOCK, to the holder and on down the chain.
+ */
+static
+void
+lock_pi_wait(struct lock *lock)
+{
+	struct thread *holder;
+	struct lock *l;
+	unsigned prio;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+	KASSERT(lock->lk_holder != NULL);
+
+	spinlock_acquire(&pi_lock);
+	prio = thread_effective_priority(curthread);
+	curthread->t_waitlock = lock;
+	curthread->t_waitprio = prio;
+	lock->lk_nwaiting[prio]++;
+	if (lock->lk_nwaiters++ == 0) {
+		lock->lk_nextheld = lock->lk_holder->t_heldlocks;
+		lock->lk_holder->t_heldlocks = lock;
+	}
+
+	/*
+	 * Stops when it reaches a thread that already has this
+	 * priority or better, so a deadlock cycle ends too.
+	 */
+	l = lock;
+	while ((holder = l->lk_holder) != NULL &&
+	       prio < thread_effective_priority(holder)) {
+		thread_inherit_priority(holder, prio);
+		l = holder->t_waitlock;
+		if (l == NULL) {
+			break;
+		}
+		l->lk_nwaiting[holder->t_waitprio]--;
+		l->lk_nwaiting[prio]++;
+		holder->t_waitprio = prio;
+	}
+	spinlock_release(&pi_lock);
+}
+
+/*
+ * The current thread takes LOCK, after having waited for it if
+ * WAITED. If anyone else is still waiting, it inherits their priority.
+ */
+static
+void
+lock_pi_take(struct lock *lock, bool waited)
+{
+	unsigned prio;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+	KASSERT(lock->lk_holder == NULL);
+
+	if (!waited && lock->lk_nwaiters == 0) {
+		lock->lk_holder = curthread;
+		return;
+	}
+
+	spinlock_acquire(&pi_lock);
+	if (waited) {
+		KASSERT(curthread->t_waitlock == lock);
+		lock->lk_nwaiting[curthread->t_waitprio]--;
+		lock->lk_nwaiters--;
+		curthread->t_waitlock = NULL;
+	}
+	lock->lk_holder = curthread;
+	if (lock->lk_nwaiters > 0) {
+		lock->lk_nextheld = curthread->t_heldlocks;
+		curthread->t_heldlocks = lock;
+		prio = lock_pi_best(lock);
+		if (prio < thread_effective_priority(curthread)) {
+			thread_inherit_priority(curthread, prio);
+		}
+	}
+	spinlock_release(&pi_lock);
+}
+
+/*
+ * The current thread lets go of LOCK. If it had waiters, take it off
+ * our list and go back to inheriting only from what's left.
+ */
+static
+void
+lock_pi_release(struct lock *lock)
+{
+	struct lock **lp, *l;
+	unsigned prio, best;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	if (lock->lk_nwaiters == 0) {
+		lock->lk_holder = NULL;
+		return;
+	}
+
+	spinlock_acquire(&pi_lock);
+	for (lp = &curthread->t_heldlocks; *lp != lock;
+	     lp = &(*lp)->lk_nextheld) {
+		KASSERT(*lp != NULL);
+	}
+	*lp = lock->lk_nextheld;
+	lock->lk_nextheld = NULL;
+	lock->lk_holder = NULL;
+
+	prio = SCHED_NLEVELS;
+	for (l = curthread->t_heldlocks; l != NULL; l = l->lk_nextheld) {
+		best = lock_pi_best(l);
+		if (best < prio) {
+			prio = best;
+		}
+	}
+	if (prio != curthread->t_inherit) {
+		thread_inherit_priority(curthread, prio);
+	}
+	spinlock_release(&pi_lock);
+}
+
 struct lock *
 lock_create(const char *name)
 {
         struct lock *lock;
+	unsigned i;
 
         lock = kmalloc(sizeof(struct lock));
         if (lock == NULL) {
@@ -162,6 +340,17 @@ lock_create(const char *name)
 	}
 	spinlock_init(&lock->lk_lock);
 	lock->lk_holder = NULL;
+	lock->lk_nfast = 0;
+	lock->lk_nspin = 0;
+	lock->lk_nsleep = 0;
+	lock->lk_nwaiters = 0;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		lock->lk_nwaiting[i] = 0;
+	}
+	lock->lk_nextheld = NULL;
+#if OPT_LOCKSTAT
+	lockstat_init(&lock->lk_stat, lock->lk_name, false);
+#endif
 
         return lock;
 }
@@ -172,6 +361,10 @@ lock_destroy(struct lock *lock)
         KASSERT(lock != NULL);
 
 	KASSERT(lock->lk_holder == NULL);
+	KASSERT(lock->lk_nwaiters == 0);
+#if OPT_LOCKSTAT
+	lockstat_cleanup(&lock->lk_stat);
+#endif
 	spinlock_cleanup(&lock->lk_lock);
 	wchan_destroy(lock->lk_wchan);
 
@@ -179,20 +372,88 @@ lock_destroy(struct lock *lock)
         kfree(lock);
 }
 
+/*
+ * Check if the holder of LOCK is running on some other cpu, in which
+ * case it's worth spinning for a while. Must hold lk_lock, which
+ * keeps the holder from letting go of the lock and going away.
+ */
+static
+bool
+lock_holder_running(struct lock *lock)
+{
+	struct thread *holder;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	holder = lock->lk_holder;
+	return holder != NULL && holder->t_state == S_RUN &&
+		holder->t_cpu != curcpu->c_self;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
+	unsigned spins, i;
+	bool slept;
+#if OPT_LOCKSTAT
+	struct timespec waitstart;
+#endif
+
 	DEBUGASSERT(lock != NULL);
         KASSERT(curthread->t_in_interrupt == false);
 
 	spinlock_acquire(&lock->lk_lock);
 	KASSERT(lock->lk_holder != curthread);
+
+	if (lock->lk_holder == NULL) {
+		lock->lk_nfast++;
+		lock_pi_take(lock, false);
+#if OPT_LOCKSTAT
+		lockstat_acquired(&lock->lk_stat, false, NULL, true);
+#endif
+		spinlock_release(&lock->lk_lock);
+		return;
+	}
+
+#if OPT_LOCKSTAT
+	lockstat_waitstart(&waitstart);
+#endif
+	spins = 0;
+	slept = false;
 	while (lock->lk_holder != NULL) {
+		if (spins < LOCK_SPIN_MAX && lock_holder_running(lock)) {
+			/*
+			 * Spin without the spinlock so the holder can
+			 * release. lk_holder is volatile, so this
+			 * rereads it every time.
+			 */
+			spinlock_release(&lock->lk_lock);
+			for (i=0; i<LOCK_SPIN_ROUND &&
+				     lock->lk_holder != NULL; i++) {
+				/* nothing */
+			}
+			spins += i;
+			spinlock_acquire(&lock->lk_lock);
+			continue;
+		}
 		/* As in the semaphore. */
+		if (!slept) {
+			lock_pi_wait(lock);
+			slept = true;
+		}
                 wchan_sleep(lock->lk_wchan, &lock->lk_lock);
 	}
 
-	lock->lk_holder = curthread;
+	if (slept) {
+		lock->lk_nsleep++;
+	}
+	else {
+		lock->lk_nspin++;
+	}
+	lock_pi_take(lock, slept);
+#if OPT_LOCKSTAT
+	lockstat_acquired(&lock->lk_stat, true, &waitstart, true);
+#endif
 	spinlock_release(&lock->lk_lock);
 }
 
@@ -203,7 +464,10 @@ lock_release(struct lock *lock)
 
 	spinlock_acquire(&lock->lk_lock);
 	KASSERT(lock->lk_holder == curthread);
-	lock->lk_holder = NULL;
+#if OPT_LOCKSTAT
+	lockstat_released(&lock->lk_stat);
+#endif
+	lock_pi_release(lock);
 	wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
 	spinlock_release(&lock->lk_lock);
 }
@@ -222,6 +486,23 @@ lock_do_i_hold(struct lock *lock)
         return ret;
 }
 
+void
+lock_printstats(struct lock *lock)
+{
+	unsigned nfast, nspin, nsleep;
+
+	DEBUGASSERT(lock != NULL);
+
+	spinlock_acquire(&lock->lk_lock);
+	nfast = lock->lk_nfast;
+	nspin = lock->lk_nspin;
+	nsleep = lock->lk_nsleep;
+	spinlock_release(&lock->lk_lock);
+
+	kprintf("lock %s: %u fast, %u spun, %u slept\n",
+		lock->lk_name, nfast, nspin, nsleep);
+}
+
 ////////////////////////////////////////////////////////////
 //
 // CV
@@ -284,6 +565,20 @@ cv_wait(struct cv *cv, struct lock *lock)
 	lock_acquire(lock);
 }
 
+int
+cv_timedwait(struct cv *cv, struct lock *lock, uint64_t deadline)
+{
+	int result;
+
+	spinlock_acquire(&cv->cv_wchanlock);
+	lock_release(lock);
+	result = wchan_sleep_until(cv->cv_wchan, &cv->cv_wchanlock, deadline);
+	spinlock_release(&cv->cv_wchanlock);
+	lock_acquire(lock);
+
+	return result;
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
@@ -300,4 +595,170 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	spinlock_acquire(&cv->cv_wchanlock);
 	wchan_wakeall(cv->cv_wchan, &cv->cv_wchanlock);
 	spinlock_release(&cv->cv_wchanlock);
-}
\ No newline at end of file
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+        struct rwlock *rwlock;
+
+        rwlock = kmalloc(sizeof(struct rwlock));
+        if (rwlock == NULL) {
+                return NULL;
+        }
+
+        rwlock->rwlock_name = kstrdup(name);
+        if (rwlock->rwlock_name == NULL) {
+                kfree(rwlock);
+                return NULL;
+        }
+
+	rwlock->rwlock_rwchan = wchan_create(rwlock->rwlock_name);
+	if (rwlock->rwlock_rwchan == NULL) {
+		kfree(rwlock->rwlock_name);
+		kfree(rwlock);
+		return NULL;
+	}
+	rwlock->rwlock_wwchan = wchan_create(rwlock->rwlock_name);
+	if (rwlock->rwlock_wwchan == NULL) {
+		wchan_destroy(rwlock->rwlock_rwchan);
+		kfree(rwlock->rwlock_name);
+		kfree(rwlock);
+		return NULL;
+	}
+
+	spinlock_init(&rwlock->rwlock_lock);
+	rwlock->rwlock_readers = 0;
+	rwlock->rwlock_waitwriters = 0;
+	rwlock->rwlock_writer = NULL;
+#if OPT_LOCKSTAT
+	lockstat_init(&rwlock->rwlock_stat, rwlock->rwlock_name, false);
+#endif
+
+        return rwlock;
+}
+
+void
+rwlock_destroy(struct rwlock *rwlock)
+{
+        KASSERT(rwlock != NULL);
+
+	KASSERT(rwlock->rwlock_readers == 0);
+	KASSERT(rwlock->rwlock_waitwriters == 0);
+	KASSERT(rwlock->rwlock_writer == NULL);
+#if OPT_LOCKSTAT
+	lockstat_cleanup(&rwlock->rwlock_stat);
+#endif
+	spinlock_cleanup(&rwlock->rwlock_lock);
+	wchan_destroy(rwlock->rwlock_wwchan);
+	wchan_destroy(rwlock->rwlock_rwchan);
+
+        kfree(rwlock->rwlock_name);
+        kfree(rwlock);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rwlock)
+{
+#if OPT_LOCKSTAT
+	struct timespec waitstart;
+	bool contended = false;
+#endif
+
+	DEBUGASSERT(rwlock != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rwlock->rwlock_lock);
+	KASSERT(rwlock->rwlock_writer != curthread);
+	/* Wait behind both the current writer and any waiting ones. */
+	while (rwlock->rwlock_writer != NULL ||
+	       rwlock->rwlock_waitwriters > 0) {
+#if OPT_LOCKSTAT
+		if (!contended) {
+			contended = true;
+			lockstat_waitstart(&waitstart);
+		}
+#endif
+		wchan_sleep(rwlock->rwlock_rwchan, &rwlock->rwlock_lock);
+	}
+	rwlock->rwlock_readers++;
+#if OPT_LOCKSTAT
+	lockstat_acquired(&rwlock->rwlock_stat, contended, &waitstart, false);
+#endif
+	spinlock_release(&rwlock->rwlock_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rwlock)
+{
+	DEBUGASSERT(rwlock != NULL);
+
+	spinlock_acquire(&rwlock->rwlock_lock);
+	KASSERT(rwlock->rwlock_readers > 0);
+	KASSERT(rwlock->rwlock_writer == NULL);
+	rwlock->rwlock_readers--;
+	if (rwlock->rwlock_readers == 0) {
+		wchan_wakeone(rwlock->rwlock_wwchan, &rwlock->rwlock_lock);
+	}
+	spinlock_release(&rwlock->rwlock_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rwlock)
+{
+#if OPT_LOCKSTAT
+	struct timespec waitstart;
+	bool contended = false;
+#endif
+
+	DEBUGASSERT(rwlock != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rwlock->rwlock_lock);
+	KASSERT(rwlock->rwlock_writer != curthread);
+	rwlock->rwlock_waitwriters++;
+	while (rwlock->rwlock_writer != NULL ||
+	       rwlock->rwlock_readers > 0) {
+#if OPT_LOCKSTAT
+		if (!contended) {
+			contended = true;
+			lockstat_waitstart(&waitstart);
+		}
+#endif
+		wchan_sleep(rwlock->rwlock_wwchan, &rwlock->rwlock_lock);
+	}
+	rwlock->rwlock_waitwriters--;
+	rwlock->rwlock_writer = curthread;
+#if OPT_LOCKSTAT
+	lockstat_acquired(&rwlock->rwlock_stat, contended, &waitstart, true);
+#endif
+	spinlock_release(&rwlock->rwlock_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rwlock)
+{
+	DEBUGASSERT(rwlock != NULL);
+
+	spinlock_acquire(&rwlock->rwlock_lock);
+	KASSERT(rwlock->rwlock_writer == curthread);
+#if OPT_LOCKSTAT
+	lockstat_released(&rwlock->rwlock_stat);
+#endif
+	rwlock->rwlock_writer = NULL;
+	/*
+	 * Hand off to the next writer if there is one; otherwise let
+	 * all the waiting readers in at once.
+	 */
+	if (rwlock->rwlock_waitwriters > 0) {
+		wchan_wakeone(rwlock->rwlock_wwchan, &rwlock->rwlock_lock);
+	}
+	else {
+		wchan_wakeall(rwlock->rwlock_rwchan, &rwlock->rwlock_lock);
+	}
+	spinlock_release(&rwlock->rwlock_lock);
+}
@@ -41,6 +41,7 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <wchan.h>
+#include <clock.h>
 #include <thread.h>
 #include <threadlist.h>
 #include <threadprivate.h>
@@ -50,6 +51,7 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <trace.h>
 
 #include "opt-synchprobs.h"
 
@@ -57,6 +59,24 @@
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/* Length of a time slice at each priority level, in hardclocks. */
+#define SCHED_QUANTUM(level)	(1U << (level))
+
+/*
+ * Cache affinity tuning. A thread that ran within the last
+ * SCHED_CACHE_HOT hardclocks is assumed to still have its working set
+ * in that cpu's cache. A cpu with SCHED_OVERLOAD or more threads
+ * already waiting is too busy to be worth waiting for.
+ */
+#define SCHED_CACHE_HOT		2
+#define SCHED_OVERLOAD		2
+
+/*
+ * Number of exited threads, with their stacks, each cpu keeps around
+ * for reuse by thread_fork.
+ */
+#define THREAD_CACHE_MAX	16
+
 /* Wait channel. A wchan is protected by an associated, passed-in spinlock. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -78,6 +98,9 @@ static struct wchanarray allwchans;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Work stealing for idle cpus; see "Thread migration" below. */
+static bool thread_steal_idle(void);
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -118,44 +141,66 @@ thread_checkstack(struct thread *thread)
 }
 
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * Set up the fields of a thread, other than its stack. This is used
+ * both for new threads and for recycled ones.
  */
 static
-struct thread *
-thread_create(const char *name)
+void
+thread_init(struct thread *thread, const char *name)
 {
-	struct thread *thread;
-
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
-	}
-
-	thread->t_name = kstrdup(name);
-	if (thread->t_name == NULL) {
-		kfree(thread);
-		return NULL;
-	}
+	snprintf(thread->t_namebuf, sizeof(thread->t_namebuf), "%s", name);
+	thread->t_name = thread->t_namebuf;
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
 
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_priority = 0;
+	thread->t_quantum = SCHED_QUANTUM(0);
+	thread->t_inherit = SCHED_NLEVELS;
+	thread->t_waitlock = NULL;
+	thread->t_waitprio = 0;
+	thread->t_heldlocks = NULL;
+	thread->t_lastcpu = NULL;
+	thread->t_lastrun = 0;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	/* Public fields */
+	thread->t_utid = 0;
+	usage_init(&thread->t_usage);
+	thread->t_usagemark.tv_sec = 0;
+	thread->t_usagemark.tv_nsec = 0;
+	thread->t_usagegen = 0;
+
 	/* If you add to struct thread, be sure to initialize here */
+}
+
+/*
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads.
+ */
+static
+struct thread *
+thread_create(const char *name)
+{
+	struct thread *thread;
+
+	thread = kmalloc(sizeof(*thread));
+	if (thread == NULL) {
+		return NULL;
+	}
+	thread->t_stack = NULL;
+	thread_init(thread, name);
 
 	return thread;
 }
@@ -173,6 +218,7 @@ cpu_create(unsigned hardware_number)
 {
 	struct cpu *c;
 	int result;
+	unsigned i;
 	char namebuf[16];
 
 	c = kmalloc(sizeof(*c));
@@ -185,12 +231,21 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_threadcache);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_intr_user = false;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	c->c_tickless = false;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
 	spinlock_init(&c->c_runqueue_lock);
+#if OPT_LOCKSTAT
+	lockstat_init(&c->c_runqueue_stat, "runqueue", true);
+	spinlock_setstat(&c->c_runqueue_lock, &c->c_runqueue_stat);
+#endif
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -200,6 +255,19 @@ cpu_create(unsigned hardware_number)
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
+	/* xorshift must not start from zero */
+	c->c_randseed = 2463534242U + c->c_number * 2654435761U;
+	c->c_wake_affine = 0;
+	c->c_wake_moved = 0;
+	c->c_steal_cold = 0;
+	c->c_steal_hot = 0;
+	c->c_tickless_since = 0;
+	c->c_ticks_skipped = 0;
+	c->c_yields_skipped = 0;
+	c->c_migrations_skipped = 0;
+#if OPT_TRACE
+	trace_cpu_init(&c->c_trace);
+#endif
 
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
@@ -234,6 +302,22 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+/*
+ * Look up cpus by number.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+struct cpu *
+cpu_get(unsigned num)
+{
+	KASSERT(num < cpuarray_num(&allcpus));
+	return cpuarray_get(&allcpus, num);
+}
+
 /*
  * Destroy a thread.
  *
@@ -265,13 +349,85 @@ thread_destroy(struct thread *thread)
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread->t_name);
 	kfree(thread);
 }
 
+/*
+ * Put a dead thread in this cpu's thread cache for reuse, if there's
+ * room, and return true; otherwise return false and leave it alone.
+ * The stack is kept, guard band and all. Only threads with their own
+ * stacks are cached, so the boot thread never is.
+ *
+ * Like thread_destroy, this cannot be called on a running thread.
+ * Must be called with interrupts off, since the cache is per-cpu.
+ */
+static
+bool
+thread_recycle(struct thread *thread)
+{
+	KASSERT(thread != curthread);
+	KASSERT(thread->t_state != S_RUN);
+	KASSERT(thread->t_proc == NULL);
+	KASSERT(curthread->t_curspl > 0);
+
+	if (thread->t_stack == NULL ||
+	    curcpu->c_threadcache.tl_count >= THREAD_CACHE_MAX) {
+		return false;
+	}
+
+	/* Make sure it didn't overflow before handing the stack out again. */
+	thread_checkstack(thread);
+
+	threadlistnode_cleanup(&thread->t_listnode);
+	thread_machdep_cleanup(&thread->t_machdep);
+	thread->t_wchan_name = "CACHED";
+
+	threadlistnode_init(&thread->t_listnode, thread);
+	threadlist_addhead(&curcpu->c_threadcache, thread);
+	return true;
+}
+
+/*
+ * Get a thread, with a stack, for thread_fork: a cached one if this
+ * cpu has one, otherwise a newly allocated one.
+ */
+static
+struct thread *
+thread_get(const char *name)
+{
+	struct thread *thread;
+	int spl;
+
+	/* Interrupts off, so we can't be moved to another cpu midway. */
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	splx(spl);
+
+	if (thread != NULL) {
+		thread_init(thread, name);
+		return thread;
+	}
+
+	thread = thread_create(name);
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	/* Allocate a stack */
+	thread->t_stack = kmalloc(STACK_SIZE);
+	if (thread->t_stack == NULL) {
+		thread_destroy(thread);
+		return NULL;
+	}
+	thread_checkstack_init(thread);
+
+	return thread;
+}
+
 /*
  * Clean up zombies. (Zombies are threads that have exited but still
- * need to have thread_destroy called on them.)
+ * need to have thread_destroy called on them.) As many as will fit go
+ * in the thread cache instead of being destroyed.
  *
  * The list of zombies is per-cpu.
  */
@@ -284,7 +440,9 @@ exorcise(void)
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+		if (!thread_recycle(z)) {
+			thread_destroy(z);
+		}
 	}
 }
 
@@ -296,6 +454,8 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -310,9 +470,13 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		struct threadlist *tl = &curcpu->c_runqueue[i];
+
+		tl->tl_count = 0;
+		tl->tl_head.tln_next = &tl->tl_tail;
+		tl->tl_tail.tln_prev = &tl->tl_head;
+	}
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -442,6 +606,184 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Run queue helpers.
+ *
+ * Each cpu has one run queue per priority level; a ready thread sits
+ * on the queue for its effective priority (see below). All of these
+ * must be called with the cpu's runqueue lock held.
+ */
+
+/* Add a thread at the tail of the queue for its priority level. */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	unsigned prio;
+
+	prio = thread_effective_priority(t);
+	KASSERT(prio < SCHED_NLEVELS);
+	threadlist_addtail(&c->c_runqueue[prio], t);
+}
+
+/* Remove and return the next thread to run, or NULL if none. */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		t = threadlist_remhead(&c->c_runqueue[i]);
+		if (t != NULL) {
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/* Total number of ready threads. */
+static
+unsigned
+runqueue_count(struct cpu *c)
+{
+	unsigned i, count;
+
+	count = 0;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		count += c->c_runqueue[i].tl_count;
+	}
+	return count;
+}
+
+/* Check if any thread at priority LEVEL or better is ready. */
+static
+bool
+runqueue_haspriority(struct cpu *c, unsigned level)
+{
+	unsigned i;
+
+	for (i=0; i<=level && i<SCHED_NLEVELS; i++) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Check if thread T has run recently enough that its working set is
+ * probably still in the cache of the cpu it ran on. Threads that have
+ * never run have nothing in any cache.
+ */
+static
+bool
+thread_cache_hot(struct thread *t)
+{
+	struct cpu *c;
+
+	c = t->t_lastcpu;
+	if (c == NULL) {
+		return false;
+	}
+	return c->c_hardclocks - t->t_lastrun < SCHED_CACHE_HOT;
+}
+
+/*
+ * Choose a cpu for thread T, which is being woken up by the current
+ * thread. Prefer the cpu it last ran on, as long as the thread is
+ * still cache-hot there and that cpu isn't overloaded. Otherwise
+ * nothing is lost by moving it, so put it on the waker's cpu if that
+ * is less busy; this also keeps the wakeup from having to reach over
+ * and lock another cpu's run queue.
+ *
+ * T is on no list at this point, but t_cpu may only change under the
+ * old cpu's runqueue lock (see thread.h). The run queue counts are
+ * read unlocked; they're only a hint.
+ */
+static
+void
+thread_wakeup_place(struct thread *t)
+{
+	struct cpu *last, *here;
+	bool inuse;
+
+	last = t->t_cpu;
+	here = curcpu->c_self;
+
+	if (last != here &&
+	    (!thread_cache_hot(t) || runqueue_count(last) >= SCHED_OVERLOAD) &&
+	    runqueue_count(here) < runqueue_count(last)) {
+		/*
+		 * The old cpu may not have finished switching away
+		 * from T yet, or may be sitting idle on T's stack (see
+		 * thread_steal). It holds its runqueue lock throughout
+		 * the former, and leaves T as c_curthread during the
+		 * latter, so check under the lock.
+		 *
+		 * t_cpu must change under that lock too, or
+		 * thread_inherit_priority could lock the old cpu, see
+		 * t_cpu still pointing at it, and go after a run queue
+		 * T is about to be put on somewhere else.
+		 */
+		spinlock_acquire(&last->c_runqueue_lock);
+		inuse = (last->c_curthread == t);
+		if (!inuse) {
+			t->t_cpu = here;
+		}
+		spinlock_release(&last->c_runqueue_lock);
+		if (!inuse) {
+			TRACE(TRACE_MIGRATE, t, last->c_number,
+			      here->c_number);
+			here->c_wake_moved++;
+			return;
+		}
+	}
+	here->c_wake_affine++;
+}
+
+/*
+ * A thread has been queued on busy cpu C. If some other cpu is idle,
+ * poke it so it wakes up and steals the thread instead of waiting for
+ * its next timer interrupt. The c_isidle flags are read without
+ * locking; a stale value just costs a spurious IPI or a missed chance.
+ */
+static
+void
+thread_kick_idle(struct cpu *c)
+{
+	struct cpu *other;
+	unsigned i, numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		other = cpuarray_get(&allcpus, i);
+		if (other != c && other->c_isidle) {
+			ipi_send(other, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
+/*
+ * If the current cpu's hardclock is deferred, bring it back to the
+ * next tick, because something has been queued that it may need to
+ * preempt for, time-slice against, or migrate. Must hold the
+ * runqueue lock.
+ */
+static
+void
+thread_tick_rearm(void)
+{
+	KASSERT(spinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	if (curcpu->c_tickless) {
+		curcpu->c_tickless = false;
+		mainbus_timer_defer(1);
+	}
+}
+
 /*
  * Make a thread runnable.
  *
@@ -466,7 +808,9 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
+	TRACE(TRACE_WAKEUP, target, targetcpu->c_number,
+	      thread_effective_priority(target));
 
 	if (targetcpu->c_isidle) {
 		/*
@@ -475,6 +819,28 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+	else {
+		/*
+		 * Target is busy, so this thread has to wait; see if
+		 * an idle cpu can take it instead.
+		 */
+		thread_kick_idle(targetcpu);
+	}
+
+	if (targetcpu->c_tickless) {
+		/*
+		 * Target's hardclock is deferred; it needs to start
+		 * ticking again now that it has something queued.
+		 * (An idle target does this itself on its way out of
+		 * the idle loop.)
+		 */
+		if (targetcpu == curcpu->c_self) {
+			thread_tick_rearm();
+		}
+		else if (!targetcpu->c_isidle) {
+			ipi_send(targetcpu, IPI_TICK);
+		}
+	}
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
@@ -500,19 +866,12 @@ thread_fork(const char *name,
 	struct thread *newthread;
 	int result;
 
-	newthread = thread_create(name);
+	/* Get a thread and stack, recycled if possible */
+	newthread = thread_get(name);
 	if (newthread == NULL) {
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
-	}
-	thread_checkstack_init(newthread);
-
 	/*
 	 * Now we clone various fields from the parent thread.
 	 */
@@ -587,8 +946,13 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing else at our priority or
+	 * better is ready, there's nothing to do; just return.
+	 */
+	if (newstate == S_READY &&
+	    !runqueue_haspriority(curcpu->c_self,
+				  thread_effective_priority(cur))) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -621,8 +985,16 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	}
 	cur->t_state = newstate;
 
+	/* Remember where and when it ran, for cache affinity. */
+	cur->t_lastcpu = curcpu->c_self;
+	cur->t_lastrun = curcpu->c_hardclocks;
+
+	/* Charge the time it ran, before we go idle. */
+	usage_charge(false);
+
 	/*
-	 * Get the next thread. While there isn't one, call md_idle().
+	 * Get the next thread. While there isn't one, try to steal one
+	 * from another cpu, and failing that call cpu_idle().
 	 * curcpu->c_isidle must be true when md_idle is
 	 * called. Unlock the runqueue while idling too, to make sure
 	 * things can be added to it.
@@ -641,14 +1013,35 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu->c_self);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			/* Look for work elsewhere before going idle. */
+			if (!thread_steal_idle()) {
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
+	thread_tick_rearm();
+
+	/*
+	 * Count the switch. Going to sleep is voluntary; staying
+	 * runnable (being preempted, or yielding) is involuntary.
+	 */
+	if (next != cur) {
+		if (newstate == S_SLEEP) {
+			cur->t_usage.u_nvcsw++;
+		}
+		else if (newstate == S_READY) {
+			cur->t_usage.u_nivcsw++;
+		}
+	}
+	usage_mark(next);
+
+	TRACE(TRACE_SWITCHOUT, cur, newstate, 0);
+	TRACE(TRACE_SWITCHIN, next, thread_effective_priority(next), 0);
 
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
@@ -794,10 +1187,13 @@ thread_exit(void)
 	cur = curthread;
 
 	/*
-	 * Detach from our process. You might need to move this action
-	 * around, depending on how your wait/exit works.
+	 * Detach from our process. User threads have already left it
+	 * (in uthread_exit or proc_exit), since once the last one is
+	 * gone the process may be destroyed.
 	 */
-	proc_remthread(cur);
+	if (cur->t_proc != NULL) {
+		proc_remthread(cur);
+	}
 
 	/* Make sure we *are* detached (move this only if you're sure!) */
 	KASSERT(cur->t_proc == NULL);
@@ -825,25 +1221,245 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multilevel feedback queue. Each cpu has SCHED_NLEVELS
+ * run queues and always runs the first thread on the highest-priority
+ * nonempty one. Threads start at the top level. A thread that uses
+ * up its whole time slice (SCHED_QUANTUM of its level, which doubles
+ * at each level down) is demoted a level by thread_tick(); a thread
+ * that sleeps on a wait channel is promoted a level when it is woken
+ * up. So cpu hogs sink to the bottom, where they get long slices, and
+ * interactive threads that mostly wait float to the top, where they
+ * preempt the hogs as soon as they become runnable.
  */
 
+/*
+ * Priority boost for a thread coming off a wait channel: move it up
+ * a level and give it a fresh time slice. The thread is not on any
+ * list at this point, so nobody else can be looking at its fields.
+ */
+static
 void
-schedule(void)
+thread_wakeup_boost(struct thread *t)
+{
+	if (t->t_priority > 0) {
+		t->t_priority--;
+	}
+	t->t_quantum = SCHED_QUANTUM(t->t_priority);
+}
+
+/*
+ * Charge the current thread for TICKS hardclocks and decide whether
+ * it should be preempted. Called from hardclock().
+ */
+bool
+thread_tick(unsigned ticks)
 {
+	struct thread *cur;
+	unsigned prio;
+	bool ret;
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * If we're idle, curthread isn't really running (it may be
+	 * asleep or a zombie), so don't charge it.
 	 */
+	if (curcpu->c_isidle) {
+		return false;
+	}
+
+	cur = curthread;
+	KASSERT(cur->t_quantum > 0);
+	if (ticks < cur->t_quantum) {
+		cur->t_quantum -= ticks;
+	}
+	else {
+		/* Used up its time slice; demote it. */
+		if (cur->t_priority < SCHED_NLEVELS - 1) {
+			cur->t_priority++;
+		}
+		cur->t_quantum = SCHED_QUANTUM(cur->t_priority);
+
+		/*
+		 * If there's nothing else to run, thread_yield would
+		 * just switch back to us, so don't bother.
+		 */
+		spinlock_acquire(&curcpu->c_runqueue_lock);
+		ret = runqueue_count(curcpu->c_self) > 0;
+		spinlock_release(&curcpu->c_runqueue_lock);
+		if (!ret) {
+			curcpu->c_yields_skipped++;
+		}
+		return ret;
+	}
+
+	prio = thread_effective_priority(cur);
+	if (prio == 0) {
+		return false;
+	}
+
+	/* Preempt if something better has become runnable. */
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	ret = runqueue_haspriority(curcpu->c_self, prio - 1);
+	spinlock_release(&curcpu->c_runqueue_lock);
+	return ret;
+}
+
+/*
+ * Tickless operation.
+ *
+ * A cpu with nothing on its run queue has no use for hardclock: there
+ * is nobody to preempt for, nothing to time-slice against, and
+ * nothing for anyone to migrate. So at the end of such a hardclock
+ * thread_tick_defer pushes the next timer interrupt back, by
+ * IDLETICKS if the cpu is idle and BUSYTICKS if one thread is
+ * running. As soon as anything is queued on the cpu,
+ * thread_make_runnable (via IPI_TICK if need be) brings the tick back
+ * with thread_tick_rearm.
+ *
+ * When the deferred hardclock happens, thread_tick_resume works out
+ * from timer_now() how many ticks were skipped, so that the caller
+ * can catch up on time slices and periodic work.
+ *
+ * cpu 0 always ticks, because it drives the timer wheel (and with it
+ * timer_now()).
+ */
+
+/*
+ * Called at the start of hardclock(). Returns the number of ticks
+ * since the last hardclock on this cpu, which is 1 unless the tick
+ * was deferred.
+ */
+unsigned
+thread_tick_resume(void)
+{
+	uint64_t since;
+	unsigned ticks;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	curcpu->c_tickless = false;
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	since = curcpu->c_tickless_since;
+	if (since == 0) {
+		return 1;
+	}
+	curcpu->c_tickless_since = 0;
+
+	ticks = timer_now() - since;
+	if (ticks == 0) {
+		/* re-armed before cpu 0 ticked */
+		ticks = 1;
+	}
+	curcpu->c_ticks_skipped += ticks - 1;
+	return ticks;
+}
+
+/*
+ * Called at the end of hardclock() (when not yielding). If the run
+ * queue is empty, defer the next hardclock.
+ */
+void
+thread_tick_defer(unsigned idleticks, unsigned busyticks)
+{
+	uint64_t now;
+
+	if (curcpu->c_number == 0) {
+		return;
+	}
+	now = timer_now();
+	if (now == 0) {
+		/* too early; can't tell how long we slept */
+		return;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	if (runqueue_count(curcpu->c_self) == 0) {
+		curcpu->c_tickless = true;
+		curcpu->c_tickless_since = now;
+		mainbus_timer_defer(curcpu->c_isidle ? idleticks : busyticks);
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+}
+
+/*
+ * The priority a thread is scheduled at: its own, or the one it has
+ * inherited from threads waiting for its locks, whichever is better.
+ */
+unsigned
+thread_effective_priority(struct thread *t)
+{
+	return t->t_inherit < t->t_priority ? t->t_inherit : t->t_priority;
+}
+
+/*
+ * Set the priority T inherits. If T is sitting on a run queue, it has
+ * to move to the queue for its new effective priority. A thread on
+ * its way from one cpu to another (see thread_steal) is on no queue,
+ * and goes on the right one when it arrives.
+ */
+void
+thread_inherit_priority(struct thread *t, unsigned prio)
+{
+	struct cpu *c;
+	unsigned old;
+
+	KASSERT(prio <= SCHED_NLEVELS);
+
+	/* t_cpu can change until we hold its runqueue lock. */
+	while (1) {
+		c = t->t_cpu;
+		KASSERT(c != NULL);
+		spinlock_acquire(&c->c_runqueue_lock);
+		if (t->t_cpu == c) {
+			break;
+		}
+		spinlock_release(&c->c_runqueue_lock);
+	}
+
+	old = thread_effective_priority(t);
+	t->t_inherit = prio;
+	if (t->t_state == S_READY && t->t_listnode.tln_next != NULL &&
+	    thread_effective_priority(t) != old) {
+		threadlist_remove(&c->c_runqueue[old], t);
+		runqueue_add(c, t);
+	}
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+/*
+ * This is called periodically from hardclock(). It does the periodic
+ * anti-starvation boost: everything on the current CPU's run queues
+ * goes back to the top level. Otherwise a steady supply of
+ * interactive threads could keep the bottom level from ever running.
+ */
+void
+schedule(void)
+{
+	struct thread *t;
+	unsigned i;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=1; i<SCHED_NLEVELS; i++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[i])) != NULL) {
+			t->t_priority = 0;
+			t->t_quantum = SCHED_QUANTUM(0);
+			threadlist_addtail(&curcpu->c_runqueue[0], t);
+		}
+	}
+	if (!curcpu->c_isidle) {
+		curthread->t_priority = 0;
+		curthread->t_quantum = SCHED_QUANTUM(0);
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
 }
 
 /*
  * Thread migration.
  *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
+ * Load is balanced by pulling rather than pushing: a cpu that runs out
+ * of work steals a ready thread from some other cpu's run queue before
+ * it goes idle (see thread_switch), and a cpu that is merely less
+ * loaded than its neighbours pulls from them periodically from
+ * hardclock(). Neither needs to look at every cpu's run queue.
  *
  * Migrating threads isn't free because of cache affinity; a thread's
  * working cache set will end up having to be moved to the other CPU,
@@ -855,109 +1471,213 @@ schedule(void)
  * System/161 does not (yet) model such cache effects, we'll be very
  * aggressive.
  */
-void
-thread_consider_migration(void)
+
+/*
+ * Cheap per-cpu pseudo-random numbers (xorshift) for picking steal
+ * victims. Nothing here needs to be unpredictable, just not always
+ * the same, and random() is far too expensive to call from the idle
+ * loop.
+ */
+static
+uint32_t
+cpu_random(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
-	struct thread *t;
+	uint32_t x;
+
+	x = curcpu->c_randseed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	curcpu->c_randseed = x;
+	return x;
+}
+
+/*
+ * Choose a cpu to steal from: look at two other cpus chosen at random
+ * and take whichever has more ready threads. This finds a busy cpu
+ * nearly as reliably as scanning all of them, without every idle cpu
+ * converging on the same victim. The counts are read without the
+ * runqueue locks; they're only a hint and the stealer rechecks them.
+ *
+ * Returns NULL if no other cpu has anything ready.
+ */
+static
+struct cpu *
+thread_pick_victim(void)
+{
+	struct cpu *c, *best;
+	unsigned i, n, numcpus, count, bestcount;
 
-	my_count = total_count = 0;
 	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
-		}
-		spinlock_release(&c->c_runqueue_lock);
+	if (numcpus < 2) {
+		return NULL;
 	}
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
-		return;
+	best = NULL;
+	bestcount = 0;
+	for (i=0; i<2; i++) {
+		/* pick among the other numcpus-1 cpus */
+		n = cpu_random() % (numcpus - 1);
+		if (n >= curcpu->c_number) {
+			n++;
+		}
+		c = cpuarray_get(&allcpus, n);
+		count = runqueue_count(c);
+		if (count > bestcount) {
+			best = c;
+			bestcount = count;
+		}
 	}
+	return best;
+}
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+/*
+ * Take one ready thread from cpu VICTIM and put it on our own run
+ * queue, provided VICTIM still has at least MINLOAD ready threads.
+ * Returns true if a thread was moved.
+ *
+ * Must be called without holding any runqueue lock; we only ever hold
+ * one at a time here, so there's no lock ordering issue between cpus.
+ */
+static
+bool
+thread_steal(struct cpu *victim, unsigned minload)
+{
+	struct thread *t;
+	unsigned i;
+
+	KASSERT(victim != curcpu->c_self);
+	KASSERT(minload > 0);
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	if (runqueue_count(victim) < minload) {
+		spinlock_release(&victim->c_runqueue_lock);
+		return false;
 	}
-	spinlock_release(&curcpu->c_runqueue_lock);
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
+	/*
+	 * Take the cache-cold thread that would otherwise run last,
+	 * searching from the back of the lowest-priority queue.
+	 * Threads that are still cache-hot are left where they are;
+	 * they'll go cold soon enough if the victim doesn't get to
+	 * them.
+	 *
+	 * Ordinarily, the victim's curthread will not appear on its
+	 * run queue. However, it can under the following
+	 * circumstances:
+	 *   - it went to sleep;
+	 *   - the processor became idle, so it remained curthread;
+	 *   - it was reawakened, so it was put on the run queue;
+	 *   - and the processor hasn't fully unidled yet, so all
+	 *     these things are still true.
+	 *
+	 * The victim is still running on that thread's stack, so
+	 * stealing it would be disastrous. Skip it; the victim will
+	 * be running it momentarily anyway.
+	 */
+	for (i=SCHED_NLEVELS; i-- > 0; ) {
+		THREADLIST_FORALL_REV(t, victim->c_runqueue[i]) {
+			if (t == victim->c_curthread) {
 				continue;
 			}
-
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
+			if (thread_cache_hot(t)) {
+				curcpu->c_steal_hot++;
+				continue;
 			}
+			goto found;
 		}
-		spinlock_release(&c->c_runqueue_lock);
 	}
+	spinlock_release(&victim->c_runqueue_lock);
+	return false;
+
+ found:
+	threadlist_remove(&victim->c_runqueue[i], t);
+	curcpu->c_steal_cold++;
+	t->t_cpu = curcpu->c_self;
+	spinlock_release(&victim->c_runqueue_lock);
+	TRACE(TRACE_MIGRATE, t, victim->c_number, curcpu->c_number);
+
+	DEBUG(DB_THREADS, "Migrated thread %s: cpu %u -> %u",
+	      t->t_name, victim->c_number, curcpu->c_number);
 
 	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
+	 * The thread is on no list at all until we add it here, so
+	 * nobody else can find it in the meantime.
 	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
-		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	runqueue_add(curcpu->c_self, t);
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	return true;
+}
+
+/*
+ * Called from the idle loop in thread_switch, with no runqueue lock
+ * held, when the current cpu has nothing to run. Returns true if it
+ * found something.
+ */
+static
+bool
+thread_steal_idle(void)
+{
+	struct cpu *victim;
+
+	victim = thread_pick_victim();
+	if (victim == NULL) {
+		return false;
+	}
+	return thread_steal(victim, 1);
+}
+
+/*
+ * This is called periodically from hardclock(). If some other cpu
+ * (chosen at random) has at least two more threads than we do,
+ * counting the one running, pull one over. Idle cpus do this on their
+ * own as soon as they run out of work; this covers the case of cpus
+ * that are busy, just less so.
+ */
+void
+thread_consider_migration(void)
+{
+	struct cpu *victim;
+	unsigned mine;
+
+	victim = thread_pick_victim();
+	if (victim == NULL) {
+		return;
 	}
 
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+	/* unlocked read; just a hint */
+	mine = runqueue_count(curcpu->c_self);
+	if (!curcpu->c_isidle) {
+		mine++;
+	}
+	thread_steal(victim, mine + 1);
+}
+
+/*
+ * Print the placement, migration, and tickless counters for each cpu.
+ */
+void
+thread_printstats(void)
+{
+	struct cpu *c;
+	unsigned i;
+
+	kprintf("cpu   wake-affine   wake-moved   steal-cold    steal-hot\n");
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		kprintf("%3u  %12u %12u %12u %12u\n", c->c_number,
+			c->c_wake_affine, c->c_wake_moved,
+			c->c_steal_cold, c->c_steal_hot);
+	}
+	kprintf("\ncpu     hardclocks  ticks-skipped yields-skipped  migr-skipped\n");
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		kprintf("%3u  %13u  %13u  %13u %13u\n", c->c_number,
+			c->c_hardclocks, c->c_ticks_skipped,
+			c->c_yields_skipped, c->c_migrations_skipped);
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -1051,6 +1771,84 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 	spinlock_acquire(lk);
 }
 
+/*
+ * State for a timed wchan sleep, shared between the sleeper and its
+ * timer. Lives on the sleeper's stack.
+ */
+struct wchan_timeout {
+	struct wchan *wt_wc;
+	struct spinlock *wt_lk;
+	struct thread *wt_thread;
+	bool wt_timedout;		/* timer woke the thread */
+};
+
+/*
+ * Timer function for wchan_sleep_until. Wake the sleeper, if it's
+ * still asleep; if it's not on the channel's list any more, someone
+ * else already woke it up.
+ */
+static
+void
+wchan_timeout(void *data)
+{
+	struct wchan_timeout *wt = data;
+	struct thread *t;
+
+	spinlock_acquire(wt->wt_lk);
+	THREADLIST_FORALL(t, wt->wt_wc->wc_threads) {
+		if (t == wt->wt_thread) {
+			break;
+		}
+	}
+	if (t != NULL) {
+		threadlist_remove(&wt->wt_wc->wc_threads, t);
+		wt->wt_timedout = true;
+		/* As in wchan_wakeone. */
+		thread_wakeup_boost(t);
+		thread_wakeup_place(t);
+		thread_make_runnable(t, false);
+	}
+	spinlock_release(wt->wt_lk);
+}
+
+int
+wchan_sleep_until(struct wchan *wc, struct spinlock *lk, uint64_t deadline)
+{
+	struct wchan_timeout wt;
+	struct timer timer;
+
+	KASSERT(!curthread->t_in_interrupt);
+	KASSERT(spinlock_do_i_hold(lk));
+	KASSERT(curcpu->c_spinlocks == 1);
+
+	if (deadline <= timer_now()) {
+		return ETIMEDOUT;
+	}
+
+	wt.wt_wc = wc;
+	wt.wt_lk = lk;
+	wt.wt_thread = curthread;
+	wt.wt_timedout = false;
+	timer_init(&timer, wchan_timeout, &wt);
+
+	/*
+	 * Start the timer while holding LK, so it can't go off and
+	 * miss us before we're on the list.
+	 */
+	timer_start(&timer, deadline);
+	thread_switch(S_SLEEP, wc, lk);
+
+	/*
+	 * Stop the timer before relocking LK: timer_stop waits for
+	 * wchan_timeout if it's running, and that needs LK. After
+	 * this, wt_timedout can't change.
+	 */
+	timer_stop(&timer);
+	spinlock_acquire(lk);
+
+	return wt.wt_timedout ? ETIMEDOUT : 0;
+}
+
 /*
  * Wake up one thread sleeping on a wait channel.
  */
@@ -1077,6 +1875,8 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 	 * in thread_switch.
 	 */
 
+	thread_wakeup_boost(target);
+	thread_wakeup_place(target);
 	thread_make_runnable(target, false);
 }
 
@@ -1107,6 +1907,8 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
+		thread_wakeup_boost(target);
+		thread_wakeup_place(target);
 		thread_make_runnable(target, false);
 	}
 
@@ -1142,6 +1944,7 @@ ipi_send(struct cpu *target, int code)
 {
 	KASSERT(code >= 0 && code < 32);
 
+	TRACE(TRACE_IPI, curthread, target->c_number, code);
 	spinlock_acquire(&target->c_ipi_lock);
 	target->c_ipi_pending |= (uint32_t)1 << code;
 	mainbus_send_ipi(target);
@@ -1230,4 +2033,15 @@ interprocessor_interrupt(void)
 
 	curcpu->c_ipi_pending = 0;
 	spinlock_release(&curcpu->c_ipi_lock);
+
+	/*
+	 * This needs the runqueue lock, which the sender may be
+	 * holding while it waits for our IPI lock, so wait until
+	 * that's been released.
+	 */
+	if (bits & (1U << IPI_TICK)) {
+		spinlock_acquire(&curcpu->c_runqueue_lock);
+		thread_tick_rearm();
+		spinlock_release(&curcpu->c_runqueue_lock);
+	}
 }
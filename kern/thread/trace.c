@@ -0,0 +1,419 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Scheduler event tracing. See trace.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <clock.h>
+#include <spl.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <trace.h>
+
+/*
+ * A copy of one cpu's ring, oldest first.
+ */
+struct trace_copy {
+	struct trace_record *tcp_records;
+	unsigned tcp_count;		/* records held */
+	unsigned tcp_lost;		/* older ones overwritten */
+	unsigned tcp_next;		/* cursor, for merging */
+};
+
+/* Whether to record events; off until turned on from the menu. */
+static volatile bool trace_enabled;
+
+static const char *const trace_names[TRACE_NTYPES] = {
+	"none",
+	"switch-out",
+	"switch-in",
+	"wakeup",
+	"migrate",
+	"ipi",
+	"syscall",
+	"sysret",
+};
+
+/* Thread states, for switch-out; see threadstate_t. */
+#define TRACE_NSTATES 4
+static const char *const trace_states[TRACE_NSTATES] = {
+	"run",
+	"ready",
+	"sleep",
+	"zombie",
+};
+
+void
+trace_setenabled(bool on)
+{
+	trace_enabled = on;
+}
+
+void
+trace_cpu_init(struct tracebuf *tb)
+{
+	KASSERT((TRACE_NRECORDS & (TRACE_NRECORDS - 1)) == 0);
+
+	tb->tb_records = kmalloc(TRACE_NRECORDS * sizeof(*tb->tb_records));
+	if (tb->tb_records == NULL) {
+		panic("trace_cpu_init: Out of memory\n");
+	}
+	bzero(tb->tb_records, TRACE_NRECORDS * sizeof(*tb->tb_records));
+	tb->tb_head = 0;
+}
+
+////////////////////////////////////////////////////////////
+// Recording
+
+void
+trace_event(unsigned type, const void *thread, uint32_t a, uint32_t b)
+{
+	struct trace_record *tr;
+	struct tracebuf *tb;
+	struct timespec ts;
+	int spl;
+
+	if (!trace_enabled) {
+		return;
+	}
+
+	/* Interrupts off, so nothing else on this cpu can get in. */
+	spl = splhigh();
+	tb = &curcpu->c_trace;
+	tr = &tb->tb_records[tb->tb_head & (TRACE_NRECORDS - 1)];
+	tb->tb_head++;
+
+	gettime(&ts);
+	tr->tr_sec = ts.tv_sec;
+	tr->tr_nsec = ts.tv_nsec;
+	tr->tr_type = type;
+	tr->tr_cpu = curcpu->c_number;
+	tr->tr_thread = (uint32_t)(uintptr_t)thread;
+	tr->tr_a = a;
+	tr->tr_b = b;
+	splx(spl);
+}
+
+////////////////////////////////////////////////////////////
+// Reading
+
+/*
+ * Copy every cpu's ring. Returns an array of cpu_count() copies, or
+ * NULL if out of memory.
+ *
+ * Tracing is stopped while copying, so the copies line up with each
+ * other; records a cpu was in the middle of writing may be torn.
+ */
+static
+struct trace_copy *
+trace_copyall(void)
+{
+	struct trace_copy *all;
+	struct tracebuf *tb;
+	unsigned numcpus, i, j, head, start;
+	bool was;
+
+	numcpus = cpu_count();
+	all = kmalloc(numcpus * sizeof(*all));
+	if (all == NULL) {
+		return NULL;
+	}
+	for (i=0; i<numcpus; i++) {
+		all[i].tcp_records = kmalloc(TRACE_NRECORDS *
+					     sizeof(struct trace_record));
+		if (all[i].tcp_records == NULL) {
+			while (i-- > 0) {
+				kfree(all[i].tcp_records);
+			}
+			kfree(all);
+			return NULL;
+		}
+	}
+
+	was = trace_enabled;
+	trace_enabled = false;
+	for (i=0; i<numcpus; i++) {
+		tb = &cpu_get(i)->c_trace;
+		head = tb->tb_head;
+		all[i].tcp_count = head < TRACE_NRECORDS ?
+			head : TRACE_NRECORDS;
+		all[i].tcp_lost = head - all[i].tcp_count;
+		all[i].tcp_next = 0;
+		start = head - all[i].tcp_count;
+		for (j=0; j<all[i].tcp_count; j++) {
+			all[i].tcp_records[j] =
+				tb->tb_records[(start + j) &
+					       (TRACE_NRECORDS - 1)];
+		}
+	}
+	trace_enabled = was;
+
+	return all;
+}
+
+static
+void
+trace_freeall(struct trace_copy *all)
+{
+	unsigned i, numcpus;
+
+	numcpus = cpu_count();
+	for (i=0; i<numcpus; i++) {
+		kfree(all[i].tcp_records);
+	}
+	kfree(all);
+}
+
+/*
+ * Return the cpu whose next unread record is oldest, or -1 if all
+ * have been read.
+ */
+static
+int
+trace_oldest(struct trace_copy *all, unsigned numcpus)
+{
+	const struct trace_record *tr, *best;
+	unsigned i;
+	int which;
+
+	best = NULL;
+	which = -1;
+	for (i=0; i<numcpus; i++) {
+		if (all[i].tcp_next == all[i].tcp_count) {
+			continue;
+		}
+		tr = &all[i].tcp_records[all[i].tcp_next];
+		if (best == NULL || tr->tr_sec < best->tr_sec ||
+		    (tr->tr_sec == best->tr_sec &&
+		     tr->tr_nsec < best->tr_nsec)) {
+			best = tr;
+			which = i;
+		}
+	}
+	return which;
+}
+
+/*
+ * Print one record. BASE is the time of the first one printed.
+ */
+static
+void
+trace_printone(const struct trace_record *tr, const struct timespec *base)
+{
+	struct timespec ts, diff;
+	const char *name;
+
+	ts.tv_sec = tr->tr_sec;
+	ts.tv_nsec = tr->tr_nsec;
+	timespec_sub(&ts, base, &diff);
+	name = tr->tr_type < TRACE_NTYPES ? trace_names[tr->tr_type] : "?";
+
+	kprintf("%6llu.%06lu cpu%-2u %-10s 0x%08x ",
+		(unsigned long long)diff.tv_sec,
+		(unsigned long)(diff.tv_nsec / 1000),
+		tr->tr_cpu, name, tr->tr_thread);
+	switch (tr->tr_type) {
+	    case TRACE_SWITCHOUT:
+		kprintf("%s\n", tr->tr_a < TRACE_NSTATES ?
+			trace_states[tr->tr_a] : "?");
+		break;
+	    case TRACE_SWITCHIN:
+		kprintf("prio %u\n", tr->tr_a);
+		break;
+	    case TRACE_WAKEUP:
+		kprintf("on cpu%u, prio %u\n", tr->tr_a, tr->tr_b);
+		break;
+	    case TRACE_MIGRATE:
+		kprintf("cpu%u -> cpu%u\n", tr->tr_a, tr->tr_b);
+		break;
+	    case TRACE_IPI:
+		kprintf("to cpu%u, code %u\n", tr->tr_a, tr->tr_b);
+		break;
+	    case TRACE_SYSCALL:
+		kprintf("call %u\n", tr->tr_a);
+		break;
+	    case TRACE_SYSRET:
+		kprintf("call %u, error %u\n", tr->tr_a, tr->tr_b);
+		break;
+	    default:
+		kprintf("%u %u\n", tr->tr_a, tr->tr_b);
+		break;
+	}
+}
+
+void
+trace_print(unsigned n)
+{
+	struct trace_copy *all;
+	struct timespec base;
+	const struct trace_record *tr;
+	unsigned numcpus, total, skip, i;
+	int which;
+
+	all = trace_copyall();
+	if (all == NULL) {
+		kprintf("trace: Out of memory\n");
+		return;
+	}
+	numcpus = cpu_count();
+
+	total = 0;
+	for (i=0; i<numcpus; i++) {
+		total += all[i].tcp_count;
+		if (all[i].tcp_lost > 0) {
+			kprintf("cpu%u: %u older events overwritten\n",
+				i, all[i].tcp_lost);
+		}
+	}
+	skip = total > n ? total - n : 0;
+
+	base.tv_sec = 0;
+	base.tv_nsec = 0;
+	while ((which = trace_oldest(all, numcpus)) >= 0) {
+		tr = &all[which].tcp_records[all[which].tcp_next++];
+		if (skip > 0) {
+			skip--;
+			continue;
+		}
+		if (base.tv_sec == 0 && base.tv_nsec == 0) {
+			base.tv_sec = tr->tr_sec;
+			base.tv_nsec = tr->tr_nsec;
+		}
+		trace_printone(tr, &base);
+	}
+	if (!trace_enabled) {
+		kprintf("(tracing is off; \"tr on\" turns it on)\n");
+	}
+
+	trace_freeall(all);
+}
+
+/*
+ * Write LEN bytes from BUF to VN at *POS, advancing *POS.
+ */
+static
+int
+trace_write(struct vnode *vn, off_t *pos, void *buf, size_t len)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, buf, len, *pos, UIO_WRITE);
+	result = VOP_WRITE(vn, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid > 0) {
+		return ENOSPC;
+	}
+	*pos = ku.uio_offset;
+	return 0;
+}
+
+int
+trace_dump(const char *path)
+{
+	struct trace_copy *all;
+	struct trace_header th;
+	struct trace_cpuheader tc;
+	struct vnode *vn;
+	char *name;
+	unsigned numcpus, i;
+	off_t pos;
+	int result;
+
+	all = trace_copyall();
+	if (all == NULL) {
+		return ENOMEM;
+	}
+	numcpus = cpu_count();
+
+	/* vfs_open destroys the string it's passed */
+	name = kstrdup(path);
+	if (name == NULL) {
+		trace_freeall(all);
+		return ENOMEM;
+	}
+	result = vfs_open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664, &vn);
+	kfree(name);
+	if (result) {
+		trace_freeall(all);
+		return result;
+	}
+
+	pos = 0;
+	th.th_magic = TRACE_MAGIC;
+	th.th_version = TRACE_VERSION;
+	th.th_ncpus = numcpus;
+	th.th_nrecords = TRACE_NRECORDS;
+	result = trace_write(vn, &pos, &th, sizeof(th));
+	for (i=0; i<numcpus && result == 0; i++) {
+		tc.tc_cpu = i;
+		tc.tc_count = all[i].tcp_count;
+		tc.tc_lost = all[i].tcp_lost;
+		result = trace_write(vn, &pos, &tc, sizeof(tc));
+		if (result == 0 && tc.tc_count > 0) {
+			result = trace_write(vn, &pos, all[i].tcp_records,
+				tc.tc_count * sizeof(struct trace_record));
+		}
+	}
+
+	vfs_close(vn);
+	trace_freeall(all);
+	return result;
+}
+
+/*
+ * Empty the rings. Tracing is stopped meanwhile so no cpu is writing
+ * its ring as it's reset.
+ */
+void
+trace_reset(void)
+{
+	unsigned i, numcpus;
+	bool was;
+
+	was = trace_enabled;
+	trace_enabled = false;
+	numcpus = cpu_count();
+	for (i=0; i<numcpus; i++) {
+		cpu_get(i)->c_trace.tb_head = 0;
+	}
+	trace_enabled = was;
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Resource usage accounting. See usage.h.
+ */
+
+#include <types.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <current.h>
+#include <usage.h>
+
+/* Whether the clock can be read yet. */
+static volatile bool usage_clockok;
+
+/* Whether time is charged by the clock rather than by ticks. */
+static volatile bool usage_clocked;
+
+/*
+ * Bumped each time clock charging is turned on, so that marks left
+ * over from the last time it was on aren't charged.
+ */
+static volatile unsigned usage_clockgen;
+
+void
+usage_bootstrap(void)
+{
+	usage_clockok = true;
+}
+
+void
+usage_setclocked(bool on)
+{
+	if (on && !usage_clocked) {
+		usage_clockgen++;
+	}
+	usage_clocked = on;
+}
+
+void
+usage_init(struct usage *u)
+{
+	bzero(u, sizeof(*u));
+}
+
+void
+usage_add(struct usage *to, const struct usage *from)
+{
+	timespec_add(&to->u_utime, &from->u_utime, &to->u_utime);
+	timespec_add(&to->u_stime, &from->u_stime, &to->u_stime);
+	to->u_minflt += from->u_minflt;
+	to->u_nvcsw += from->u_nvcsw;
+	to->u_nivcsw += from->u_nivcsw;
+	to->u_nsyscalls += from->u_nsyscalls;
+	to->u_inbytes += from->u_inbytes;
+	to->u_outbytes += from->u_outbytes;
+}
+
+void
+usage_export(const struct usage *u, struct rusage *ru)
+{
+	bzero(ru, sizeof(*ru));
+	ru->ru_utime.tv_sec = u->u_utime.tv_sec;
+	ru->ru_utime.tv_usec = u->u_utime.tv_nsec / 1000;
+	ru->ru_stime.tv_sec = u->u_stime.tv_sec;
+	ru->ru_stime.tv_usec = u->u_stime.tv_nsec / 1000;
+	/* There's no paging to disk, so every fault is a minor one. */
+	ru->ru_minflt = u->u_minflt;
+	ru->ru_nvcsw = u->u_nvcsw;
+	ru->ru_nivcsw = u->u_nivcsw;
+	ru->ru_nsyscalls = u->u_nsyscalls;
+	ru->ru_inbytes = u->u_inbytes;
+	ru->ru_outbytes = u->u_outbytes;
+}
+
+void
+usage_tick(unsigned ticks)
+{
+	struct thread *cur;
+	struct timespec ts;
+	struct timespec *bucket;
+
+	/* Idle cpus don't tick, so what's caught up on was mostly idle. */
+	if (usage_clocked || curcpu->c_isidle) {
+		return;
+	}
+
+	cur = curthread;
+	ts.tv_sec = ticks / HZ;
+	ts.tv_nsec = (ticks % HZ) * (1000000000 / HZ);
+	bucket = curcpu->c_intr_user ?
+		&cur->t_usage.u_utime : &cur->t_usage.u_stime;
+	timespec_add(bucket, &ts, bucket);
+}
+
+void
+usage_charge(bool user)
+{
+	struct thread *cur;
+	struct timespec now, diff;
+	struct timespec *bucket;
+	unsigned gen;
+
+	if (!usage_clockok || !usage_clocked) {
+		return;
+	}
+
+	cur = curthread;
+	gen = usage_clockgen;
+	gettime(&now);
+	if (cur->t_usagegen == gen) {
+		timespec_sub(&now, &cur->t_usagemark, &diff);
+		bucket = user ? &cur->t_usage.u_utime : &cur->t_usage.u_stime;
+		timespec_add(bucket, &diff, bucket);
+	}
+	cur->t_usagemark = now;
+	cur->t_usagegen = gen;
+}
+
+void
+usage_mark(struct thread *t)
+{
+	if (!usage_clockok || !usage_clocked) {
+		return;
+	}
+	gettime(&t->t_usagemark);
+	t->t_usagegen = usage_clockgen;
+}
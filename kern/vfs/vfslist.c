@@ -43,6 +43,7 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <execcache.h>
 
 /*
  * Structure for a single named device.
@@ -87,6 +88,15 @@ DEFARRAY(knowndev, static __UNUSED inline);
 
 static struct knowndevarray *knowndevs;
 
+/*
+ * Lock for the knowndevs table (the array itself and each kd_fs).
+ * Changing the table requires both the big lock and this lock held
+ * for writing; looking things up requires either one, so lookups that
+ * don't otherwise need the big lock (vfs_getdevname) can proceed in
+ * parallel.
+ */
+static struct rwlock *knowndevs_rwlock;
+
 /* The big lock for all FS ops. Remove for filesystem assignment. */
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
@@ -107,6 +117,11 @@ vfs_bootstrap(void)
 	if (vfs_biglock==NULL) {
 		panic("vfs: Could not create vfs big lock\n");
 	}
+
+	knowndevs_rwlock = rwlock_create("knowndevs");
+	if (knowndevs_rwlock==NULL) {
+		panic("vfs: Could not create knowndevs lock\n");
+	}
 	vfs_biglock_depth = 0;
 
 	devnull_create();
@@ -179,9 +194,14 @@ vfs_getroot(const char *devname, struct vnode **result)
 {
 	struct knowndev *kd;
 	unsigned i, num;
+	int err;
 
+	/* FSOP_GETROOT needs the big lock */
 	KASSERT(vfs_biglock_do_i_hold());
 
+	rwlock_acquire_read(knowndevs_rwlock);
+	err = ENODEV;
+
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = knowndevarray_get(knowndevs, i);
@@ -202,13 +222,15 @@ vfs_getroot(const char *devname, struct vnode **result)
 			if (!strcmp(kd->kd_name, devname) ||
 			    (volname!=NULL && !strcmp(volname, devname))) {
 				*result = FSOP_GETROOT(kd->kd_fs);
-				return 0;
+				err = 0;
+				goto done;
 			}
 		}
 		else {
 			if (kd->kd_rawname!=NULL &&
 			    !strcmp(kd->kd_name, devname)) {
-				return ENXIO;
+				err = ENXIO;
+				goto done;
 			}
 		}
 
@@ -223,7 +245,8 @@ vfs_getroot(const char *devname, struct vnode **result)
 			KASSERT(kd->kd_device != NULL);
 			VOP_INCREF(kd->kd_vnode);
 			*result = kd->kd_vnode;
-			return 0;
+			err = 0;
+			goto done;
 		}
 
 		/*
@@ -234,7 +257,8 @@ vfs_getroot(const char *devname, struct vnode **result)
 			KASSERT(kd->kd_device != NULL);
 			VOP_INCREF(kd->kd_vnode);
 			*result = kd->kd_vnode;
-			return 0;
+			err = 0;
+			goto done;
 		}
 
 		/*
@@ -245,10 +269,13 @@ vfs_getroot(const char *devname, struct vnode **result)
 	}
 
 	/*
-	 * If we got here, the device specified by devname doesn't exist.
+	 * If we got here, the device specified by devname doesn't
+	 * exist, and err is still ENODEV.
 	 */
 
-	return ENODEV;
+ done:
+	rwlock_release_read(knowndevs_rwlock);
+	return err;
 }
 
 /*
@@ -262,7 +289,7 @@ vfs_getdevname(struct fs *fs)
 
 	KASSERT(fs != NULL);
 
-	KASSERT(vfs_biglock_do_i_hold());
+	rwlock_acquire_read(knowndevs_rwlock);
 
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
@@ -275,10 +302,12 @@ vfs_getdevname(struct fs *fs)
 			 * the fs cannot go away, and the device can't
 			 * go away until the fs goes away.
 			 */
+			rwlock_release_read(knowndevs_rwlock);
 			return kd->kd_name;
 		}
 	}
 
+	rwlock_release_read(knowndevs_rwlock);
 	return NULL;
 }
 
@@ -412,12 +441,16 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		volname = FSOP_GETVOLNAME(fs);
 	}
 
+	rwlock_acquire_write(knowndevs_rwlock);
+
 	if (badnames(name, rawname, volname)) {
+		rwlock_release_write(knowndevs_rwlock);
 		vfs_biglock_release();
 		return EEXIST;
 	}
 
 	result = knowndevarray_add(knowndevs, kd, &index);
+	rwlock_release_write(knowndevs_rwlock);
 
 	if (result == 0 && dev != NULL) {
 		/* use index+1 as the device number, so 0 is reserved */
@@ -471,7 +504,7 @@ vfs_addfs(const char *devname, struct fs *fs)
 
 /*
  * Look for a mountable device named DEVNAME.
- * Should already hold knowndevs_lock.
+ * Should already hold the big lock, which keeps the table from changing.
  */
 static
 int
@@ -538,7 +571,9 @@ vfs_mount(const char *devname, void *data,
 
 	KASSERT(fs != NULL);
 
+	rwlock_acquire_write(knowndevs_rwlock);
 	kd->kd_fs = fs;
+	rwlock_release_write(knowndevs_rwlock);
 
 	volname = FSOP_GETVOLNAME(fs);
 	kprintf("vfs: Mounted %s: on %s\n",
@@ -572,6 +607,9 @@ vfs_unmount(const char *devname)
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+	/* cached programs hold their files open */
+	execcache_flush();
+
 	/* sync the fs */
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
@@ -586,7 +624,9 @@ vfs_unmount(const char *devname)
 	kprintf("vfs: Unmounted %s:\n", kd->kd_name);
 
 	/* now drop the filesystem */
+	rwlock_acquire_write(knowndevs_rwlock);
 	kd->kd_fs = NULL;
+	rwlock_release_write(knowndevs_rwlock);
 
 	KASSERT(result==0);
 
@@ -607,6 +647,9 @@ vfs_unmountall(void)
 
 	vfs_biglock_acquire();
 
+	/* cached programs hold their files open */
+	execcache_flush();
+
 	num = knowndevarray_num(knowndevs);
 	for (i=0; i<num; i++) {
 		dev = knowndevarray_get(knowndevs, i);
@@ -653,7 +696,9 @@ vfs_unmountall(void)
 		}
 
 		/* now drop the filesystem */
+		rwlock_acquire_write(knowndevs_rwlock);
 		dev->kd_fs = NULL;
+		rwlock_release_write(knowndevs_rwlock);
 	}
 
 	vfs_biglock_release();
@@ -50,6 +50,7 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	vn->vn_ops = ops;
 	vn->vn_refcount = 1;
 	spinlock_init(&vn->vn_countlock);
+	vn->vn_gen = 0;
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
 	return 0;
@@ -122,6 +123,62 @@ vnode_decref(struct vnode *vn)
 	}
 }
 
+/*
+ * Note that the file has changed.
+ */
+static
+void
+vnode_modified(struct vnode *vn)
+{
+	spinlock_acquire(&vn->vn_countlock);
+	vn->vn_gen++;
+	spinlock_release(&vn->vn_countlock);
+}
+
+/*
+ * Write, then note the change.
+ * Called by VOP_WRITE.
+ */
+int
+vnode_write(struct vnode *vn, struct uio *uio)
+{
+	int result;
+
+	result = __VOP(vn, write)(vn, uio);
+	vnode_modified(vn);
+	return result;
+}
+
+/*
+ * Truncate, then note the change.
+ * Called by VOP_TRUNCATE.
+ */
+int
+vnode_truncate(struct vnode *vn, off_t pos)
+{
+	int result;
+
+	result = __VOP(vn, truncate)(vn, pos);
+	vnode_modified(vn);
+	return result;
+}
+
+/*
+ * Get the modification generation.
+ */
+unsigned
+vnode_getgen(struct vnode *vn)
+{
+	unsigned gen;
+
+	KASSERT(vn != NULL);
+
+	spinlock_acquire(&vn->vn_countlock);
+	gen = vn->vn_gen;
+	spinlock_release(&vn->vn_countlock);
+	return gen;
+}
+
 /*
  * Check for various things being valid.
  * Called before all VOP_* calls.
@@ -59,8 +59,15 @@ as_create(void)
 	as->as_heapbase = 0;
 	as->as_heapsz = 0;
 
+	as->as_fault_lock = lock_create("as_fault_lock");
+	if (as->as_fault_lock == NULL) {
+		kfree(as);
+		return NULL;
+	}
+
 	as->as_pgtable = kmalloc(sizeof(struct outer_pgtable));
 	if (as->as_pgtable == NULL){
+		lock_destroy(as->as_fault_lock);
 		kfree(as);
 		return NULL;
 	}
@@ -77,6 +84,7 @@ as_destroy(struct addrspace *as)
 {
 	lock_acquire(vm_lock);
 	as_destroy_pgtable(as);
+	lock_destroy(as->as_fault_lock);
 	kfree(as);
 	lock_release(vm_lock);
 }
@@ -165,6 +173,45 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_define_thread_stack(struct addrspace *as, unsigned tid, vaddr_t *stackptr)
+{
+	vaddr_t top, bottom;
+
+	/* The guard page is part of the region, but never gets mapped */
+	top = USERSTACK - tid * USER_THREAD_SLOTPAGES * PAGE_SIZE;
+	bottom = top - USER_THREAD_SLOTPAGES * PAGE_SIZE;
+
+	lock_acquire(vm_lock);
+	if (bottom < as->as_stackbase) {
+		/* Grow the stack region down to cover it */
+		if (as->as_heapbase + as->as_heapsz >= bottom) {
+			lock_release(vm_lock);
+			return ENOMEM;
+		}
+		as->as_stackbase = bottom;
+	}
+	lock_release(vm_lock);
+
+	/* Leave room for the callee to save its arguments */
+	*stackptr = top - 16;
+	return 0;
+}
+
+bool
+as_is_stack_guard(vaddr_t addr)
+{
+	vaddr_t below;
+
+	if (addr >= USERSTACK) {
+		return false;
+	}
+	/* The guard is the lowest page of each thread's slot */
+	below = (USERSTACK - (addr & PAGE_FRAME)) / PAGE_SIZE;
+	return below % USER_THREAD_SLOTPAGES == 0 &&
+		below / USER_THREAD_SLOTPAGES <= USER_THREAD_MAX;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret, pid_t child_pid)
 {
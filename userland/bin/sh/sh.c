@@ -421,6 +421,7 @@ docommand(char *buf, struct exitinfo *ei)
 		__time(&startsecs, &startnsecs);
 	}
 
+#ifdef HOST
 	pid = fork();
 	switch (pid) {
 		case -1:
@@ -443,6 +444,15 @@ docommand(char *buf, struct exitinfo *ei)
 		default:
 			break;
 	}
+#else
+	/* No need to copy the shell just to exec something else */
+	pid = spawnvp(args[0], args, NULL, 0);
+	if (pid < 0) {
+		warn("%s", args[0]);
+		exitinfo_exit(ei, 1);
+		return;
+	}
+#endif
 
 	/* parent */
 	if (bg) {
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * time - run a program and report the time and resources it used.
+ *
+ * Usage: time program [args...]
+ *
+ * Prints elapsed, user and system time, then page faults, context
+ * switches, system calls and bytes read and written, as counted by
+ * the kernel for the program and any children it waited for. User
+ * and system time are sampled at each clock tick unless "ru on" has
+ * been given at the kernel menu. Exits with the program's exit status.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <err.h>
+
+/*
+ * Subtract timeval B from A, giving microseconds.
+ */
+static
+unsigned long long
+tvdiff(const struct timeval *a, const struct timeval *b)
+{
+	long long usecs;
+
+	usecs = (long long)(a->tv_sec - b->tv_sec) * 1000000;
+	usecs += a->tv_usec - b->tv_usec;
+	return usecs;
+}
+
+/*
+ * Print microseconds as seconds, to the millisecond.
+ */
+static
+void
+printtime(const char *what, unsigned long long usecs)
+{
+	printf("%8llu.%03llu %s", usecs / 1000000, (usecs / 1000) % 1000,
+	       what);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct rusage before, after;
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs;
+	unsigned long long real;
+	pid_t pid;
+	int status;
+
+	if (argc < 2) {
+		errx(1, "Usage: time program [args...]");
+	}
+
+	/* Other children may have been reaped already; count only this one */
+	if (getrusage(RUSAGE_CHILDREN, &before) < 0) {
+		err(1, "getrusage");
+	}
+	__time(&startsecs, &startnsecs);
+
+	pid = spawnvp(argv[1], argv + 1, NULL, 0);
+	if (pid < 0) {
+		err(1, "%s", argv[1]);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+
+	__time(&endsecs, &endnsecs);
+	if (getrusage(RUSAGE_CHILDREN, &after) < 0) {
+		err(1, "getrusage");
+	}
+
+	real = (unsigned long long)(endsecs - startsecs) * 1000000;
+	real += endnsecs / 1000;
+	real -= startnsecs / 1000;
+
+	printtime("real ", real);
+	printtime("user ", tvdiff(&after.ru_utime, &before.ru_utime));
+	printtime("sys\n", tvdiff(&after.ru_stime, &before.ru_stime));
+	printf("%12llu page faults\n",
+	       after.ru_minflt - before.ru_minflt);
+	printf("%12llu voluntary context switches\n",
+	       after.ru_nvcsw - before.ru_nvcsw);
+	printf("%12llu involuntary context switches\n",
+	       after.ru_nivcsw - before.ru_nivcsw);
+	printf("%12llu system calls\n",
+	       after.ru_nsyscalls - before.ru_nsyscalls);
+	printf("%12llu bytes read\n",
+	       after.ru_inbytes - before.ru_inbytes);
+	printf("%12llu bytes written\n",
+	       after.ru_outbytes - before.ru_outbytes);
+
+	if (WIFSIGNALED(status)) {
+		warnx("%s: signal %d", argv[1], WTERMSIG(status));
+		return 1;
+	}
+	return WEXITSTATUS(status);
+}
@@ -45,6 +45,7 @@
 #include <kern/time.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
+#include <kern/spawn.h>
 
 
 /*
@@ -131,6 +132,8 @@ int rmdir(const char *dirname);
 pid_t getpid(void);
 int ioctl(int filehandle, int code, void *buf);
 off_t lseek(int filehandle, off_t pos, int code);
+ssize_t pread(int filehandle, void *buf, size_t size, off_t pos);
+ssize_t pwrite(int filehandle, const void *buf, size_t size, off_t pos);
 int fsync(int filehandle);
 int ftruncate(int filehandle, off_t size);
 int remove(const char *filename);
@@ -147,7 +150,17 @@ ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 ssize_t __getcwd(char *buf, size_t buflen);
+int __threadfork(void (*entry)(void (*)(void)), void (*func)(void));
+int threadjoin(int tid, int *status);
+__DEAD void threadexit(int status);
+int futex_wait(volatile int *addr, int val, const struct timespec *timeout);
+int futex_wake(volatile int *addr, int count);
+pid_t spawn(const char *prog, char *const *args,
+	    const struct spawn_action *actions, int nactions);
+ssize_t copy_file_range(int infd, off_t *inpos, int outfd, off_t *outpos,
+			size_t len, unsigned flags);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -156,7 +169,10 @@ ssize_t __getcwd(char *buf, size_t buflen);
  */
 
 int execvp(const char *prog, char *const *args); /* calls execv */
+pid_t spawnvp(const char *prog, char *const *args,	/* calls spawn */
+	      const struct spawn_action *actions, int nactions);
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
+int threadfork(void (*func)(void));		/* calls __threadfork */
 
 #endif /* _UNISTD_H_ */
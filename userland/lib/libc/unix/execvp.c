@@ -35,28 +35,18 @@
 #include <limits.h>
 
 /*
- * POSIX C function: exec a program on the search path. Tries
- * execv() repeatedly until one of the choices works.
+ * Fill PROGPATH (of size SIZE) with the next place to look for PROG,
+ * taking directories from the search path at *SP and advancing it.
+ * Returns 0 when the search path is used up.
  */
+static
 int
-execvp(const char *prog, char *const *args)
+nextpath(const char **sp, const char *prog, char *progpath, size_t size)
 {
-	const char *searchpath, *s, *t;
-	char progpath[PATH_MAX];
+	const char *s, *t;
 	size_t len;
 
-	if (strchr(prog, '/') != NULL) {
-		execv(prog, args);
-		return -1;
-	}
-
-	searchpath = getenv("PATH");
-	if (searchpath == NULL) {
-		errno = ENOENT;
-		return -1;
-	}
-
-	for (s = searchpath; s != NULL; s = t) {
+	for (s = *sp; s != NULL; s = t) {
 		t = strchr(s, ':');
 		if (t != NULL) {
 			len = t - s;
@@ -69,19 +59,59 @@ execvp(const char *prog, char *const *args)
 		if (len == 0) {
 			continue;
 		}
-		if (len >= sizeof(progpath)) {
+		if (len >= size) {
 			continue;
 		}
 		memcpy(progpath, s, len);
-		snprintf(progpath + len, sizeof(progpath) - len, "/%s", prog);
+		snprintf(progpath + len, size - len, "/%s", prog);
+		*sp = t;
+		return 1;
+	}
+	*sp = NULL;
+	return 0;
+}
+
+/*
+ * Whether an exec failure just means to try the next directory.
+ */
+static
+int
+routine_error(int err)
+{
+	switch (err) {
+	    case ENOENT:
+	    case ENOTDIR:
+	    case ENOEXEC:
+		return 1;
+	    default:
+		return 0;
+	}
+}
+
+/*
+ * POSIX C function: exec a program on the search path. Tries
+ * execv() repeatedly until one of the choices works.
+ */
+int
+execvp(const char *prog, char *const *args)
+{
+	const char *s;
+	char progpath[PATH_MAX];
+
+	if (strchr(prog, '/') != NULL) {
+		execv(prog, args);
+		return -1;
+	}
+
+	s = getenv("PATH");
+	if (s == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	while (nextpath(&s, prog, progpath, sizeof(progpath))) {
 		execv(progpath, args);
-		switch (errno) {
-		    case ENOENT:
-		    case ENOTDIR:
-		    case ENOEXEC:
-			/* routine errors, try next dir */
-			break;
-		    default:
+		if (!routine_error(errno)) {
 			/* oops, let's fail */
 			return -1;
 		}
@@ -89,3 +119,38 @@ execvp(const char *prog, char *const *args)
 	errno = ENOENT;
 	return -1;
 }
+
+/*
+ * Like execvp, but start the program in a new process with spawn(),
+ * applying the given file actions, and return its pid.
+ */
+pid_t
+spawnvp(const char *prog, char *const *args,
+	const struct spawn_action *actions, int nactions)
+{
+	const char *s;
+	char progpath[PATH_MAX];
+	pid_t pid;
+
+	if (strchr(prog, '/') != NULL) {
+		return spawn(prog, args, actions, nactions);
+	}
+
+	s = getenv("PATH");
+	if (s == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	while (nextpath(&s, prog, progpath, sizeof(progpath))) {
+		pid = spawn(progpath, args, actions, nactions);
+		if (pid >= 0) {
+			return pid;
+		}
+		if (!routine_error(errno)) {
+			return -1;
+		}
+	}
+	errno = ENOENT;
+	return -1;
+}
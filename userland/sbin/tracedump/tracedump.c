@@ -0,0 +1,489 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * tracedump - decode a scheduler trace written by the kernel menu
+ * command "tr dump FILE".
+ *
+ * Usage: tracedump [-s] file
+ *
+ * Prints the events from all cpus merged in time order. With -s,
+ * prints a summary instead: event counts per cpu, and the worst
+ * wakeup-to-run and system call latencies seen.
+ *
+ * Builds both for OS/161 and for the host, so traces can be looked
+ * at offline.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#include "kern/trace.h"
+
+#ifdef HOST
+/* The kernel writes big-endian, as for SFS; see dumpsfs. */
+#include <netinet/in.h> // for arpa/inet.h
+#include <arpa/inet.h>  // for ntohl
+#include "hostcompat.h"
+#define SWAP32(x) ntohl(x)
+#define SWAP16(x) ntohs(x)
+
+extern const char *hostcompat_progname;
+
+#else
+
+#define SWAP32(x) (x)
+#define SWAP16(x) (x)
+
+#endif
+
+/* Size of the table for matching up events by thread. */
+#define MATCHSIZE 1024
+
+static const char *const names[TRACE_NTYPES] = {
+	"none",
+	"switch-out",
+	"switch-in",
+	"wakeup",
+	"migrate",
+	"ipi",
+	"syscall",
+	"sysret",
+};
+
+/* Thread states, for switch-out. */
+#define NSTATES 4
+static const char *const states[NSTATES] = {
+	"run",
+	"ready",
+	"sleep",
+	"zombie",
+};
+
+/*
+ * One cpu's records, oldest first.
+ */
+struct cpurecs {
+	struct trace_cpuheader hdr;
+	struct trace_record *recs;
+	unsigned next;			/* cursor, for merging */
+};
+
+/*
+ * An event waiting for its partner (a wakeup for the switch-in, a
+ * syscall for the sysret), keyed by thread.
+ */
+struct pending {
+	uint32_t thread;
+	uint64_t when;			/* nanoseconds */
+};
+
+static struct cpurecs *cpus;
+static unsigned ncpus;
+
+////////////////////////////////////////////////////////////
+// reading
+
+static
+void
+doread(int fd, void *buf, size_t len, const char *file)
+{
+	ssize_t r;
+
+	r = read(fd, buf, len);
+	if (r < 0) {
+		err(1, "%s", file);
+	}
+	if ((size_t)r < len) {
+		errx(1, "%s: Unexpected end of file", file);
+	}
+}
+
+static
+void
+loadtrace(const char *file)
+{
+	struct trace_header th;
+	struct trace_record *tr;
+	unsigned i, j;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", file);
+	}
+
+	doread(fd, &th, sizeof(th), file);
+	if (SWAP32(th.th_magic) != TRACE_MAGIC) {
+		errx(1, "%s: Not a trace file", file);
+	}
+	if (SWAP32(th.th_version) != TRACE_VERSION) {
+		errx(1, "%s: Unknown trace version %u", file,
+		     (unsigned)SWAP32(th.th_version));
+	}
+	ncpus = SWAP32(th.th_ncpus);
+
+	cpus = malloc(ncpus * sizeof(*cpus));
+	if (cpus == NULL) {
+		errx(1, "Out of memory");
+	}
+	for (i=0; i<ncpus; i++) {
+		doread(fd, &cpus[i].hdr, sizeof(cpus[i].hdr), file);
+		cpus[i].hdr.tc_cpu = SWAP32(cpus[i].hdr.tc_cpu);
+		cpus[i].hdr.tc_count = SWAP32(cpus[i].hdr.tc_count);
+		cpus[i].hdr.tc_lost = SWAP32(cpus[i].hdr.tc_lost);
+		cpus[i].next = 0;
+
+		cpus[i].recs = malloc(cpus[i].hdr.tc_count * sizeof(*tr) + 1);
+		if (cpus[i].recs == NULL) {
+			errx(1, "Out of memory");
+		}
+		doread(fd, cpus[i].recs, cpus[i].hdr.tc_count * sizeof(*tr),
+		       file);
+		for (j=0; j<cpus[i].hdr.tc_count; j++) {
+			tr = &cpus[i].recs[j];
+			tr->tr_sec = SWAP32(tr->tr_sec);
+			tr->tr_nsec = SWAP32(tr->tr_nsec);
+			tr->tr_type = SWAP16(tr->tr_type);
+			tr->tr_cpu = SWAP16(tr->tr_cpu);
+			tr->tr_thread = SWAP32(tr->tr_thread);
+			tr->tr_a = SWAP32(tr->tr_a);
+			tr->tr_b = SWAP32(tr->tr_b);
+		}
+	}
+	close(fd);
+}
+
+static
+uint64_t
+nsecs(const struct trace_record *tr)
+{
+	return (uint64_t)tr->tr_sec * 1000000000 + tr->tr_nsec;
+}
+
+/*
+ * Return the next record in time order across all cpus, or NULL at
+ * the end.
+ */
+static
+const struct trace_record *
+nextrec(void)
+{
+	const struct trace_record *tr, *best;
+	unsigned i, which;
+
+	best = NULL;
+	which = 0;
+	for (i=0; i<ncpus; i++) {
+		if (cpus[i].next == cpus[i].hdr.tc_count) {
+			continue;
+		}
+		tr = &cpus[i].recs[cpus[i].next];
+		if (best == NULL || nsecs(tr) < nsecs(best)) {
+			best = tr;
+			which = i;
+		}
+	}
+	if (best != NULL) {
+		cpus[which].next++;
+	}
+	return best;
+}
+
+////////////////////////////////////////////////////////////
+// printing
+
+static
+void
+printrec(const struct trace_record *tr, uint64_t base)
+{
+	uint64_t t;
+	const char *name;
+
+	t = (nsecs(tr) - base) / 1000;
+	name = tr->tr_type < TRACE_NTYPES ? names[tr->tr_type] : "?";
+
+	printf("%6lu.%06lu cpu%-2u %-10s 0x%08lx ",
+	       (unsigned long)(t / 1000000), (unsigned long)(t % 1000000),
+	       (unsigned)tr->tr_cpu, name, (unsigned long)tr->tr_thread);
+	switch (tr->tr_type) {
+	    case TRACE_SWITCHOUT:
+		printf("%s\n", tr->tr_a < NSTATES ? states[tr->tr_a] : "?");
+		break;
+	    case TRACE_SWITCHIN:
+		printf("prio %lu\n", (unsigned long)tr->tr_a);
+		break;
+	    case TRACE_WAKEUP:
+		printf("on cpu%lu, prio %lu\n", (unsigned long)tr->tr_a,
+		       (unsigned long)tr->tr_b);
+		break;
+	    case TRACE_MIGRATE:
+		printf("cpu%lu -> cpu%lu\n", (unsigned long)tr->tr_a,
+		       (unsigned long)tr->tr_b);
+		break;
+	    case TRACE_IPI:
+		printf("to cpu%lu, code %lu\n", (unsigned long)tr->tr_a,
+		       (unsigned long)tr->tr_b);
+		break;
+	    case TRACE_SYSCALL:
+		printf("call %lu\n", (unsigned long)tr->tr_a);
+		break;
+	    case TRACE_SYSRET:
+		printf("call %lu, error %lu\n", (unsigned long)tr->tr_a,
+		       (unsigned long)tr->tr_b);
+		break;
+	    default:
+		printf("%lu %lu\n", (unsigned long)tr->tr_a,
+		       (unsigned long)tr->tr_b);
+		break;
+	}
+}
+
+static
+void
+dumpall(void)
+{
+	const struct trace_record *tr;
+	uint64_t base = 0;
+	unsigned i;
+
+	for (i=0; i<ncpus; i++) {
+		if (cpus[i].hdr.tc_lost > 0) {
+			printf("cpu%u: %u older events overwritten\n",
+			       cpus[i].hdr.tc_cpu, cpus[i].hdr.tc_lost);
+		}
+	}
+	while ((tr = nextrec()) != NULL) {
+		if (base == 0) {
+			base = nsecs(tr);
+		}
+		printrec(tr, base);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// summary
+
+/*
+ * Find the slot for THREAD in TABLE, which is open-addressed; returns
+ * an empty slot if it isn't there. Thread addresses are never 0.
+ */
+static
+struct pending *
+findslot(struct pending *table, uint32_t thread)
+{
+	unsigned i, n;
+
+	i = (thread >> 4) % MATCHSIZE;
+	for (n=0; n<MATCHSIZE; n++) {
+		if (table[i].thread == thread || table[i].thread == 0) {
+			return &table[i];
+		}
+		i = (i + 1) % MATCHSIZE;
+	}
+	errx(1, "Too many threads");
+}
+
+/*
+ * Note the start of an interval for THREAD (a wakeup or syscall).
+ */
+static
+void
+startwait(struct pending *table, const struct trace_record *tr)
+{
+	struct pending *p;
+
+	p = findslot(table, tr->tr_thread);
+	p->thread = tr->tr_thread;
+	p->when = nsecs(tr);
+}
+
+/*
+ * End the interval for THREAD. Returns when it started, or 0 if we
+ * didn't see it start. The slot is kept, so as not to break the
+ * probe chain; it's just marked done.
+ */
+static
+uint64_t
+endwait(struct pending *table, const struct trace_record *tr)
+{
+	struct pending *p;
+	uint64_t when;
+
+	p = findslot(table, tr->tr_thread);
+	if (p->thread == 0) {
+		return 0;
+	}
+	when = p->when;
+	p->when = 0;
+	return when;
+}
+
+static
+void
+summary(void)
+{
+	static struct pending wakeups[MATCHSIZE], syscalls[MATCHSIZE];
+	const struct trace_record *tr;
+	unsigned counts[TRACE_NTYPES];
+	uint64_t start, len;
+	uint64_t worstrun = 0, worstcall = 0;
+	uint64_t worstrunat = 0, worstcallat = 0;
+	uint32_t worstrunthread = 0, worstcallthread = 0;
+	unsigned worstcallno = 0;
+	uint64_t first = 0, last = 0;
+	unsigned i, j;
+
+	printf("%-5s %8s", "cpu", "lost");
+	for (j=1; j<TRACE_NTYPES; j++) {
+		printf(" %10s", names[j]);
+	}
+	printf("\n");
+	for (i=0; i<ncpus; i++) {
+		bzero(counts, sizeof(counts));
+		for (j=0; j<cpus[i].hdr.tc_count; j++) {
+			if (cpus[i].recs[j].tr_type < TRACE_NTYPES) {
+				counts[cpus[i].recs[j].tr_type]++;
+			}
+		}
+		printf("cpu%-2u %8u", cpus[i].hdr.tc_cpu,
+		       cpus[i].hdr.tc_lost);
+		for (j=1; j<TRACE_NTYPES; j++) {
+			printf(" %10u", counts[j]);
+		}
+		printf("\n");
+	}
+
+	while ((tr = nextrec()) != NULL) {
+		if (first == 0) {
+			first = nsecs(tr);
+		}
+		last = nsecs(tr);
+		switch (tr->tr_type) {
+		    case TRACE_WAKEUP:
+			startwait(wakeups, tr);
+			break;
+		    case TRACE_SWITCHIN:
+			start = endwait(wakeups, tr);
+			if (start == 0) {
+				break;
+			}
+			len = nsecs(tr) - start;
+			if (len > worstrun) {
+				worstrun = len;
+				worstrunat = start;
+				worstrunthread = tr->tr_thread;
+			}
+			break;
+		    case TRACE_SYSCALL:
+			startwait(syscalls, tr);
+			break;
+		    case TRACE_SYSRET:
+			start = endwait(syscalls, tr);
+			if (start == 0) {
+				break;
+			}
+			len = nsecs(tr) - start;
+			if (len > worstcall) {
+				worstcall = len;
+				worstcallat = start;
+				worstcallthread = tr->tr_thread;
+				worstcallno = tr->tr_a;
+			}
+			break;
+		}
+	}
+
+	printf("\nTrace covers %lu us\n",
+	       (unsigned long)((last - first) / 1000));
+	if (worstrun > 0) {
+		printf("Worst wakeup-to-run: %lu us, thread 0x%08lx, "
+		       "woken at %lu us\n",
+		       (unsigned long)(worstrun / 1000),
+		       (unsigned long)worstrunthread,
+		       (unsigned long)((worstrunat - first) / 1000));
+	}
+	if (worstcall > 0) {
+		printf("Worst system call: %lu us, call %u, thread 0x%08lx, "
+		       "entered at %lu us\n",
+		       (unsigned long)(worstcall / 1000), worstcallno,
+		       (unsigned long)worstcallthread,
+		       (unsigned long)((worstcallat - first) / 1000));
+	}
+}
+
+static
+void
+usage(void)
+{
+	errx(1, "Usage: tracedump [-s] file");
+}
+
+int
+main(int argc, char **argv)
+{
+	bool dosummary = false;
+	const char *file = NULL;
+	int i;
+
+#ifdef HOST
+	hostcompat_progname = argv[0];
+#endif
+
+	for (i=1; i<argc; i++) {
+		if (!strcmp(argv[i], "-s")) {
+			dosummary = true;
+		}
+		else if (argv[i][0] == '-' || file != NULL) {
+			usage();
+		}
+		else {
+			file = argv[i];
+		}
+	}
+	if (file == NULL) {
+		usage();
+	}
+
+	loadtrace(file);
+	if (dosummary) {
+		summary();
+	}
+	else {
+		dumpall();
+	}
+	return 0;
+}
@@ -0,0 +1,367 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * copytest - test copy_file_range(), and time it against read/write.
+ *
+ * Writes a FILESIZE file, then copies it twice: once the way cp used
+ * to, through a BUFSIZE user buffer with a read and a write per chunk,
+ * and once with copy_file_range. Checks both copies and prints how
+ * long each took. Then checks copying with explicit offsets leaves the
+ * seek positions alone, and the errors for flags, overlapping ranges,
+ * files open the wrong way, and offsets on a device. Last, copies
+ * within one descriptor, from an offset to its seek position, while a
+ * child writes through the same descriptor, and checks that no update
+ * to the shared seek position is lost.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#define SRCFILE		"copytest.src"
+#define DSTFILE		"copytest.dst"
+#define FILESIZE	(1024*1024)
+#define BUFSIZE		1024
+#define NSAMEFILE	64
+
+static char buf[BUFSIZE], want[BUFSIZE];
+
+/*
+ * Fill BUF with the BUFSIZE bytes the source file has at POS.
+ */
+static
+void
+fillbuf(char *b, off_t pos)
+{
+	unsigned i;
+
+	for (i=0; i<BUFSIZE; i++) {
+		b[i] = (char)((pos + i) * 7 + (pos + i) / 251);
+	}
+}
+
+static
+int
+openfile(const char *name, int flags)
+{
+	int fd;
+
+	fd = open(name, flags, 0664);
+	if (fd < 0) {
+		err(1, "%s", name);
+	}
+	return fd;
+}
+
+static
+void
+makesrc(void)
+{
+	off_t pos;
+	int fd;
+
+	fd = openfile(SRCFILE, O_WRONLY|O_CREAT|O_TRUNC);
+	for (pos=0; pos<FILESIZE; pos+=BUFSIZE) {
+		fillbuf(buf, pos);
+		if (write(fd, buf, BUFSIZE) != BUFSIZE) {
+			err(1, "%s: write", SRCFILE);
+		}
+	}
+	close(fd);
+}
+
+/*
+ * Check DSTFILE is a copy of SRCFILE.
+ */
+static
+void
+checkdst(const char *how)
+{
+	off_t pos;
+	int fd;
+
+	fd = openfile(DSTFILE, O_RDONLY);
+	for (pos=0; pos<FILESIZE; pos+=BUFSIZE) {
+		if (read(fd, buf, BUFSIZE) != BUFSIZE) {
+			errx(1, "%s: copy is short at %ld", how, (long)pos);
+		}
+		fillbuf(want, pos);
+		if (memcmp(buf, want, BUFSIZE) != 0) {
+			errx(1, "%s: wrong data at %ld", how, (long)pos);
+		}
+	}
+	if (read(fd, buf, BUFSIZE) != 0) {
+		errx(1, "%s: copy is too long", how);
+	}
+	close(fd);
+}
+
+/*
+ * Check that an operation failed with ERR.
+ */
+static
+void
+failed(ssize_t result, int err, const char *what)
+{
+	if (result >= 0) {
+		errx(1, "%s: succeeded", what);
+	}
+	if (errno != err) {
+		errx(1, "%s: got %s, expected %s",
+		     what, strerror(errno), strerror(err));
+	}
+}
+
+static
+unsigned long
+elapsed_us(time_t secs, unsigned long nsecs)
+{
+	time_t secs2;
+	unsigned long nsecs2;
+
+	__time(&secs2, &nsecs2);
+	if (nsecs2 < nsecs) {
+		secs2--;
+		nsecs2 += 1000000000;
+	}
+	return (secs2 - secs) * 1000000 + (nsecs2 - nsecs) / 1000;
+}
+
+static
+void
+test_timing(void)
+{
+	time_t secs;
+	unsigned long nsecs, us;
+	ssize_t len;
+	int from, to;
+
+	from = openfile(SRCFILE, O_RDONLY);
+	to = openfile(DSTFILE, O_WRONLY|O_CREAT|O_TRUNC);
+	__time(&secs, &nsecs);
+	while ((len = read(from, buf, BUFSIZE)) > 0) {
+		if (write(to, buf, len) != len) {
+			err(1, "%s: write", DSTFILE);
+		}
+	}
+	if (len < 0) {
+		err(1, "%s: read", SRCFILE);
+	}
+	us = elapsed_us(secs, nsecs);
+	close(to);
+	close(from);
+	checkdst("read/write");
+	printf("read/write:      %d bytes in %lu us\n", FILESIZE, us);
+
+	from = openfile(SRCFILE, O_RDONLY);
+	to = openfile(DSTFILE, O_WRONLY|O_CREAT|O_TRUNC);
+	__time(&secs, &nsecs);
+	while ((len = copy_file_range(from, NULL, to, NULL,
+				      FILESIZE, 0)) > 0) {
+		/* nothing */
+	}
+	if (len < 0) {
+		err(1, "copy_file_range");
+	}
+	us = elapsed_us(secs, nsecs);
+	close(to);
+	close(from);
+	checkdst("copy_file_range");
+	printf("copy_file_range: %d bytes in %lu us\n", FILESIZE, us);
+}
+
+static
+void
+test_offsets(void)
+{
+	off_t inpos, outpos;
+	ssize_t len;
+	int from, to;
+
+	from = openfile(SRCFILE, O_RDONLY);
+	to = openfile(DSTFILE, O_RDWR);
+	if (lseek(from, 100, SEEK_SET) < 0 || lseek(to, 200, SEEK_SET) < 0) {
+		err(1, "lseek");
+	}
+
+	/* Copy one buffer's worth from the source over the start */
+	inpos = 5 * BUFSIZE;
+	outpos = 0;
+	len = copy_file_range(from, &inpos, to, &outpos, BUFSIZE, 0);
+	if (len != BUFSIZE) {
+		errx(1, "copy at offsets: got %d", (int)len);
+	}
+	if (inpos != 6 * BUFSIZE || outpos != BUFSIZE) {
+		errx(1, "copy at offsets: offsets not updated");
+	}
+	if (lseek(from, 0, SEEK_CUR) != 100 || lseek(to, 0, SEEK_CUR) != 200) {
+		errx(1, "copy at offsets: seek position moved");
+	}
+	if (pread(to, buf, BUFSIZE, 0) != BUFSIZE) {
+		err(1, "%s: pread", DSTFILE);
+	}
+	fillbuf(want, 5 * BUFSIZE);
+	if (memcmp(buf, want, BUFSIZE) != 0) {
+		errx(1, "copy at offsets: wrong data");
+	}
+
+	/* Past the end there's nothing to copy */
+	inpos = FILESIZE;
+	len = copy_file_range(from, &inpos, to, NULL, BUFSIZE, 0);
+	if (len != 0) {
+		errx(1, "copy past EOF: got %d", (int)len);
+	}
+
+	failed(copy_file_range(from, NULL, to, NULL, BUFSIZE, 1), EINVAL,
+	       "copy with flags");
+	inpos = 0;
+	outpos = BUFSIZE / 2;
+	failed(copy_file_range(to, &inpos, to, &outpos, BUFSIZE, 0), EINVAL,
+	       "overlapping copy");
+	failed(copy_file_range(to, NULL, from, NULL, BUFSIZE, 0), EBADF,
+	       "copy to read-only");
+	failed(copy_file_range(-1, NULL, to, NULL, BUFSIZE, 0), EBADF,
+	       "copy from fd -1");
+	inpos = 0;
+	failed(copy_file_range(STDIN_FILENO, &inpos, to, NULL, BUFSIZE, 0),
+	       ESPIPE, "copy from console at an offset");
+
+	close(to);
+	close(from);
+	printf("offsets and errors: ok\n");
+}
+
+/*
+ * Copy from an offset in a file to the seek position of the same open
+ * file. The seek position must still be locked even though the input
+ * side has its own offset.
+ */
+static
+void
+test_samefile(void)
+{
+	off_t inpos, start;
+	ssize_t len;
+	pid_t pid;
+	int fd, status;
+	unsigned i;
+
+	fd = openfile(DSTFILE, O_RDWR);
+
+	/* Once, to check the data and where everything ends up */
+	start = 2 * BUFSIZE;
+	if (lseek(fd, start, SEEK_SET) < 0) {
+		err(1, "lseek");
+	}
+	inpos = 10 * BUFSIZE;
+	len = copy_file_range(fd, &inpos, fd, NULL, BUFSIZE, 0);
+	if (len != BUFSIZE) {
+		errx(1, "copy within a file: got %d", (int)len);
+	}
+	if (inpos != 11 * BUFSIZE) {
+		errx(1, "copy within a file: offset not updated");
+	}
+	if (lseek(fd, 0, SEEK_CUR) != start + BUFSIZE) {
+		errx(1, "copy within a file: seek position not advanced");
+	}
+	if (pread(fd, buf, BUFSIZE, start) != BUFSIZE) {
+		err(1, "%s: pread", DSTFILE);
+	}
+	fillbuf(want, 10 * BUFSIZE);
+	if (memcmp(buf, want, BUFSIZE) != 0) {
+		errx(1, "copy within a file: wrong data");
+	}
+
+	/*
+	 * Then many times, racing with a child writing through the same
+	 * descriptor. Each of us moves the shared seek position on by
+	 * BUFSIZE per call, so if either loses the other's update it
+	 * ends up short. The source range stays below the seek position,
+	 * so the ranges never overlap.
+	 */
+	start = 4 * BUFSIZE;
+	if (lseek(fd, start, SEEK_SET) < 0) {
+		err(1, "lseek");
+	}
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		fillbuf(buf, 0);
+		for (i=0; i<NSAMEFILE; i++) {
+			if (write(fd, buf, BUFSIZE) != BUFSIZE) {
+				err(1, "%s: write", DSTFILE);
+			}
+		}
+		_exit(0);
+	}
+	for (i=0; i<NSAMEFILE; i++) {
+		inpos = 0;
+		len = copy_file_range(fd, &inpos, fd, NULL, BUFSIZE, 0);
+		if (len < 0) {
+			err(1, "copy within a file");
+		}
+		if (len != BUFSIZE) {
+			errx(1, "copy within a file: got %d", (int)len);
+		}
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "writer child failed");
+	}
+	if (lseek(fd, 0, SEEK_CUR) != start + 2 * NSAMEFILE * BUFSIZE) {
+		errx(1, "copy within a file: seek position update lost");
+	}
+
+	close(fd);
+	printf("same file: ok\n");
+}
+
+int
+main(void)
+{
+	makesrc();
+	test_timing();
+	test_offsets();
+	test_samefile();
+	remove(DSTFILE);
+	remove(SRCFILE);
+	printf("copytest: Passed.\n");
+	return 0;
+}
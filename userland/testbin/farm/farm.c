@@ -65,20 +65,27 @@ spawnv(const char *prog, char **argv)
 	}
 }
 
+/*
+ * Reap the children in whatever order they finish.
+ */
 static
 void
 waitall(void)
 {
 	int i, status;
+	pid_t pid;
+
 	for (i=0; i<npids; i++) {
-		if (waitpid(pids[i], &status, 0)<0) {
-			warn("waitpid for %d", pids[i]);
+		pid = waitpid(WAIT_ANY, &status, 0);
+		if (pid<0) {
+			warn("waitpid");
+			break;
 		}
 		else if (WIFSIGNALED(status)) {
-			warnx("pid %d: signal %d", pids[i], WTERMSIG(status));
+			warnx("pid %d: signal %d", pid, WTERMSIG(status));
 		}
 		else if (WEXITSTATUS(status) != 0) {
-			warnx("pid %d: exit %d", pids[i], WEXITSTATUS(status));
+			warnx("pid %d: exit %d", pid, WEXITSTATUS(status));
 		}
 	}
 }
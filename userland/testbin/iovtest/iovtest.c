@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * iovtest - test readv() and writev().
+ *
+ * Writes NRECS records, each a small header and a payload in separate
+ * buffers, with one writev per record, and checks the seek position
+ * moves past each whole record. Reads them back with readv into a
+ * header buffer and a payload buffer split at a different place than
+ * they were written, with an empty buffer in between, and checks the
+ * data. Then checks short reads at EOF and the errors for a bad
+ * iovec count and a file open the wrong way.
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#define FILENAME	"iovtest.dat"
+#define NRECS		16
+#define PAYLOAD		300
+
+struct header {
+	unsigned h_num;
+	unsigned h_len;
+};
+
+#define RECSIZE		(sizeof(struct header) + PAYLOAD)
+
+/*
+ * Fill BUF with the payload record NUM should have.
+ */
+static
+void
+fillpayload(char *buf, unsigned num)
+{
+	unsigned i;
+
+	for (i=0; i<PAYLOAD; i++) {
+		buf[i] = (char)(num * 13 + i);
+	}
+}
+
+/*
+ * Check the seek position of FD is POS.
+ */
+static
+void
+checkpos(int fd, off_t pos, const char *when)
+{
+	off_t now;
+
+	now = lseek(fd, 0, SEEK_CUR);
+	if (now < 0) {
+		err(1, "lseek");
+	}
+	if (now != pos) {
+		errx(1, "%s: seek position is %ld, expected %ld",
+		     when, (long)now, (long)pos);
+	}
+}
+
+/*
+ * Check that an operation failed with ERR.
+ */
+static
+void
+failed(ssize_t result, int err, const char *what)
+{
+	if (result >= 0) {
+		errx(1, "%s: succeeded", what);
+	}
+	if (errno != err) {
+		errx(1, "%s: got %s, expected %s",
+		     what, strerror(errno), strerror(err));
+	}
+}
+
+static
+void
+writerecs(void)
+{
+	struct header h;
+	char payload[PAYLOAD];
+	struct iovec iov[2];
+	ssize_t len;
+	unsigned i;
+	int fd;
+
+	fd = open(FILENAME, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+
+	for (i=0; i<NRECS; i++) {
+		h.h_num = i;
+		h.h_len = PAYLOAD;
+		fillpayload(payload, i);
+
+		iov[0].iov_base = &h;
+		iov[0].iov_len = sizeof(h);
+		iov[1].iov_base = payload;
+		iov[1].iov_len = PAYLOAD;
+		len = writev(fd, iov, 2);
+		if (len < 0) {
+			err(1, "writev record %u", i);
+		}
+		if ((size_t)len != RECSIZE) {
+			errx(1, "writev record %u: short write (%d)",
+			     i, (int)len);
+		}
+		checkpos(fd, (off_t)(i + 1) * RECSIZE, "after writev");
+	}
+
+	failed(readv(fd, iov, 2), EBADF, "readv from write-only");
+	close(fd);
+}
+
+static
+void
+readrecs(void)
+{
+	char head[sizeof(struct header) + 10];
+	char rest[PAYLOAD - 10];
+	char want[PAYLOAD];
+	struct header h;
+	struct iovec iov[3];
+	ssize_t len;
+	unsigned i;
+	int fd;
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+
+	/* Split the record ten bytes into the payload */
+	iov[0].iov_base = head;
+	iov[0].iov_len = sizeof(head);
+	iov[1].iov_base = NULL;
+	iov[1].iov_len = 0;
+	iov[2].iov_base = rest;
+	iov[2].iov_len = sizeof(rest);
+
+	for (i=0; i<NRECS; i++) {
+		len = readv(fd, iov, 3);
+		if (len < 0) {
+			err(1, "readv record %u", i);
+		}
+		if ((size_t)len != RECSIZE) {
+			errx(1, "readv record %u: short read (%d)",
+			     i, (int)len);
+		}
+		memcpy(&h, head, sizeof(h));
+		if (h.h_num != i || h.h_len != PAYLOAD) {
+			errx(1, "record %u: bad header", i);
+		}
+		fillpayload(want, i);
+		if (memcmp(head + sizeof(h), want, 10) != 0 ||
+		    memcmp(rest, want + 10, sizeof(rest)) != 0) {
+			errx(1, "record %u: wrong data", i);
+		}
+	}
+	checkpos(fd, (off_t)NRECS * RECSIZE, "after readv");
+
+	/* Nothing left */
+	len = readv(fd, iov, 3);
+	if (len != 0) {
+		errx(1, "readv at EOF: got %d", (int)len);
+	}
+
+	/* Half a record left: the first buffer fills, the last doesn't */
+	if (lseek(fd, -(off_t)RECSIZE / 2, SEEK_END) < 0) {
+		err(1, "lseek");
+	}
+	len = readv(fd, iov, 3);
+	if (len != (ssize_t)(RECSIZE / 2)) {
+		errx(1, "readv near EOF: got %d, expected %d",
+		     (int)len, (int)(RECSIZE / 2));
+	}
+
+	failed(readv(fd, iov, 0), EINVAL, "readv of 0 iovecs");
+	failed(readv(fd, iov, -1), EINVAL, "readv of -1 iovecs");
+	failed(writev(fd, iov, 3), EBADF, "writev to read-only");
+	close(fd);
+}
+
+int
+main(void)
+{
+	writerecs();
+	printf("iovtest: %d records written\n", NRECS);
+	readrecs();
+	printf("iovtest: %d records read back\n", NRECS);
+	remove(FILENAME);
+	printf("iovtest: passed\n");
+	return 0;
+}
@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * prwtest - test pread() and pwrite().
+ *
+ * Writes a file block by block with pwrite, back to front, and reads
+ * it back with pread, checking that the seek position never moves.
+ * Checks the errors for a negative offset, a device, and a file open
+ * the wrong way. Then has NKIDS processes pread the file at once
+ * through one shared descriptor, each in its own order, and checks
+ * that every block comes back right and the shared seek position is
+ * still where it was.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#define FILENAME	"prwtest.dat"
+#define BLOCKSIZE	512
+#define NBLOCKS		32
+#define NKIDS		4
+#define NPASSES		8
+
+/*
+ * Fill BUF with the contents block NUM should have.
+ */
+static
+void
+fillblock(char *buf, unsigned num)
+{
+	unsigned i;
+
+	for (i=0; i<BLOCKSIZE; i++) {
+		buf[i] = (char)(num * 7 + i);
+	}
+}
+
+/*
+ * Read block NUM with pread and check it.
+ */
+static
+void
+checkblock(int fd, unsigned num)
+{
+	char want[BLOCKSIZE], got[BLOCKSIZE];
+	ssize_t len;
+
+	len = pread(fd, got, BLOCKSIZE, (off_t)num * BLOCKSIZE);
+	if (len < 0) {
+		err(1, "pread block %u", num);
+	}
+	if (len != BLOCKSIZE) {
+		errx(1, "pread block %u: short read (%d)", num, (int)len);
+	}
+	fillblock(want, num);
+	if (memcmp(want, got, BLOCKSIZE) != 0) {
+		errx(1, "block %u: wrong data", num);
+	}
+}
+
+/*
+ * Check the seek position of FD is still POS.
+ */
+static
+void
+checkpos(int fd, off_t pos, const char *when)
+{
+	off_t now;
+
+	now = lseek(fd, 0, SEEK_CUR);
+	if (now < 0) {
+		err(1, "lseek");
+	}
+	if (now != pos) {
+		errx(1, "%s: seek position moved to %ld", when, (long)now);
+	}
+}
+
+/*
+ * Check that an operation failed with ERR.
+ */
+static
+void
+failed(ssize_t result, int err, const char *what)
+{
+	if (result >= 0) {
+		errx(1, "%s: succeeded", what);
+	}
+	if (errno != err) {
+		errx(1, "%s: got %s, expected %s",
+		     what, strerror(errno), strerror(err));
+	}
+}
+
+static
+void
+writefile(void)
+{
+	char buf[BLOCKSIZE];
+	ssize_t len;
+	int fd;
+	unsigned i;
+
+	fd = open(FILENAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+
+	/* Back to front, so every write is somewhere the position isn't */
+	for (i=NBLOCKS; i-- > 0; ) {
+		fillblock(buf, i);
+		len = pwrite(fd, buf, BLOCKSIZE, (off_t)i * BLOCKSIZE);
+		if (len < 0) {
+			err(1, "pwrite block %u", i);
+		}
+		if (len != BLOCKSIZE) {
+			errx(1, "pwrite block %u: short write (%d)",
+			     i, (int)len);
+		}
+	}
+	checkpos(fd, 0, "after pwrite");
+
+	for (i=0; i<NBLOCKS; i++) {
+		checkblock(fd, i);
+	}
+	checkpos(fd, 0, "after pread");
+
+	/* Reading past the end gets nothing */
+	len = pread(fd, buf, BLOCKSIZE, (off_t)NBLOCKS * BLOCKSIZE);
+	if (len != 0) {
+		errx(1, "pread past EOF: got %d", (int)len);
+	}
+
+	failed(pread(fd, buf, BLOCKSIZE, -1), EINVAL, "pread at -1");
+	failed(pwrite(fd, buf, BLOCKSIZE, -1), EINVAL, "pwrite at -1");
+	close(fd);
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	failed(pwrite(fd, buf, BLOCKSIZE, 0), EBADF, "pwrite to read-only");
+	close(fd);
+
+	failed(pread(STDIN_FILENO, buf, BLOCKSIZE, 0), ESPIPE,
+	       "pread from console");
+	failed(pread(-1, buf, BLOCKSIZE, 0), EBADF, "pread from fd -1");
+}
+
+/*
+ * Child NUM: read every block NPASSES times, starting at a different
+ * place each pass.
+ */
+static
+void
+reader(int fd, unsigned num)
+{
+	unsigned pass, i;
+
+	for (pass=0; pass<NPASSES; pass++) {
+		for (i=0; i<NBLOCKS; i++) {
+			checkblock(fd, (i + num * 5 + pass * 3) % NBLOCKS);
+		}
+	}
+	_exit(0);
+}
+
+static
+void
+readers(void)
+{
+	pid_t pids[NKIDS];
+	int fd, status, bad;
+	unsigned i;
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	/* Somewhere none of the readers should disturb */
+	if (lseek(fd, 100, SEEK_SET) < 0) {
+		err(1, "lseek");
+	}
+
+	for (i=0; i<NKIDS; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			reader(fd, i);
+		}
+	}
+
+	bad = 0;
+	for (i=0; i<NKIDS; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			warnx("reader %u failed", i);
+			bad = 1;
+		}
+	}
+	if (bad) {
+		exit(1);
+	}
+	checkpos(fd, 100, "after readers");
+	close(fd);
+}
+
+int
+main(void)
+{
+	writefile();
+	printf("prwtest: pread/pwrite ok\n");
+	readers();
+	printf("prwtest: %d concurrent readers ok\n", NKIDS);
+	remove(FILENAME);
+	printf("prwtest: passed\n");
+	return 0;
+}
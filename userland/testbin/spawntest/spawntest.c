@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * spawntest - test spawn(), and compare it with fork and execv.
+ *
+ * Checks that spawn reports a bad program or bad file action as an
+ * error without leaving a child behind, that file actions take effect
+ * in the child, and that exit codes come back. Then times starting
+ * /bin/true NRUNS times each way, from a parent with a large heap
+ * that fork has to copy and spawn doesn't.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#define NRUNS		50
+#define HEAPSIZE	(512*1024)
+#define OUTFILE		"spawntest.out"
+#define MESSAGE		"spawned\n"
+
+static char *prog;
+
+/*
+ * Wait for PID and check it exited with CODE.
+ */
+static
+void
+reap(pid_t pid, int code)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != code) {
+		errx(1, "pid %d: status 0x%x, expected exit %d",
+		     pid, status, code);
+	}
+}
+
+/*
+ * Check that spawn failed with ERR and there's no child to show for it.
+ */
+static
+void
+failed(pid_t pid, int err, const char *what)
+{
+	int status;
+
+	if (pid >= 0) {
+		errx(1, "%s: spawn succeeded", what);
+	}
+	if (errno != err) {
+		errx(1, "%s: got %s, expected %s",
+		     what, strerror(errno), strerror(err));
+	}
+	if (waitpid(WAIT_ANY, &status, WNOHANG) >= 0 || errno != ECHILD) {
+		errx(1, "%s: left a child behind", what);
+	}
+	printf("%s: %s, ok\n", what, strerror(err));
+}
+
+static
+void
+test_errors(void)
+{
+	char *args[2];
+	struct spawn_action act;
+
+	args[0] = (char *)"/bin/true";
+	args[1] = NULL;
+
+	failed(spawn("/nonexistent", args, NULL, 0), ENOENT,
+	       "nonexistent program");
+
+	act.sa_op = 12345;
+	act.sa_fd = 0;
+	act.sa_newfd = 0;
+	failed(spawn(args[0], args, &act, 1), EINVAL, "bad file action");
+
+	act.sa_op = SPAWN_CLOSE;
+	act.sa_fd = -1;
+	failed(spawn(args[0], args, &act, 1), EBADF, "close of bad fd");
+
+	failed(spawn(args[0], args, NULL, -1), EINVAL, "negative count");
+}
+
+static
+void
+test_exitcode(void)
+{
+	char *args[2];
+
+	args[0] = (char *)"/bin/false";
+	args[1] = NULL;
+	reap(spawnvp("false", args, NULL, 0), 1);
+	printf("exit code: ok\n");
+}
+
+static
+void
+test_actions(void)
+{
+	struct spawn_action acts[2];
+	char *args[3];
+	char buf[64];
+	int fd, len;
+
+	fd = open(OUTFILE, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", OUTFILE);
+	}
+
+	/* Child's stdout goes to the file, and it doesn't keep fd open */
+	acts[0].sa_op = SPAWN_DUP2;
+	acts[0].sa_fd = fd;
+	acts[0].sa_newfd = STDOUT_FILENO;
+	acts[1].sa_op = SPAWN_CLOSE;
+	acts[1].sa_fd = fd;
+	acts[1].sa_newfd = 0;
+
+	args[0] = prog;
+	args[1] = (char *)"-child";
+	args[2] = NULL;
+	reap(spawnvp(prog, args, acts, 2), 0);
+	close(fd);
+
+	fd = open(OUTFILE, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", OUTFILE);
+	}
+	len = read(fd, buf, sizeof(buf) - 1);
+	if (len < 0) {
+		err(1, "%s: read", OUTFILE);
+	}
+	close(fd);
+	remove(OUTFILE);
+	buf[len] = 0;
+	if (strcmp(buf, MESSAGE) != 0) {
+		errx(1, "file actions: child wrote \"%s\"", buf);
+	}
+	printf("file actions: ok\n");
+}
+
+static
+unsigned long
+elapsed_us(time_t secs, unsigned long nsecs)
+{
+	time_t secs2;
+	unsigned long nsecs2;
+
+	__time(&secs2, &nsecs2);
+	if (nsecs2 < nsecs) {
+		secs2--;
+		nsecs2 += 1000000000;
+	}
+	return (secs2 - secs) * 1000000 + (nsecs2 - nsecs) / 1000;
+}
+
+static
+void
+test_timing(void)
+{
+	char *args[2];
+	char *heap;
+	time_t secs;
+	unsigned long nsecs, us;
+	unsigned i;
+	pid_t pid;
+
+	/* Give fork something to copy */
+	heap = malloc(HEAPSIZE);
+	if (heap == NULL) {
+		err(1, "malloc");
+	}
+	memset(heap, 1, HEAPSIZE);
+
+	args[0] = (char *)"/bin/true";
+	args[1] = NULL;
+
+	__time(&secs, &nsecs);
+	for (i=0; i<NRUNS; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			execv(args[0], args);
+			_exit(255);
+		}
+		reap(pid, 0);
+	}
+	us = elapsed_us(secs, nsecs);
+	printf("fork+execv: %u runs in %lu us, %lu us each\n",
+	       NRUNS, us, us / NRUNS);
+
+	__time(&secs, &nsecs);
+	for (i=0; i<NRUNS; i++) {
+		pid = spawn(args[0], args, NULL, 0);
+		if (pid < 0) {
+			err(1, "spawn");
+		}
+		reap(pid, 0);
+	}
+	us = elapsed_us(secs, nsecs);
+	printf("spawn:      %u runs in %lu us, %lu us each\n",
+	       NRUNS, us, us / NRUNS);
+
+	free(heap);
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc == 2 && !strcmp(argv[1], "-child")) {
+		write(STDOUT_FILENO, MESSAGE, strlen(MESSAGE));
+		return 0;
+	}
+	prog = argc > 0 ? argv[0] : (char *)"/testbin/spawntest";
+
+	test_errors();
+	test_exitcode();
+	test_actions();
+	test_timing();
+	printf("spawntest: Passed.\n");
+	return 0;
+}
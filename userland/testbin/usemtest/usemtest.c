@@ -36,6 +36,11 @@
  *
  * The last part of the test will generally hang, sometimes in fork,
  * unless your filetable/open-file locking is just so.
+ *
+ * Afterwards it times a ping-pong between two semfs semaphores against
+ * the same ping-pong between two threads using semaphores built on
+ * futex_wait/futex_wake, which only enter the kernel to sleep or to
+ * wake someone.
  */
 
 #include <sys/types.h>
@@ -43,6 +48,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <err.h>
 
 #define ONCELOOPS   3
@@ -50,6 +56,7 @@
 #define THRICELOOPS 1
 #define LOOPS (ONCELOOPS + 2*TWICELOOPS + 3*THRICELOOPS)
 #define NUMJOBS 4
+#define PINGPONGS 2000
 
 /*
  * Print to the console, one character at a time to encourage
@@ -376,6 +383,225 @@ conctest(void)
 	}
 }
 
+////////////////////////////////////////////////////////////
+// futex semaphores
+
+/*
+ * Semaphore built on a futex. COUNT is the semaphore value and is the
+ * futex word; WAITERS says whether V needs to make a system call.
+ */
+struct fsem {
+	volatile int count;
+	volatile int waiters;
+};
+
+/*
+ * Compare and swap using LL/SC: if *P is OLD, store NEW. Returns
+ * nonzero on success. May fail spuriously if the SC loses, so call
+ * it in a loop.
+ */
+static
+int
+cas(volatile int *p, int old, int new)
+{
+	int x, y;
+
+	y = new;
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		".set noreorder;"	/* we fill the delay slot */
+		"ll %0, 0(%2);"		/*   x = *p */
+		"bne %0, %3, 1f;"	/*   if (x != old) fail */
+		"nop;"
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"sync;"			/*   order against later loads */
+		"1: .set pop"		/* restore assembler mode */
+		: "=&r" (x), "+r" (y) : "r" (p), "r" (old) : "memory");
+	return x == old && y != 0;
+}
+
+static
+void
+atomic_add(volatile int *p, int n)
+{
+	int x;
+
+	do {
+		x = *p;
+	} while (!cas(p, x, x + n));
+}
+
+static
+void
+fsem_init(struct fsem *sem, int count)
+{
+	sem->count = count;
+	sem->waiters = 0;
+}
+
+static
+void
+fsem_P(struct fsem *sem)
+{
+	int x;
+
+	while (1) {
+		x = sem->count;
+		if (x > 0) {
+			if (cas(&sem->count, x, x - 1)) {
+				return;
+			}
+			continue;
+		}
+		/*
+		 * Announce ourselves before sleeping; the kernel rechecks
+		 * the count, so a V in between makes futex_wait return
+		 * EAGAIN instead of sleeping.
+		 */
+		atomic_add(&sem->waiters, 1);
+		if (futex_wait(&sem->count, 0, NULL) < 0 && errno != EAGAIN) {
+			err(1, "futex_wait");
+		}
+		atomic_add(&sem->waiters, -1);
+	}
+}
+
+static
+void
+fsem_V(struct fsem *sem)
+{
+	atomic_add(&sem->count, 1);
+	if (sem->waiters > 0) {
+		if (futex_wake(&sem->count, 1) < 0) {
+			err(1, "futex_wake");
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// ping-pong benchmark
+
+/*
+ * Microseconds since START.
+ */
+static
+unsigned long
+elapsed_us(time_t startsecs, unsigned long startnsecs)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	if (nsecs < startnsecs) {
+		secs--;
+		nsecs += 1000000000;
+	}
+	return (secs - startsecs) * 1000000 + (nsecs - startnsecs) / 1000;
+}
+
+static
+unsigned long
+semfs_pingpong(void)
+{
+	struct usem ping, pong;
+	time_t secs;
+	unsigned long nsecs, us;
+	unsigned i;
+	pid_t pid;
+
+	usem_init(&ping, "ping", 0);
+	usem_init(&pong, "pong", 0);
+	usem_open(&ping);
+	usem_open(&pong);
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		for (i=0; i<PINGPONGS; i++) {
+			P(&ping);
+			V(&pong);
+		}
+		_exit(0);
+	}
+
+	__time(&secs, &nsecs);
+	for (i=0; i<PINGPONGS; i++) {
+		V(&ping);
+		P(&pong);
+	}
+	us = elapsed_us(secs, nsecs);
+	dowait(pid, 0);
+
+	usem_close(&ping);
+	usem_close(&pong);
+	usem_cleanup(&ping);
+	usem_cleanup(&pong);
+	return us;
+}
+
+static struct fsem fping, fpong;
+
+static
+void
+futex_ponger(void)
+{
+	unsigned i;
+
+	for (i=0; i<PINGPONGS; i++) {
+		fsem_P(&fping);
+		fsem_V(&fpong);
+	}
+}
+
+static
+unsigned long
+futex_pingpong(void)
+{
+	time_t secs;
+	unsigned long nsecs, us;
+	unsigned i;
+	int tid, status;
+
+	fsem_init(&fping, 0);
+	fsem_init(&fpong, 0);
+
+	tid = threadfork(futex_ponger);
+	if (tid < 0) {
+		err(1, "threadfork");
+	}
+
+	__time(&secs, &nsecs);
+	for (i=0; i<PINGPONGS; i++) {
+		fsem_V(&fping);
+		fsem_P(&fpong);
+	}
+	us = elapsed_us(secs, nsecs);
+
+	if (threadjoin(tid, &status) < 0) {
+		warn("threadjoin");
+	}
+	return us;
+}
+
+static
+void
+pingpongtest(void)
+{
+	unsigned long us;
+
+	say("Ping-pong...\n");
+	us = semfs_pingpong();
+	printf("semfs: %u round trips in %lu us (%lu us each)\n",
+	       PINGPONGS, us, us / PINGPONGS);
+	us = futex_pingpong();
+	printf("futex: %u round trips in %lu us (%lu us each)\n",
+	       PINGPONGS, us, us / PINGPONGS);
+}
+
 ////////////////////////////////////////////////////////////
 // concurrent use test
 
@@ -384,6 +610,7 @@ main(void)
 {
 	basetest();
 	conctest();
+	pingpongtest();
 	say("Passed.\n");
 	return 0;
 }
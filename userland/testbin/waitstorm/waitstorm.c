@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * waitstorm - many processes in waitpid at once.
+ *
+ * Starts NPARENTS processes, each of which forks a child, waits for
+ * it, and repeats, NROUNDS times. Each child naps briefly before
+ * exiting, so that most of the parents are sitting in waitpid
+ * whenever a child exits. If every exit wakes every waiting parent,
+ * this takes much longer than it ought to.
+ *
+ * Also checks that each parent gets its own child's exit code.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#define NPARENTS	16
+#define NROUNDS		20
+#define NAPNSECS	2000000		/* 2 ms */
+
+static
+void
+child(unsigned round)
+{
+	struct timespec nap;
+
+	nap.tv_sec = 0;
+	nap.tv_nsec = NAPNSECS;
+	nanosleep(&nap, NULL);
+	_exit(round % 100);
+}
+
+static
+void
+parent(unsigned num)
+{
+	unsigned i;
+	pid_t pid;
+	int status;
+
+	for (i=0; i<NROUNDS; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "parent %u: fork", num);
+		}
+		if (pid == 0) {
+			child(i);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "parent %u: waitpid", num);
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != (int)(i % 100)) {
+			errx(1, "parent %u: child %d: wrong status 0x%x",
+			     num, pid, status);
+		}
+	}
+	_exit(0);
+}
+
+int
+main(void)
+{
+	pid_t pids[NPARENTS];
+	time_t secs, secs2;
+	unsigned long nsecs, nsecs2, us;
+	unsigned i, failures = 0;
+	int status;
+
+	printf("waitstorm: %u parents, %u children each\n",
+	       NPARENTS, NROUNDS);
+
+	__time(&secs, &nsecs);
+	for (i=0; i<NPARENTS; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			parent(i);
+		}
+	}
+	for (i=0; i<NPARENTS; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			warn("waitpid");
+			failures++;
+		}
+		else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			failures++;
+		}
+	}
+	__time(&secs2, &nsecs2);
+
+	if (nsecs2 < nsecs) {
+		secs2--;
+		nsecs2 += 1000000000;
+	}
+	us = (secs2 - secs) * 1000000 + (nsecs2 - nsecs) / 1000;
+	/* The parents run side by side, so a round is total / NROUNDS */
+	printf("waitstorm: %u waits in %lu us; %lu us per round, "
+	       "of which %u us is the child's nap\n",
+	       NPARENTS * NROUNDS, us, us / NROUNDS, NAPNSECS / 1000);
+
+	if (failures > 0) {
+		errx(1, "%u parents failed", failures);
+	}
+	printf("waitstorm: Passed.\n");
+	return 0;
+}
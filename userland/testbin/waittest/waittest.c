@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * waittest - test waitpid() with WNOHANG and with WAIT_ANY.
+ *
+ * Checks that:
+ *   - waiting for any child with no children gives ECHILD;
+ *   - WNOHANG on a child that is still running returns 0;
+ *   - a child that has been reaped can't be waited for again;
+ *   - WAIT_ANY reaps exited children in the order they exited.
+ *
+ * For the last, NKIDS children each sleep a different time, the last
+ * forked the shortest, so they exit in the reverse of the order they
+ * were started. Once they've all had time to exit, WAIT_ANY with
+ * WNOHANG should hand them back in that exit order.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#define NKIDS		5
+#define STEPNSECS	100000000	/* 100 ms between exits */
+
+/*
+ * Sleep for N steps.
+ */
+static
+void
+nap(unsigned n)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ((unsigned long long)n * STEPNSECS) / 1000000000;
+	ts.tv_nsec = ((unsigned long long)n * STEPNSECS) % 1000000000;
+	nanosleep(&ts, NULL);
+}
+
+/*
+ * Fork a child that sleeps for STEPS steps and exits with CODE.
+ */
+static
+pid_t
+startkid(unsigned steps, int code)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		nap(steps);
+		_exit(code);
+	}
+	return pid;
+}
+
+/*
+ * Check that an operation failed with ERR, or with ERR2 if nonzero.
+ */
+static
+void
+failed(pid_t result, int err, int err2, const char *what)
+{
+	if (result >= 0) {
+		errx(1, "%s: returned %d", what, (int)result);
+	}
+	if (errno != err && (err2 == 0 || errno != err2)) {
+		errx(1, "%s: got %s, expected %s",
+		     what, strerror(errno), strerror(err));
+	}
+}
+
+static
+void
+test_nochildren(void)
+{
+	int status;
+
+	failed(waitpid(WAIT_ANY, &status, 0), ECHILD, 0,
+	       "waitpid(-1) with no children");
+	failed(waitpid(WAIT_ANY, &status, WNOHANG), ECHILD, 0,
+	       "waitpid(-1, WNOHANG) with no children");
+	printf("no children: ok\n");
+}
+
+static
+void
+test_nohang(void)
+{
+	pid_t pid, result;
+	int status;
+
+	pid = startkid(2, 7);
+
+	result = waitpid(pid, &status, WNOHANG);
+	if (result != 0) {
+		errx(1, "waitpid(pid, WNOHANG) on a live child: got %d",
+		     (int)result);
+	}
+	result = waitpid(WAIT_ANY, &status, WNOHANG);
+	if (result != 0) {
+		errx(1, "waitpid(-1, WNOHANG) on a live child: got %d",
+		     (int)result);
+	}
+
+	result = waitpid(pid, &status, 0);
+	if (result < 0) {
+		err(1, "waitpid");
+	}
+	if (result != pid) {
+		errx(1, "waitpid: got pid %d, expected %d",
+		     (int)result, (int)pid);
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 7) {
+		errx(1, "waitpid: wrong exit status 0x%x", status);
+	}
+
+	/* It's gone now; the pid may or may not have been reused. */
+	failed(waitpid(pid, &status, 0), ESRCH, ECHILD,
+	       "waitpid on a reaped child");
+	failed(waitpid(pid, &status, WNOHANG), ESRCH, ECHILD,
+	       "waitpid(WNOHANG) on a reaped child");
+	printf("WNOHANG: ok\n");
+}
+
+static
+void
+test_order(void)
+{
+	pid_t pids[NKIDS], result;
+	int status;
+	unsigned i, want;
+
+	for (i=0; i<NKIDS; i++) {
+		pids[i] = startkid(NKIDS - i, i);
+	}
+
+	/* Give them all time to exit */
+	nap(NKIDS + 3);
+
+	for (i=0; i<NKIDS; i++) {
+		want = NKIDS - 1 - i;
+		result = waitpid(WAIT_ANY, &status, WNOHANG);
+		if (result < 0) {
+			err(1, "waitpid(-1)");
+		}
+		if (result == 0) {
+			errx(1, "waitpid(-1): child %u hasn't exited yet",
+			     want);
+		}
+		if (result != pids[want]) {
+			errx(1, "waitpid(-1): got pid %d, expected child %u "
+			     "(pid %d)", (int)result, want, (int)pids[want]);
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != (int)want) {
+			errx(1, "waitpid(-1): wrong exit status 0x%x",
+			     status);
+		}
+	}
+
+	failed(waitpid(WAIT_ANY, &status, WNOHANG), ECHILD, 0,
+	       "waitpid(-1) after reaping everything");
+	failed(waitpid(pids[0], &status, 0), ESRCH, ECHILD,
+	       "waitpid on a child reaped by waitpid(-1)");
+	printf("WAIT_ANY order: ok\n");
+}
+
+int
+main(void)
+{
+	test_nochildren();
+	test_nohang();
+	test_order();
+	printf("waittest: Passed.\n");
+	return 0;
+}